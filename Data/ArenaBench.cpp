@@ -0,0 +1,323 @@
+// ArenaBench.cpp : Multi-threaded allocation throughput of CArenaAllocator.
+//
+// Each worker repeatedly does a 'parse': create an arena, make a few thousand
+// small allocations, then throw the whole arena away.  The same workload is
+// run against a heap backed arena, an arena sharing the process page pool,
+// one long lived arena Reset() between parses (heap and mmap backed), and
+// plain malloc/free of every block, at 1 to N threads.
+//
+// It then builds a parse-tree-like structure (child lists and names on every
+// node) with std containers and with the arena containers, counting global
+// operator new calls for each, and measures the peak bytes of an arena
+// that keeps replacing a small working set of nodes, with and without
+// size-class recycling.
+
+#include "stdafx.h"
+
+#include <thread>
+#include <chrono>
+
+#include "CArenaAllocator.h"
+#include "ArenaContainers.h"
+
+static const size_t kParsesPerThread = 2000;
+static const size_t kAllocsPerParse = 4000;
+
+enum BenchMode
+{
+	BENCH_HEAP_ARENA,
+	BENCH_POOLED_ARENA,
+	BENCH_RESET_ARENA,
+	BENCH_MAPPED_ARENA,
+	BENCH_MALLOC
+};
+
+static const char *s_modeNames[] = { "arena (heap pages)", "arena (shared pool)", "arena (Reset)", "arena (mapped, Reset)", "malloc/free" };
+
+// Cheap per thread generator; rand() would serialize the workers on some CRTs.
+static inline unsigned int NextSize(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return 8 + ((*pSeed >> 16) % 121); // 8..128 bytes, typical parse node sizes
+}
+
+static void FillArena(CArenaAllocator *pArena, unsigned int *pSeed)
+{
+	for (size_t i = 0; i < kAllocsPerParse; i++)
+	{
+		BYTE *pMem = (BYTE*)pArena->Allocate(NextSize(pSeed));
+		*pMem = 0;
+#ifdef _DEBUG
+		CArenaAllocator::DbgDeleteHelper(pMem); // keep the page verifier quiet
+#endif
+	}
+}
+
+// One long lived arena, Reset() between parses.
+static void ResetParses(CArenaAllocator *pArena, unsigned int *pSeed)
+{
+	for (size_t nParse = 0; nParse < kParsesPerThread; nParse++)
+	{
+		// Enough retained to cover a whole parse
+		pArena->Reset(kAllocsPerParse * 256);
+		FillArena(pArena, pSeed);
+	}
+}
+
+static void Worker(BenchMode mode, unsigned int nSeed)
+{
+	switch (mode)
+	{
+	case BENCH_MALLOC:
+		{
+			void *ptrs[kAllocsPerParse];
+			for (size_t nParse = 0; nParse < kParsesPerThread; nParse++)
+			{
+				for (size_t i = 0; i < kAllocsPerParse; i++)
+				{
+					ptrs[i] = malloc(NextSize(&nSeed));
+					*(BYTE*)ptrs[i] = 0;
+				}
+				for (size_t i = 0; i < kAllocsPerParse; i++)
+				{
+					free(ptrs[i]);
+				}
+			}
+		}
+		break;
+
+	case BENCH_RESET_ARENA:
+		{
+			CArenaAllocator arena;
+			ResetParses(&arena, &nSeed);
+		}
+		break;
+
+	case BENCH_MAPPED_ARENA:
+		{
+			CArenaMappedPageSource mappedSource(64 * 1024 * 1024);
+			CArenaAllocator arena(&mappedSource);
+			ResetParses(&arena, &nSeed);
+		}
+		break;
+
+	default:
+		for (size_t nParse = 0; nParse < kParsesPerThread; nParse++)
+		{
+			CArenaAllocator arena(mode == BENCH_POOLED_ARENA ? CArenaPagePool::Shared() : NULL);
+			FillArena(&arena, &nSeed);
+		}
+		break;
+	}
+}
+
+static double RunMode(BenchMode mode, unsigned int nThreads)
+{
+	vector<thread> threads;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (unsigned int i = 0; i < nThreads; i++)
+	{
+		threads.push_back(thread(Worker, mode, i + 1));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+	double nOps = (double)nThreads * kParsesPerThread * kAllocsPerParse;
+	return nOps / elapsed.count() / 1e6;
+}
+
+// Global heap traffic counter.  Counts every operator new in the process.
+static atomic<size_t> s_nHeapAllocs(0);
+
+void *operator new(size_t nBytes)
+{
+	s_nHeapAllocs.fetch_add(1, memory_order_relaxed);
+	void *p = malloc(nBytes ? nBytes : 1);
+	if (p == NULL)
+	{
+		throw bad_alloc();
+	}
+	return p;
+}
+
+// GCC can't tell the operator new above is malloc, and flags the frees.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+static const size_t kTreeNodes = 100000;
+
+struct StdNode
+{
+	vector<StdNode*>	children;
+	wstring				name;
+};
+
+struct ArenaNode
+{
+	ArenaVector<ArenaNode*>	children;
+	ArenaWString			name;
+
+	ArenaNode(CArenaAllocator *pArena) : children(pArena), name(CArenaStlAllocator<wchar_t>(pArena)) { }
+
+	_ARENA_NEW_HELPER(pArena,nBytes)
+	_ARENA_DELETE_HELPER(ptr)
+};
+
+// Long enough to defeat the small string optimization.
+static void MakeName(wchar_t *pName, size_t nName, size_t i)
+{
+	swprintf(pName, nName, L"parse_node_identifier_%08u", (unsigned int)i);
+}
+
+static size_t BuildStdTree()
+{
+	wchar_t name[64];
+	vector<StdNode*> nodes;
+	nodes.reserve(kTreeNodes);
+
+	size_t nBefore = s_nHeapAllocs.load();
+	unsigned int nSeed = 1;
+	for (size_t i = 0; i < kTreeNodes; i++)
+	{
+		StdNode *pNode = new StdNode;
+		MakeName(name, ARRAYSIZE(name), i);
+		pNode->name = name;
+		if (i)
+		{
+			nodes[NextSize(&nSeed) % i]->children.push_back(pNode);
+		}
+		nodes.push_back(pNode);
+	}
+	size_t nAllocs = s_nHeapAllocs.load() - nBefore;
+
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		delete nodes[i];
+	}
+	return nAllocs;
+}
+
+static size_t BuildArenaTree()
+{
+	wchar_t name[64];
+	vector<ArenaNode*> nodes;
+	nodes.reserve(kTreeNodes);
+
+	// Mapped pages so the arena's own pages don't count either.
+	CArenaMappedPageSource source(256 * 1024 * 1024);
+	CArenaAllocator arena(&source);
+
+	size_t nBefore = s_nHeapAllocs.load();
+	unsigned int nSeed = 1;
+	for (size_t i = 0; i < kTreeNodes; i++)
+	{
+		ArenaNode *pNode = new (&arena) ArenaNode(&arena);
+		MakeName(name, ARRAYSIZE(name), i);
+		pNode->name = name;
+		if (i)
+		{
+			nodes[NextSize(&nSeed) % i]->children.push_back(pNode);
+		}
+		nodes.push_back(pNode);
+	}
+	size_t nAllocs = s_nHeapAllocs.load() - nBefore;
+
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		delete nodes[i];
+	}
+	return nAllocs;
+}
+
+static const size_t kChurnLive = 1000;
+static const size_t kChurnReplacements = 1000000;
+
+struct PlainChurnNode
+{
+	PlainChurnNode	*pLeft, *pRight;
+	size_t			nWeight;
+
+	_ARENA_NEW_HELPER(pArena,nBytes)
+	_ARENA_DELETE_HELPER(ptr)
+};
+
+struct RecycledChurnNode
+{
+	RecycledChurnNode	*pLeft, *pRight;
+	size_t				nWeight;
+
+	_ARENA_RECYCLE_NEW_HELPER(pArena,nBytes)
+	_ARENA_RECYCLE_DELETE_HELPER(ptr,nBytes)
+};
+
+// Replace random members of a fixed size working set, the way a long lived
+// tree churns on replace-on-equal inserts.  Returns the arena's peak bytes.
+template<typename TNode>
+static size_t Churn()
+{
+	CArenaAllocator arena;
+	vector<TNode*> live(kChurnLive, (TNode*)NULL);
+
+	unsigned int nSeed = 1;
+	for (size_t i = 0; i < kChurnReplacements; i++)
+	{
+		nSeed = nSeed * 1103515245 + 12345;
+		size_t nSlot = (nSeed >> 8) % kChurnLive;
+		delete live[nSlot];
+		live[nSlot] = new (&arena) TNode;
+	}
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		delete live[i];
+	}
+	return arena.GetStats().nPeakBytes;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	unsigned int nMaxThreads = thread::hardware_concurrency();
+	if (nMaxThreads == 0)
+	{
+		nMaxThreads = 4;
+	}
+
+	printf("%-22s %8s %14s\n", "mode", "threads", "M allocs/sec");
+	for (int mode = BENCH_HEAP_ARENA; mode <= BENCH_MALLOC; mode++)
+	{
+		for (unsigned int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2)
+		{
+			double dRate = RunMode((BenchMode)mode, nThreads);
+			printf("%-22s %8u %14.1f\n", s_modeNames[mode], nThreads, dRate);
+		}
+	}
+
+	printf("\nGlobal heap allocations building a %u node tree:\n", (unsigned int)kTreeNodes);
+	printf("  std containers:   %u\n", (unsigned int)BuildStdTree());
+	printf("  arena containers: %u\n", (unsigned int)BuildArenaTree());
+
+	printf("\nPeak arena bytes replacing %u of %u live nodes:\n", (unsigned int)kChurnReplacements, (unsigned int)kChurnLive);
+	printf("  no-op delete:     %u\n", (unsigned int)Churn<PlainChurnNode>());
+	printf("  recycling delete: %u\n", (unsigned int)Churn<RecycledChurnNode>());
+
+	printf("\nProcess arena stats:\n%s\n", CArenaAllocator::GetProcessStats().ToJson().c_str());
+
+	return 0;
+}
@@ -0,0 +1,349 @@
+#ifndef _DEF_ARENACONTAINERS_H_
+#define _DEF_ARENACONTAINERS_H_
+
+// Containers whose storage lives in a CArenaAllocator, so the vectors,
+// strings and maps hanging off arena allocated parse nodes don't sneak
+// back out to the global heap.
+//
+// - CArenaStlAllocator<T>: a standard allocator over an arena, for any STL
+//   container (see ArenaString and ArenaHashMap).
+// - ArenaVector<T>: vector that grows in place when its buffer is the last
+//   thing allocated in the arena, which is the common case while building.
+// - ArenaTree<T>: the weighted random Tree (Tree.h) with its nodes in an
+//   arena, laid out in insertion order rather than across the heap.
+//   ArenaRecyclingTree<T> reuses the nodes Remove frees.
+// - ArenaDirectedGraph<T>, ArenaDenseDirectedGraph<T>: DirectedGraph
+//   (DirectedGraph.h) with its nodes, edge sets and node map in an arena.
+//   Tearing one down frees nothing node by node.
+//
+// Like everything else in an arena, freeing is a no-op in release: memory
+// comes back when the arena is freed/reset.  Debug builds still expect
+// every block to be released so the arena's dead-allocation checks hold.
+
+#include <new>
+#include <string>
+#include <unordered_map>
+
+#include "CArenaAllocator.h"
+#include "Random.h"
+
+template<typename T>
+class CArenaStlAllocator
+{
+public:
+	typedef T			value_type;
+	typedef T			*pointer;
+	typedef const T		*const_pointer;
+	typedef T			&reference;
+	typedef const T		&const_reference;
+	typedef size_t		size_type;
+	typedef ptrdiff_t	difference_type;
+
+	template<typename U>
+	struct rebind { typedef CArenaStlAllocator<U> other; };
+
+	CArenaStlAllocator(CArenaAllocator *pArena) : m_pArena(pArena) { }
+
+	template<typename U>
+	CArenaStlAllocator(const CArenaStlAllocator<U> &other) : m_pArena(other.Arena()) { }
+
+	T *allocate(size_t n)
+	{
+		// The arena only guarantees pointer alignment.
+		StaticAssert(__alignof(T) <= sizeof(void*));
+#ifdef _DONT_USE_ARENA
+		return (T*)new char[ n * sizeof(T) ];
+#else
+		T *p = (T*)m_pArena->Allocate(n * sizeof(T));
+		if (p == NULL)
+		{
+			throw std::bad_alloc();
+		}
+		return p;
+#endif
+	}
+
+	void deallocate(T *p, size_t)
+	{
+#ifdef _DONT_USE_ARENA
+		delete [] (char*)p;
+#elif defined(_DEBUG)
+		CArenaAllocator::DbgDeleteHelper(p);
+#else
+		(void)p;
+#endif
+	}
+
+	CArenaAllocator *Arena() const { return m_pArena; }
+
+	template<typename U>
+	bool operator==(const CArenaStlAllocator<U> &rhs) const { return m_pArena == rhs.Arena(); }
+	template<typename U>
+	bool operator!=(const CArenaStlAllocator<U> &rhs) const { return m_pArena != rhs.Arena(); }
+
+private:
+	CArenaAllocator	*m_pArena;
+};
+
+// CArenaStlAllocator whose single-object blocks go through the arena's
+// size-class recycler, so a container that frees and allocates one node at
+// a time (a Tree under Remove/Add churn) reuses its dead nodes instead of
+// growing the arena.  Each such block costs a hidden word and rounds up to
+// a power of two; arrays are allocated as CArenaStlAllocator does.
+template<typename T>
+class CArenaRecyclingStlAllocator : public CArenaStlAllocator<T>
+{
+public:
+	template<typename U>
+	struct rebind { typedef CArenaRecyclingStlAllocator<U> other; };
+
+	CArenaRecyclingStlAllocator(CArenaAllocator *pArena) : CArenaStlAllocator<T>(pArena) { }
+
+	template<typename U>
+	CArenaRecyclingStlAllocator(const CArenaRecyclingStlAllocator<U> &other) : CArenaStlAllocator<T>(other.Arena()) { }
+
+	T *allocate(size_t n)
+	{
+#ifndef _DONT_USE_ARENA
+		if (n == 1)
+		{
+			StaticAssert(__alignof(T) <= sizeof(void*));
+			T *p = (T*)this->Arena()->AllocateRecyclable(sizeof(T));
+			if (p == NULL)
+			{
+				throw std::bad_alloc();
+			}
+			return p;
+		}
+#endif
+		return CArenaStlAllocator<T>::allocate(n);
+	}
+
+	void deallocate(T *p, size_t n)
+	{
+#ifndef _DONT_USE_ARENA
+		if (n == 1)
+		{
+			CArenaAllocator::Recycle(p, sizeof(T));
+			return;
+		}
+#endif
+		CArenaStlAllocator<T>::deallocate(p, n);
+	}
+};
+
+// Strings.  Construct with an allocator: ArenaWString str(CArenaStlAllocator<wchar_t>(pArena));
+typedef std::basic_string<char, std::char_traits<char>, CArenaStlAllocator<char> >				ArenaString;
+typedef std::basic_string<wchar_t, std::char_traits<wchar_t>, CArenaStlAllocator<wchar_t> >	ArenaWString;
+
+// Hash map.  Construct with a bucket count hint and an allocator.
+template<typename TKey, typename TValue, typename _Hasher = std::hash<TKey>, typename _Keyeq = std::equal_to<TKey> >
+using ArenaHashMap = std::unordered_map<TKey, TValue, _Hasher, _Keyeq, CArenaStlAllocator<std::pair<const TKey, TValue> > >;
+
+// Weighted random tree.  Construct with an allocator: ArenaTree<T> tree(CArenaStlAllocator<T>(pArena));
+// Nodes taken out by Remove stay in the arena until it's freed/reset.
+template <typename TData, typename TRandom, typename TAlloc>
+class Tree;
+
+template<typename TData, typename TRandom = CXoshiro256>
+using ArenaTree = Tree<TData, TRandom, CArenaStlAllocator<TData> >;
+
+// Same, but Remove hands each node back to the arena for the next Add to
+// reuse.  Construct with CArenaRecyclingStlAllocator<T>(pArena).
+template<typename TData, typename TRandom = CXoshiro256>
+using ArenaRecyclingTree = Tree<TData, TRandom, CArenaRecyclingStlAllocator<TData> >;
+
+// Directed graphs.  Construct with an allocator: ArenaDirectedGraph<T> graph(CArenaStlAllocator<T>(pArena));
+// Nodes deleted along the way stay in the arena until it's freed/reset.
+template <typename TData, typename _Hasher, typename _Keyeq, bool _DenseKeys, typename TAlloc>
+class DirectedGraph;
+
+template<typename TAlloc>
+struct AllocatorFreesInBulk;
+
+#if !defined(_DONT_USE_ARENA) && !defined(_DEBUG)
+// Release deletes are no-ops anyway; debug wants every block released.
+template<typename T>
+struct AllocatorFreesInBulk<CArenaStlAllocator<T> > : std::true_type { };
+#endif
+
+template<typename TData, typename _Hasher = std::hash<TData>, typename _Keyeq = std::equal_to<TData> >
+using ArenaDirectedGraph = DirectedGraph<TData, _Hasher, _Keyeq, false, CArenaStlAllocator<TData> >;
+
+template<typename TIndex>
+using ArenaDenseDirectedGraph = DirectedGraph<TIndex, std::hash<TIndex>, std::equal_to<TIndex>, true, CArenaStlAllocator<TIndex> >;
+
+template<typename T>
+class ArenaVector
+{
+	NON_COPYABLE(ArenaVector)
+public:
+	typedef T			value_type;
+	typedef T			*iterator;
+	typedef const T		*const_iterator;
+
+	ArenaVector(CArenaAllocator *pArena) : m_alloc(pArena), m_pData(NULL), m_nSize(0), m_nCapacity(0) { }
+	~ArenaVector()
+	{
+		clear();
+		ReleaseBuffer();
+	}
+
+	size_t size() const { return m_nSize; }
+	size_t capacity() const { return m_nCapacity; }
+	bool empty() const { return m_nSize == 0; }
+
+	T *data() { return m_pData; }
+	const T *data() const { return m_pData; }
+
+	iterator begin() { return m_pData; }
+	iterator end() { return m_pData + m_nSize; }
+	const_iterator begin() const { return m_pData; }
+	const_iterator end() const { return m_pData + m_nSize; }
+
+	T &operator[](size_t i) { ASSERT(i < m_nSize); return m_pData[i]; }
+	const T &operator[](size_t i) const { ASSERT(i < m_nSize); return m_pData[i]; }
+	T &front() { ASSERT(m_nSize); return m_pData[0]; }
+	T &back() { ASSERT(m_nSize); return m_pData[m_nSize - 1]; }
+
+	void push_back(const T &value)
+	{
+		if (m_nSize == m_nCapacity)
+		{
+			// value may live in our own buffer; copy it before the buffer moves.
+			T copy(value);
+			Grow(m_nSize + 1);
+			new (m_pData + m_nSize) T(std::move(copy));
+		}
+		else
+		{
+			new (m_pData + m_nSize) T(value);
+		}
+		m_nSize++;
+	}
+
+	template<typename... TArgs>
+	T &emplace_back(TArgs&&... args)
+	{
+		if ((m_nSize == m_nCapacity) && !TryExtend(GrowCapacity(m_nSize + 1)))
+		{
+			// args may refer into our own buffer; build the new element in
+			// the new buffer before the old ones move out from under them.
+			size_t nCapacity = GrowCapacity(m_nSize + 1);
+			T *pNewData = m_alloc.allocate(nCapacity);
+			try
+			{
+				new (pNewData + m_nSize) T(std::forward<TArgs>(args)...);
+			}
+			catch (...)
+			{
+				m_alloc.deallocate(pNewData, nCapacity);
+				throw;
+			}
+			MoveTo(pNewData, nCapacity);
+		}
+		else
+		{
+			new (m_pData + m_nSize) T(std::forward<TArgs>(args)...);
+		}
+		return m_pData[m_nSize++];
+	}
+
+	void pop_back()
+	{
+		ASSERT(m_nSize);
+		m_pData[--m_nSize].~T();
+	}
+
+	void reserve(size_t nCapacity)
+	{
+		if (nCapacity > m_nCapacity)
+		{
+			Reallocate(nCapacity);
+		}
+	}
+
+	void resize(size_t nSize)
+	{
+		reserve(nSize);
+		while (m_nSize < nSize)
+		{
+			new (m_pData + m_nSize) T();
+			m_nSize++;
+		}
+		while (m_nSize > nSize)
+		{
+			pop_back();
+		}
+	}
+
+	void clear()
+	{
+		while (m_nSize)
+		{
+			pop_back();
+		}
+	}
+
+private:
+	size_t GrowCapacity(size_t nMinCapacity) const
+	{
+		// Small first buffer: most parse node child lists are tiny.
+		size_t nCapacity = m_nCapacity ? m_nCapacity * 2 : 4;
+		return MAX(nCapacity, nMinCapacity);
+	}
+
+	void Grow(size_t nMinCapacity)
+	{
+		Reallocate(GrowCapacity(nMinCapacity));
+	}
+
+	// Last block in the arena?  Then just push the page's free pointer out.
+	bool TryExtend(size_t nCapacity)
+	{
+		if (m_pData && m_alloc.Arena()->TryExtend(m_pData, m_nCapacity * sizeof(T), nCapacity * sizeof(T)))
+		{
+			m_nCapacity = nCapacity;
+			return true;
+		}
+		return false;
+	}
+
+	void Reallocate(size_t nCapacity)
+	{
+		if (!TryExtend(nCapacity))
+		{
+			MoveTo(m_alloc.allocate(nCapacity), nCapacity);
+		}
+	}
+
+	// Move everything into pNewData, which holds nCapacity, and drop the old buffer.
+	void MoveTo(T *pNewData, size_t nCapacity)
+	{
+		for (size_t i = 0; i < m_nSize; i++)
+		{
+			new (pNewData + i) T(std::move(m_pData[i]));
+			m_pData[i].~T();
+		}
+		ReleaseBuffer();
+		m_pData = pNewData;
+		m_nCapacity = nCapacity;
+	}
+
+	void ReleaseBuffer()
+	{
+		if (m_pData)
+		{
+			m_alloc.deallocate(m_pData, m_nCapacity);
+		}
+		m_pData = NULL;
+		m_nCapacity = 0;
+	}
+
+	CArenaStlAllocator<T>	m_alloc;
+	T		*m_pData;
+	size_t	m_nSize;
+	size_t	m_nCapacity;
+};
+
+#endif // _DEF_ARENACONTAINERS_H_
@@ -0,0 +1,371 @@
+// ArenaMicroBench.cpp : Per-operation cost of CArenaAllocator vs malloc and
+// std::pmr::monotonic_buffer_resource.
+//
+// Each benchmark is a batch: make an allocator, allocate a fixed list of
+// block sizes, free every block (a no-op for the arenas), then throw the
+// allocator away.  Like Google Benchmark, the batch count doubles until a
+// run takes long enough to time, and the last run is reported.
+//
+//   mixed          sizes drawn from a synthetic small-block-heavy mix (s_parseSizes)
+//   tiny_eval      a handful of small blocks; the case MakeFirstPage's small first page is for
+//   large_orphans  mixed sizes with every 8th block big enough to get its own page
+//
+// Columns are ns per allocation (including its free), resident set size
+// at the fullest point of the last batch, and last level cache misses per
+// allocation when perf counters are available (Linux perf_event_open).
+//
+// Usage: ArenaMicroBench [filter]   runs only benchmarks whose name contains filter.
+
+#include "stdafx.h"
+
+#include <chrono>
+#include <memory_resource>
+
+#include "CArenaAllocator.h"
+
+#if defined(_WIN32)
+	#include <windows.h>
+	#include <psapi.h>
+#elif defined(__linux__)
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+static const double kMinRunSeconds = 0.2;
+static const size_t kMaxBlocksPerBatch = 4096;
+
+// Resident set size in KB, 0 if unknown.
+static size_t CurrentRssKB()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+	{
+		return counters.WorkingSetSize / 1024;
+	}
+	return 0;
+#elif defined(__linux__)
+	size_t nPages = 0, nResident = 0;
+	FILE *pFile = fopen("/proc/self/statm", "r");
+	if (pFile)
+	{
+		if (fscanf(pFile, "%zu %zu", &nPages, &nResident) != 2)
+		{
+			nResident = 0;
+		}
+		fclose(pFile);
+	}
+	return nResident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+	return 0;
+#endif
+}
+
+// Hardware cache miss counter for this thread.  IsValid() is false where
+// there are no perf counters (other OSes, containers, paranoid kernels).
+class CCacheMissCounter
+{
+	NON_COPYABLE(CCacheMissCounter)
+public:
+#ifdef __linux__
+	CCacheMissCounter()
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	~CCacheMissCounter()
+	{
+		if (m_fd >= 0)
+		{
+			close(m_fd);
+		}
+	}
+
+	bool IsValid() const { return m_fd >= 0; }
+
+	void Start()
+	{
+		if (m_fd >= 0)
+		{
+			ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	unsigned __int64 Stop()
+	{
+		unsigned __int64 nCount = 0;
+		if (m_fd >= 0)
+		{
+			ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(m_fd, &nCount, sizeof(nCount)) != sizeof(nCount))
+			{
+				nCount = 0;
+			}
+		}
+		return nCount;
+	}
+
+private:
+	int	m_fd;
+#else
+	CCacheMissCounter() { }
+	bool IsValid() const { return false; }
+	void Start() { }
+	unsigned __int64 Stop() { return 0; }
+#endif
+};
+
+// Allocators under test.  Begin/End bracket one batch.
+
+class HeapArenaAdapter
+{
+public:
+	void Begin() { m_pArena = new (m_storage) CArenaAllocator(); }
+	void *Alloc(size_t nBytes) { return m_pArena->Allocate(nBytes); }
+	void Free(void *p) { DBG_ONLY(CArenaAllocator::DbgDeleteHelper(p)); (void)p; }
+	void End() { m_pArena->~CArenaAllocator(); }
+
+private:
+	alignas(CArenaAllocator) BYTE	m_storage[sizeof(CArenaAllocator)];
+	CArenaAllocator	*m_pArena;
+};
+
+class PooledArenaAdapter
+{
+public:
+	void Begin() { m_pArena = new (m_storage) CArenaAllocator(CArenaPagePool::Shared()); }
+	void *Alloc(size_t nBytes) { return m_pArena->Allocate(nBytes); }
+	void Free(void *p) { DBG_ONLY(CArenaAllocator::DbgDeleteHelper(p)); (void)p; }
+	void End() { m_pArena->~CArenaAllocator(); }
+
+private:
+	alignas(CArenaAllocator) BYTE	m_storage[sizeof(CArenaAllocator)];
+	CArenaAllocator	*m_pArena;
+};
+
+class ResetArenaAdapter
+{
+public:
+	void Begin() { }
+	void *Alloc(size_t nBytes) { return m_arena.Allocate(nBytes); }
+	void Free(void *p) { DBG_ONLY(CArenaAllocator::DbgDeleteHelper(p)); (void)p; }
+	void End() { m_arena.Reset(1024 * 1024); }
+
+private:
+	CArenaAllocator	m_arena;
+};
+
+class MallocAdapter
+{
+public:
+	void Begin() { }
+	void *Alloc(size_t nBytes) { return malloc(nBytes); }
+	void Free(void *p) { free(p); }
+	void End() { }
+};
+
+class PmrAdapter
+{
+public:
+	void Begin() { m_pResource = new (m_storage) std::pmr::monotonic_buffer_resource(); }
+	void *Alloc(size_t nBytes) { return m_pResource->allocate(nBytes, sizeof(void*)); }
+	void Free(void *) { }
+	void End() { m_pResource->~monotonic_buffer_resource(); }
+
+private:
+	alignas(std::pmr::monotonic_buffer_resource) BYTE	m_storage[sizeof(std::pmr::monotonic_buffer_resource)];
+	std::pmr::monotonic_buffer_resource	*m_pResource;
+};
+
+// Block sizes for one batch, generated up front so the timed loop only allocates.
+struct Workload
+{
+	const char	*pName;
+	size_t		nBlocks;
+	size_t		sizes[kMaxBlocksPerBatch];
+};
+
+struct SizeRange
+{
+	size_t			nMin;
+	size_t			nMax;
+	unsigned int	nWeight;
+};
+
+// A synthetic mix, per 1000 requests: mostly blocks of 32 bytes or less,
+// with a thinning tail out to a few KB.  Not measured from a real parse.
+static const SizeRange s_parseSizes[] =
+{
+	{ 1, 8, 120 },
+	{ 9, 16, 310 },
+	{ 17, 32, 280 },
+	{ 33, 64, 170 },
+	{ 65, 128, 80 },
+	{ 129, 256, 25 },
+	{ 257, 1024, 12 },
+	{ 1025, 4000, 3 }
+};
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed >> 8;
+}
+
+static size_t ParseSize(unsigned int *pSeed)
+{
+	unsigned int nTotal = 0;
+	for (size_t i = 0; i < ARRAYSIZE(s_parseSizes); i++)
+	{
+		nTotal += s_parseSizes[i].nWeight;
+	}
+
+	unsigned int nPick = NextRandom(pSeed) % nTotal;
+	size_t i = 0;
+	while (nPick >= s_parseSizes[i].nWeight)
+	{
+		nPick -= s_parseSizes[i].nWeight;
+		i++;
+	}
+	const SizeRange &range = s_parseSizes[i];
+	return range.nMin + NextRandom(pSeed) % (range.nMax - range.nMin + 1);
+}
+
+static void MakeWorkloads(Workload *pMixed, Workload *pTinyEval, Workload *pLargeOrphans)
+{
+	unsigned int nSeed = 1;
+
+	pMixed->pName = "mixed";
+	pMixed->nBlocks = kMaxBlocksPerBatch;
+	for (size_t i = 0; i < pMixed->nBlocks; i++)
+	{
+		pMixed->sizes[i] = ParseSize(&nSeed);
+	}
+
+	// Fits in the default 192 byte first page.
+	static const size_t tinySizes[] = { 24, 16, 40, 32, 16 };
+	pTinyEval->pName = "tiny_eval";
+	pTinyEval->nBlocks = ARRAYSIZE(tinySizes);
+	for (size_t i = 0; i < pTinyEval->nBlocks; i++)
+	{
+		pTinyEval->sizes[i] = tinySizes[i];
+	}
+
+	pLargeOrphans->pName = "large_orphans";
+	pLargeOrphans->nBlocks = 256;
+	for (size_t i = 0; i < pLargeOrphans->nBlocks; i++)
+	{
+		pLargeOrphans->sizes[i] = (i % 8 == 7) ? 8 * 1024 + NextRandom(&nSeed) % (56 * 1024) : ParseSize(&nSeed);
+	}
+}
+
+struct Result
+{
+	double				dNsPerOp;
+	size_t				nRssKB;
+	unsigned __int64	nCacheMisses;
+	size_t				nOps;
+};
+
+template<typename TAdapter>
+static void RunBatches(TAdapter *pAdapter, const Workload &work, size_t nBatches, Result *pResult)
+{
+	void *ptrs[kMaxBlocksPerBatch];
+	for (size_t nBatch = 0; nBatch < nBatches; nBatch++)
+	{
+		pAdapter->Begin();
+		for (size_t i = 0; i < work.nBlocks; i++)
+		{
+			ptrs[i] = pAdapter->Alloc(work.sizes[i]);
+			*(volatile BYTE*)ptrs[i] = 0;
+		}
+		if (nBatch == nBatches - 1)
+		{
+			pResult->nRssKB = CurrentRssKB();
+		}
+		for (size_t i = 0; i < work.nBlocks; i++)
+		{
+			pAdapter->Free(ptrs[i]);
+		}
+		pAdapter->End();
+	}
+}
+
+template<typename TAdapter>
+static Result Measure(const Workload &work)
+{
+	TAdapter *pAdapter = new TAdapter;
+	CCacheMissCounter misses;
+	Result result = { 0, 0, 0, 0 };
+
+	for (size_t nBatches = 1; ; nBatches *= 2)
+	{
+		misses.Start();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		RunBatches(pAdapter, work, nBatches, &result);
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+		result.nCacheMisses = misses.Stop();
+
+		if (elapsed.count() >= kMinRunSeconds)
+		{
+			result.nOps = nBatches * work.nBlocks;
+			result.dNsPerOp = elapsed.count() * 1e9 / result.nOps;
+			break;
+		}
+	}
+
+	delete pAdapter;
+	return result;
+}
+
+template<typename TAdapter>
+static void Report(const char *pAllocator, const Workload &work, const char *pFilter)
+{
+	char name[128];
+	snprintf(name, sizeof(name), "%s/%s", work.pName, pAllocator);
+	if (pFilter && !strstr(name, pFilter))
+	{
+		return;
+	}
+
+	Result result = Measure<TAdapter>(work);
+	printf("%-36s %10.2f %10u", name, result.dNsPerOp, (unsigned int)result.nRssKB);
+	if (CCacheMissCounter().IsValid())
+	{
+		printf(" %14.3f\n", (double)result.nCacheMisses / result.nOps);
+	}
+	else
+	{
+		printf(" %14s\n", "n/a");
+	}
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	const char *pFilter = (argc > 1) ? argv[1] : NULL;
+
+	static Workload workloads[3];
+	MakeWorkloads(&workloads[0], &workloads[1], &workloads[2]);
+
+	printf("%-36s %10s %10s %14s\n", "benchmark", "ns/op", "RSS KB", "misses/op");
+	for (size_t i = 0; i < ARRAYSIZE(workloads); i++)
+	{
+		Report<HeapArenaAdapter>("arena", workloads[i], pFilter);
+		Report<PooledArenaAdapter>("arena_pooled", workloads[i], pFilter);
+		Report<ResetArenaAdapter>("arena_reset", workloads[i], pFilter);
+		Report<MallocAdapter>("malloc", workloads[i], pFilter);
+		Report<PmrAdapter>("pmr_monotonic", workloads[i], pFilter);
+	}
+
+	return 0;
+}
@@ -0,0 +1,203 @@
+// ArenaReplay.cpp : Replays an arena allocation trace through different
+// page configurations, to tune page sizes from real allocation sequences.
+//
+// Record a trace by building with _WANT_ARENA_TRACE and calling
+// CArenaTrace::Dump() at a quiet point.  Events are replayed in recorded
+// order on one thread, each recorded arena getting its own arena in the
+// configuration under test.  Reports replay throughput, bytes of page
+// taken from the page source against bytes requested, and the biggest
+// any one arena got.
+//
+// Usage: ArenaReplay [trace file]   without one, replays a synthetic trace.
+
+#include "stdafx.h"
+
+#include <chrono>
+
+#include "CArenaAllocator.h"
+
+struct ReplayConfig
+{
+	const char	*pName;
+	bool		bPooled;
+	CArenaPagePolicy::Growth	growth;
+	size_t		nFirstPageSize;
+	size_t		nPageSize;
+	bool		bPolicy;
+};
+
+static const ReplayConfig s_configs[] =
+{
+	{ "default (192, 4K)",	false,	CArenaPagePolicy::GROW_FIXED,		0,		0,		false },
+	{ "shared pool",		true,	CArenaPagePolicy::GROW_FIXED,		0,		0,		false },
+	{ "fixed 1K, 4K",		false,	CArenaPagePolicy::GROW_FIXED,		1024,	4096,	true },
+	{ "fixed 192, 16K",		false,	CArenaPagePolicy::GROW_FIXED,		192,	16384,	true },
+	{ "geometric 192, 4K+",	false,	CArenaPagePolicy::GROW_GEOMETRIC,	192,	4096,	true },
+	{ "hinted 192, 4K+",	false,	CArenaPagePolicy::GROW_HINTED,		192,	4096,	true }
+};
+
+struct ReplayArena
+{
+	CArenaAllocator		*pArena;
+	vector<CArenaMark>	marks;
+
+	ReplayArena() : pArena(NULL) { }
+};
+
+// Arena stats are summed as each replayed arena is freed.
+static CArenaStats ReplayTrace(const vector<CArenaTraceRecord> &records, const ReplayConfig &config, double *pSeconds, size_t *pLargestPeak)
+{
+	CArenaPagePolicy policy(config.growth, config.nFirstPageSize, config.nPageSize);
+	CArenaPageSource *pSource = config.bPooled ? CArenaPagePool::Shared() : NULL;
+	CArenaPagePolicy *pPolicy = config.bPolicy ? &policy : NULL;
+
+	unordered_map<unsigned int, ReplayArena> arenas;
+	CArenaStats totals;
+	*pLargestPeak = 0;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const CArenaTraceRecord &record = records[i];
+		ReplayArena &arena = arenas[record.nArenaId];
+		if (arena.pArena == NULL)
+		{
+			arena.pArena = new CArenaAllocator(pSource, pPolicy);
+		}
+
+		switch (record.GetKind())
+		{
+		case CArenaTraceRecord::ALLOCATE:
+		{
+			BYTE *pMem = (BYTE*)arena.pArena->Allocate(MAX(record.GetSize(), (size_t)1));
+			*pMem = 0;
+#ifdef _DEBUG
+			CArenaAllocator::DbgDeleteHelper(pMem); // keep the page verifier quiet
+#endif
+			break;
+		}
+		case CArenaTraceRecord::RESET:
+			arena.pArena->Reset();
+			arena.marks.clear();
+			break;
+		case CArenaTraceRecord::MARK:
+			arena.marks.push_back(arena.pArena->Mark());
+			break;
+		case CArenaTraceRecord::REWIND:
+			// The ring buffer may have dropped the matching mark.
+			if (!arena.marks.empty())
+			{
+				arena.pArena->Rewind(arena.marks.back());
+				arena.marks.pop_back();
+			}
+			break;
+		case CArenaTraceRecord::FREE:
+		{
+			// Stats are final after the destructor has run, so take them
+			// first and fold in the peak it would have recorded.
+			CArenaStats stats = arena.pArena->GetStats();
+			delete arena.pArena;
+			arenas.erase(record.nArenaId);
+			*pLargestPeak = MAX(*pLargestPeak, stats.nPeakBytes);
+			totals.AddDelta(stats, CArenaStats());
+			break;
+		}
+		}
+	}
+
+	// Arenas still alive at the end of the trace.
+	for (unordered_map<unsigned int, ReplayArena>::iterator it = arenas.begin(); it != arenas.end(); ++it)
+	{
+		CArenaStats stats = it->second.pArena->GetStats();
+		delete it->second.pArena;
+		*pLargestPeak = MAX(*pLargestPeak, stats.nPeakBytes);
+		totals.AddDelta(stats, CArenaStats());
+	}
+
+	*pSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return totals;
+}
+
+static void AddRecord(vector<CArenaTraceRecord> *pRecords, unsigned int nArenaId, CArenaTraceRecord::Kind kind, size_t nBytes)
+{
+	CArenaTraceRecord record;
+	record.nTimestamp = pRecords->size();
+	record.nArenaId = nArenaId;
+	record.nKindAndSize = ((unsigned int)kind << CArenaTraceRecord::kSizeBits) | (unsigned int)nBytes;
+	pRecords->push_back(record);
+}
+
+// Many short parses, some with a nested eval, and one long lived arena
+// reset between batches.
+static void MakeSyntheticTrace(vector<CArenaTraceRecord> *pRecords)
+{
+	unsigned int nSeed = 1;
+	unsigned int nNextId = 2;
+	for (size_t nParse = 0; nParse < 2000; nParse++)
+	{
+		unsigned int nId = nNextId++;
+		nSeed = nSeed * 1103515245 + 12345;
+		size_t nAllocs = 1 + (nSeed >> 8) % 2000;
+		for (size_t i = 0; i < nAllocs; i++)
+		{
+			nSeed = nSeed * 1103515245 + 12345;
+			size_t nBytes = 8 + (nSeed >> 16) % 121;
+			if ((nSeed >> 8) % 509 == 0)
+			{
+				nBytes = 8192 + (nSeed >> 16) % 8192;
+			}
+			AddRecord(pRecords, nId, CArenaTraceRecord::ALLOCATE, nBytes);
+
+			if (i % 500 == 250)
+			{
+				AddRecord(pRecords, nId, CArenaTraceRecord::MARK, 0);
+				for (size_t j = 0; j < 40; j++)
+				{
+					AddRecord(pRecords, nId, CArenaTraceRecord::ALLOCATE, 24);
+				}
+				AddRecord(pRecords, nId, CArenaTraceRecord::REWIND, 0);
+			}
+		}
+		AddRecord(pRecords, nId, CArenaTraceRecord::FREE, 0);
+
+		AddRecord(pRecords, 1, CArenaTraceRecord::ALLOCATE, 64);
+		if (nParse % 100 == 99)
+		{
+			AddRecord(pRecords, 1, CArenaTraceRecord::RESET, 0);
+		}
+	}
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	vector<CArenaTraceRecord> records;
+	if (argc > 1)
+	{
+		if (!CArenaTrace::Load(argv[1], &records))
+		{
+			printf("Can't read trace %s\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+	{
+		MakeSyntheticTrace(&records);
+	}
+	printf("%u events\n\n", (unsigned int)records.size());
+
+	printf("%-20s %12s %14s %14s %8s %12s\n", "config", "M events/s", "requested", "page bytes", "waste", "max peak");
+	for (size_t i = 0; i < ARRAYSIZE(s_configs); i++)
+	{
+		double dSeconds;
+		size_t nLargestPeak;
+		CArenaStats stats = ReplayTrace(records, s_configs[i], &dSeconds, &nLargestPeak);
+
+		double dWaste = stats.nPageBytes ? 100.0 * (1.0 - (double)stats.nBytesRequested / stats.nPageBytes) : 0.0;
+		printf("%-20s %12.1f %14llu %14llu %7.1f%% %12llu\n", s_configs[i].pName,
+			records.size() / dSeconds / 1e6,
+			(unsigned long long)stats.nBytesRequested, (unsigned long long)stats.nPageBytes,
+			dWaste, (unsigned long long)nLargestPeak);
+	}
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+// ArenaStress.cpp : Random nests of Mark()/Rewind() on CArenaAllocator,
+// checked against what the arena said at each mark.
+//
+// Every round opens or closes a mark (up to kMaxDepth deep) and makes a
+// few allocations, one in kOrphanOdds big enough for an orphan page.
+// After a Rewind, BytesInUse() must be exactly what it was at the mark:
+// everything since is released, on the mark's page, on the pages pushed
+// since and in the orphans.  Back at the top, a Rewind(Mark()) must change
+// nothing, and every kResetRounds a Reset() takes it all to 0.  Run with
+// each page policy and with the shared page pool.
+//
+// BytesInUse() is also held to a model, the bytes asked for and not yet
+// rewound: never less, and never more than kBlockSlack a block over (for
+// alignment, and debug's markers).  The stats' peak
+// (CArenaStats::nPeakBytes, "peakBytes" in the JSON) must be the most
+// BytesInUse() ever said, per arena and for the process.
+//
+// Usage: ArenaStress [rounds] [seed]   default 100,000 rounds, seed 1.
+
+#include "stdafx.h"
+
+#include "CArenaAllocator.h"
+
+static const size_t kMaxDepth = 8;
+static const size_t kAllocsPerRound = 4;
+static const unsigned int kOrphanOdds = 64;
+static const unsigned int kResetRounds = 10000;
+static const size_t kBlockSlack = 32;
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed >> 8;
+}
+
+#define CHECK(x) if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); return false; }
+
+// return the size asked for
+static size_t AllocateRandom(CArenaAllocator *pArena, unsigned int *pSeed)
+{
+	size_t nBytes = (0 == NextRandom(pSeed) % kOrphanOdds) ? 4096 + NextRandom(pSeed) % 8192 : 1 + NextRandom(pSeed) % 256;
+	BYTE *pMem = (BYTE*)pArena->Allocate(nBytes);
+	memset(pMem, 0xA5, nBytes);
+#ifdef _DEBUG
+	CArenaAllocator::DbgDeleteHelper(pMem); // a Rewind wants everything after the mark dead
+#endif
+	return nBytes;
+}
+
+// A mark, and what was live when it was taken.
+struct MarkState
+{
+	CArenaMark	mark;
+	size_t		nInUse;			// BytesInUse()
+	size_t		nLive;			// the model's bytes
+	size_t		nLiveBlocks;	// and blocks
+};
+
+// *pPeak is raised to the arena's peak.
+static bool StressRewind(const char *pName, CArenaPageSource *pSource, CArenaPagePolicy *pPolicy,
+							unsigned int nRounds, unsigned int nSeed, size_t *pPeak)
+{
+	printf("  %s\n", pName);
+
+	CArenaAllocator arena(pSource, pPolicy);
+	vector<MarkState> marks;
+	size_t nLive = 0;
+	size_t nLiveBlocks = 0;
+	size_t nPeak = 0;
+
+	for (unsigned int nRound = 0; nRound < nRounds; nRound++)
+	{
+		if (marks.empty())
+		{
+			size_t nBytes = arena.BytesInUse();
+			arena.Rewind(arena.Mark());
+			CHECK(arena.BytesInUse() == nBytes);
+
+			if (0 == nRound % kResetRounds)
+			{
+				arena.Reset();
+				CHECK(arena.BytesInUse() == 0);
+			}
+		}
+
+		// Nothing is allocated outside a mark, or the arena would only grow.
+		unsigned int nAction = NextRandom(&nSeed) % 3;
+		if (marks.empty() || ((nAction == 0) && (marks.size() < kMaxDepth)))
+		{
+			MarkState state = { arena.Mark(), arena.BytesInUse(), nLive, nLiveBlocks };
+			marks.push_back(state);
+		}
+		else if (nAction == 1)
+		{
+			arena.Rewind(marks.back().mark);
+			CHECK(arena.BytesInUse() == marks.back().nInUse);
+			nLive = marks.back().nLive;
+			nLiveBlocks = marks.back().nLiveBlocks;
+			marks.pop_back();
+			continue;
+		}
+
+		for (size_t i = 0; i < kAllocsPerRound; i++)
+		{
+			nLive += AllocateRandom(&arena, &nSeed);
+			nLiveBlocks++;
+
+			size_t nInUse = arena.BytesInUse();
+			CHECK((nInUse >= nLive) && (nInUse <= nLive + nLiveBlocks * kBlockSlack));
+			nPeak = MAX(nPeak, nInUse);
+		}
+	}
+
+	while (!marks.empty())
+	{
+		arena.Rewind(marks.back().mark);
+		marks.pop_back();
+	}
+
+#ifndef _NO_ARENA_STATS
+	CHECK(arena.GetStats().nPeakBytes == nPeak);
+#endif
+	*pPeak = MAX(*pPeak, nPeak);
+	return true;
+}
+
+static bool CheckProcessPeak(size_t nPeak)
+{
+#ifdef _NO_ARENA_STATS
+	(void)nPeak;
+#else
+	CArenaStats stats = CArenaAllocator::GetProcessStats();
+	CHECK(stats.nPeakBytes == nPeak);
+
+	char expected[64];
+	sprintf(expected, "\"peakBytes\":%llu,", (unsigned long long)nPeak);
+	CHECK(stats.ToJson().find(expected) != string::npos);
+#endif
+	return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	unsigned int nRounds = (argc > 1) ? (unsigned int)atol(argv[1]) : 100000;
+	unsigned int nSeed = (argc > 2) ? (unsigned int)atol(argv[2]) : 1;
+
+	printf("%u rounds, seed %u\n", nRounds, nSeed);
+
+	CArenaPagePolicy fixed(CArenaPagePolicy::GROW_FIXED, 256, 1024);
+	CArenaPagePolicy geometric(CArenaPagePolicy::GROW_GEOMETRIC, 256, 1024, 64 * 1024);
+	CArenaPagePolicy hinted(CArenaPagePolicy::GROW_HINTED, 256, 1024, 64 * 1024);
+
+	size_t nPeak = 0;
+	bool bSucceeded =
+		StressRewind("default pages", NULL, NULL, nRounds, nSeed, &nPeak) &&
+		StressRewind("fixed pages", NULL, &fixed, nRounds, nSeed, &nPeak) &&
+		StressRewind("geometric pages", NULL, &geometric, nRounds, nSeed, &nPeak) &&
+		StressRewind("hinted pages", NULL, &hinted, nRounds, nSeed, &nPeak) &&
+		StressRewind("shared pool", CArenaPagePool::Shared(), NULL, nRounds, nSeed, &nPeak) &&
+		CheckProcessPeak(nPeak);
+
+	puts(bSucceeded ? "Succeeded" : "FAILED!!!");
+	return bSucceeded ? 0 : 1;
+}
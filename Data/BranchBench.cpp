@@ -0,0 +1,173 @@
+// BranchBench.cpp : Per function cost of ResolveBranches.
+//
+// Generates random functions (misc instructions, branches to labels, the
+// labels dropped in at random) at a few sizes and times ResolveBranches on
+// each, the way a compiler calls it: once per function, one after another.
+// Reports the time per function and the global operator new calls per
+// function made while resolving.
+//
+// The branch graph lives in the thread's arena.  Build with
+// _DONT_USE_ARENA to send it all back to the heap, for the before numbers.
+//
+// Usage: BranchBench [functions per size]   default 2,000.
+
+#include "stdafx.h"
+
+#include <chrono>
+
+#include "Instruction.h"
+
+static const size_t s_functionSizes[] = { 64, 256, 1024, 2048 };
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed >> 16;
+}
+
+class CStopwatch
+{
+public:
+	CStopwatch() : m_start(chrono::steady_clock::now()) { }
+	double Seconds() const { return chrono::duration<double>(chrono::steady_clock::now() - m_start).count(); }
+
+private:
+	chrono::steady_clock::time_point	m_start;
+};
+
+// Global heap traffic counter.  Counts every operator new in the process.
+static size_t s_nHeapAllocs = 0;
+
+void *operator new(size_t nBytes)
+{
+	s_nHeapAllocs++;
+	void *p = malloc(nBytes ? nBytes : 1);
+	if (p == NULL)
+	{
+		throw bad_alloc();
+	}
+	return p;
+}
+
+// GCC can't tell the operator new above is malloc, and flags the frees.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// A function of nInstructions, about one in eight a branch.  Most branches
+// get a label of their own, the rest share one already made.
+static void BuildFunction(size_t nInstructions, unsigned int *pSeed,
+							vector<Instruction> *pCode, vector<Label*> *pLabels)
+{
+	pCode->clear();
+	pLabels->clear();
+	pCode->reserve(nInstructions + nInstructions / 8);
+
+	Instruction op;
+	for (size_t i = 0; i < nInstructions; i++)
+	{
+		op.pParam = NULL;
+		if (0 == NextRandom(pSeed) % 8)
+		{
+			Label *pLabel;
+			if ((NextRandom(pSeed) % 15) || pLabels->empty())
+			{
+				pLabel = new Label;
+				pLabel->nNumRefs = 1;
+				pLabel->nExpectedByteOffset = 0;
+				pLabels->push_back(pLabel);
+			}
+			else
+			{
+				pLabel = (*pLabels)[NextRandom(pSeed) % pLabels->size()];
+				pLabel->nNumRefs++;
+			}
+			op.opcode = OP_BR_UNRESOLVED;
+			op.size = BR_UNRESOLVED_SIZE;
+			op.pParam = pLabel;
+		}
+		else
+		{
+			op.opcode = OP_MISC;
+			op.size = NextRandom(pSeed) % 3 + 1;
+			op.nParam = 0;
+		}
+		pCode->push_back(op);
+	}
+
+	op.opcode = OP_LABEL;
+	op.size = 0;
+	for (Label *pLabel : *pLabels)
+	{
+		op.pParam = pLabel;
+		pCode->insert(pCode->begin() + NextRandom(pSeed) % pCode->size(), op);
+	}
+}
+
+static void FreeLabels(vector<Label*> *pLabels)
+{
+	for (Label *pLabel : *pLabels)
+	{
+		delete pLabel;
+	}
+	pLabels->clear();
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	size_t nFunctions = (argc > 1) ? (size_t)atol(argv[1]) : 2000;
+
+	vector<Instruction> code;
+	vector<Label*> labels;
+
+#ifdef _DONT_USE_ARENA
+	printf("ResolveBranches, branch graph on the heap\n\n");
+#else
+	printf("ResolveBranches, branch graph in the thread arena\n\n");
+#endif
+	printf("%12s %12s %14s %14s\n", "instructions", "functions", "us/function", "news/function");
+
+	for (size_t nSize : s_functionSizes)
+	{
+		unsigned int nSeed = 1;
+
+		// One untimed, so the arena has its pages and the first function
+		// of each size isn't paying for them.
+		BuildFunction(nSize, &nSeed, &code, &labels);
+		ResolveBranches(&code);
+		FreeLabels(&labels);
+
+		double dSeconds = 0;
+		size_t nAllocs = 0;
+		for (size_t i = 0; i < nFunctions; i++)
+		{
+			BuildFunction(nSize, &nSeed, &code, &labels);
+
+			size_t nAllocsBefore = s_nHeapAllocs;
+			CStopwatch watch;
+			ResolveBranches(&code);
+			dSeconds += watch.Seconds();
+			nAllocs += s_nHeapAllocs - nAllocsBefore;
+
+			FreeLabels(&labels);
+		}
+
+		printf("%12u %12u %14.2f %14.1f\n", (unsigned int)nSize, (unsigned int)nFunctions,
+			dSeconds * 1e6 / nFunctions, (double)nAllocs / nFunctions);
+	}
+
+	return 0;
+}
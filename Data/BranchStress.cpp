@@ -0,0 +1,219 @@
+// BranchStress.cpp : ResolveBranches on random functions, every encoding
+// checked against the code it ended up in and against a plain solver.
+//
+// Each round builds a random function: misc instructions, branches to
+// labels (most get a label of their own, the rest share one) and the labels
+// dropped in at random, as the test harness's BuildRandomInstructionStream
+// does.  Every kDenseRounds rounds the branches are far denser, so they
+// span each other in long cycles.
+//
+// After ResolveBranches every branch must be br.s or br.l with its size,
+// and its offset must be the byte distance from the end of the branch to
+// its label in the resolved code: br.s within [-128, 127], br.l outside it.
+//
+// Each branch's size is also held to a whole-function fixed point (all
+// short, then lengthen whatever doesn't reach until nothing changes), the
+// least any encoding can be.  Never shorter than that, and where it's
+// longer (a cycle of branches ResolveBranches gave up on and made long)
+// it's counted and reported rather than failed.
+//
+// Usage: BranchStress [rounds] [seed]   default 5,000 rounds, seed 1.
+
+#include "stdafx.h"
+
+#include "Instruction.h"
+
+static const size_t kMinInstructions = 64;
+static const size_t kMaxInstructions = 512;
+static const unsigned int kDenseRounds = 8;
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed >> 8;
+}
+
+#define CHECK(x) if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); return false; }
+
+// One in nBranchOdds instructions a branch.
+static void BuildFunction(unsigned int nBranchOdds, unsigned int *pSeed,
+							vector<Instruction> *pCode, vector<Label*> *pLabels)
+{
+	size_t nInstructions = kMinInstructions + NextRandom(pSeed) % (kMaxInstructions - kMinInstructions);
+
+	Instruction op;
+	for (size_t i = 0; i < nInstructions; i++)
+	{
+		op.pParam = NULL;
+		if (0 == NextRandom(pSeed) % nBranchOdds)
+		{
+			Label *pLabel;
+			if ((NextRandom(pSeed) % 15) || pLabels->empty())
+			{
+				pLabel = new Label;
+				pLabel->nNumRefs = 1;
+				pLabel->nExpectedByteOffset = 0;
+				pLabels->push_back(pLabel);
+			}
+			else
+			{
+				pLabel = (*pLabels)[NextRandom(pSeed) % pLabels->size()];
+				pLabel->nNumRefs++;
+			}
+			op.opcode = OP_BR_UNRESOLVED;
+			op.size = BR_UNRESOLVED_SIZE;
+			op.pParam = pLabel;
+		}
+		else
+		{
+			op.opcode = OP_MISC;
+			op.size = NextRandom(pSeed) % 3 + 1;
+			op.nParam = 0;
+		}
+		pCode->push_back(op);
+	}
+
+	op.opcode = OP_LABEL;
+	op.size = 0;
+	for (Label *pLabel : *pLabels)
+	{
+		op.pParam = pLabel;
+		pCode->insert(pCode->begin() + NextRandom(pSeed) % pCode->size(), op);
+	}
+}
+
+// Each instruction's byte offset, and each label's.
+static void ComputeOffsets(const vector<Instruction> &code, const vector<size_t> &sizes,
+							vector<size_t> *pOffsets, unordered_map<Label*, size_t> *pLabelOffsets)
+{
+	size_t nOffset = 0;
+	pOffsets->resize(code.size());
+	for (size_t i = 0; i < code.size(); i++)
+	{
+		(*pOffsets)[i] = nOffset;
+		if (OP_LABEL == code[i].opcode)
+		{
+			(*pLabelOffsets)[(Label*)code[i].pParam] = nOffset;
+		}
+		nOffset += sizes[i];
+	}
+}
+
+static bool IsShort(int nOffset)
+{
+	return (nOffset >= -128) && (nOffset <= 127);
+}
+
+// The plain solver: every branch short, then lengthen any that can't reach
+// and go round again, until a pass changes nothing.  Branches only ever
+// grow, so this stops at the least sizes that work.
+static void SolveFixedPoint(const vector<Instruction> &code, vector<size_t> *pSizes)
+{
+	pSizes->resize(code.size());
+	for (size_t i = 0; i < code.size(); i++)
+	{
+		(*pSizes)[i] = (OP_BR_UNRESOLVED == code[i].opcode) ? BR_SHORT_SIZE : code[i].size;
+	}
+
+	vector<size_t> offsets;
+	unordered_map<Label*, size_t> labelOffsets;
+	bool bChanged;
+	do
+	{
+		ComputeOffsets(code, *pSizes, &offsets, &labelOffsets);
+		bChanged = false;
+		for (size_t i = 0; i < code.size(); i++)
+		{
+			if ((OP_BR_UNRESOLVED == code[i].opcode) && ((*pSizes)[i] == BR_SHORT_SIZE))
+			{
+				int nOffset = (int)labelOffsets[(Label*)code[i].pParam] - (int)(offsets[i] + BR_SHORT_SIZE);
+				if (!IsShort(nOffset))
+				{
+					(*pSizes)[i] = BR_LONG_SIZE;
+					bChanged = true;
+				}
+			}
+		}
+	}
+	while (bChanged);
+}
+
+// *pOversized counts the branches longer than they need be.
+static bool CheckFunction(const vector<Instruction> &original, const vector<Instruction> &code, size_t *pOversized)
+{
+	CHECK(code.size() == original.size());
+
+	vector<size_t> expected;
+	SolveFixedPoint(original, &expected);
+
+	vector<size_t> sizes(code.size());
+	for (size_t i = 0; i < code.size(); i++)
+	{
+		sizes[i] = code[i].size;
+	}
+	vector<size_t> offsets;
+	unordered_map<Label*, size_t> labelOffsets;
+	ComputeOffsets(code, sizes, &offsets, &labelOffsets);
+
+	for (size_t i = 0; i < code.size(); i++)
+	{
+		if (OP_BR_UNRESOLVED != original[i].opcode)
+		{
+			CHECK(code[i].opcode == original[i].opcode);
+			CHECK(code[i].size == original[i].size);
+			CHECK(code[i].pParam == original[i].pParam);
+			continue;
+		}
+
+		CHECK((OP_BR_S == code[i].opcode) || (OP_BR_L == code[i].opcode));
+		CHECK(code[i].size == ((OP_BR_S == code[i].opcode) ? BR_SHORT_SIZE : BR_LONG_SIZE));
+		CHECK(code[i].size >= expected[i]);
+		*pOversized += (code[i].size > expected[i]);
+
+		int nOffset = (int)labelOffsets[(Label*)original[i].pParam] - (int)(offsets[i] + code[i].size);
+		CHECK(code[i].nParam == nOffset);
+		CHECK(IsShort(nOffset) == (OP_BR_S == code[i].opcode));
+	}
+	return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	unsigned int nRounds = (argc > 1) ? (unsigned int)atol(argv[1]) : 5000;
+	unsigned int nSeed = (argc > 2) ? (unsigned int)atol(argv[2]) : 1;
+
+	printf("%u rounds, seed %u\n", nRounds, nSeed);
+
+	bool bSucceeded = true;
+	size_t nShort = 0;
+	size_t nLong = 0;
+	size_t nOversized = 0;
+	vector<Instruction> code;
+	vector<Label*> labels;
+
+	for (unsigned int nRound = 0; bSucceeded && (nRound < nRounds); nRound++)
+	{
+		code.clear();
+		labels.clear();
+		BuildFunction((0 == nRound % kDenseRounds) ? 2 : 8, &nSeed, &code, &labels);
+
+		vector<Instruction> original(code);
+		ResolveBranches(&code);
+		bSucceeded = CheckFunction(original, code, &nOversized);
+
+		for (const Instruction &op : code)
+		{
+			nShort += (OP_BR_S == op.opcode);
+			nLong += (OP_BR_L == op.opcode);
+		}
+		for (Label *pLabel : labels)
+		{
+			delete pLabel;
+		}
+	}
+
+	printf("%u short, %u long branches, %u long that could be short\n",
+		(unsigned int)nShort, (unsigned int)nLong, (unsigned int)nOversized);
+	puts(bSucceeded ? "Succeeded" : "FAILED!!!");
+	return bSucceeded ? 0 : 1;
+}
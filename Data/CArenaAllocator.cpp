@@ -18,6 +18,15 @@
 #include "os.h"
 #include "CArenaAllocator.h"
 
+#include <mutex>
+#ifdef _WANT_ARENA_TRACE
+#include <chrono>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 #if defined(_DEBUG) || defined(_WANT_STATS)
 #define _MARKER_SIZE 4
 #endif
@@ -42,6 +51,8 @@ struct CArenaAllocHeader
 
 static void AddAllocMarkers(CArenaAllocHeader *pHeader);
 static void VerifyPage(const CArenaPageHeader *pHeader);
+static void VerifyAllocations(const BYTE *pStart, const BYTE *pEnd);
+static void MarkPage(CArenaPageHeader *pHeader);
 static void VerifyDeadAllocation(const CArenaAllocHeader *pHeader);
 
 #endif
@@ -50,38 +61,333 @@ static void VerifyDeadAllocation(const CArenaAllocHeader *pHeader);
 struct CArenaPageHeader
 {
 	CArenaPageHeader	*pNextPage;
+	size_t				nPageSize; // does include the header and any Pre/Post Buffers!
 	BYTE *Buffer() const { return ((BYTE*)this + ALIGN_TO_POINTER(sizeof(CArenaPageHeader))); }
 
 #ifdef _DEBUG
 	BYTE		*highWaterMark;
-	size_t		nPageSize; // does include any Pre/Post Buffers!
 	BYTE		marker[_MARKER_SIZE];
 
 	BYTE *TailMarker() const { return (BYTE*)this + this->nPageSize - _MARKER_SIZE; }
 #endif
 };
 
-CArenaAllocator::CArenaAllocator() :
-	 m_pCurrPage(0), m_pCurrentFree(0), m_pBarrier(0)
+CArenaPagePool::CArenaPagePool(size_t nPageSize, size_t nMaxFreePages) :
+	m_pSlots(NULL), m_idle(0), m_empty(0), m_nPageSize(nPageSize), m_nMaxFreePages(MIN(nMaxFreePages, kMaxSlots))
+{
+	m_pSlots = new CSlot[ m_nMaxFreePages ];
+	for (size_t i = 0; i < m_nMaxFreePages; i++)
+	{
+		m_pSlots[i].pPage = NULL;
+		Push(&m_empty, (SlotId)(i + 1));
+	}
+}
+
+CArenaPagePool::~CArenaPagePool()
+{
+	// No one else can be touching the pool by now.
+	SlotId nSlot;
+	while ((nSlot = Pop(&m_idle)) != 0)
+	{
+		delete [] m_pSlots[nSlot - 1].pPage;
+	}
+	delete [] m_pSlots;
+}
+
+CArenaPagePool *CArenaPagePool::Shared()
+{
+	static CArenaPagePool s_pool;
+	return &s_pool;
+}
+
+CArenaPagePool::SlotId CArenaPagePool::Pop(std::atomic<TaggedHead> *pHead)
+{
+	TaggedHead head = pHead->load(std::memory_order_acquire);
+	for (;;)
+	{
+		SlotId nTop = (SlotId)head;
+		if (nTop == 0)
+		{
+			return 0;
+		}
+
+		// nTop may be popped (and even pushed again) by someone else before
+		// the CAS.  Its link is still safe to read since slots outlive every
+		// pop; the tag makes the CAS fail in that case.
+		TaggedHead next = ((head >> 32) + 1) << 32 | m_pSlots[nTop - 1].nNext.load(std::memory_order_relaxed);
+		if (pHead->compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+		{
+			return nTop;
+		}
+	}
+}
+
+void CArenaPagePool::Push(std::atomic<TaggedHead> *pHead, SlotId nSlot)
+{
+	TaggedHead head = pHead->load(std::memory_order_relaxed);
+	TaggedHead next;
+	do
+	{
+		m_pSlots[nSlot - 1].nNext.store((SlotId)head, std::memory_order_relaxed);
+		next = (head & ~(TaggedHead)kMaxSlots) | nSlot; // only pops need to change the tag
+	} while (!pHead->compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+BYTE *CArenaPagePool::AllocPage(size_t nPageSize)
+{
+	if (nPageSize == m_nPageSize)
+	{
+		SlotId nSlot = Pop(&m_idle);
+		if (nSlot)
+		{
+			BYTE *pPage = m_pSlots[nSlot - 1].pPage;
+			Push(&m_empty, nSlot);
+			return pPage;
+		}
+	}
+
+	return new BYTE[ nPageSize ];
+}
+
+void CArenaPagePool::FreePage(BYTE *pPage, size_t nPageSize)
+{
+	SlotId nSlot = (nPageSize == m_nPageSize) ? Pop(&m_empty) : 0;
+	if (nSlot == 0)
+	{
+		// Enough idle memory sitting around already.  Nothing in the pool
+		// points into the page, so it can go.
+		delete [] pPage;
+		return;
+	}
+
+	m_pSlots[nSlot - 1].pPage = pPage;
+	Push(&m_idle, nSlot);
+}
+
+CArenaMappedPageSource::CArenaMappedPageSource(size_t nReserveBytes, bool bHugePages) :
+	m_pBase(NULL), m_nReserved(0), m_nUsed(0), m_nCommitted(0), m_bHugePages(bHugePages)
+{
+	nReserveBytes = (nReserveBytes + kCommitChunk - 1) & ~(kCommitChunk - 1);
+
+#ifdef _WIN32
+	// Large pages can't be committed lazily on Windows, so bHugePages is ignored.
+	m_pBase = (BYTE*)VirtualAlloc(NULL, nReserveBytes, MEM_RESERVE, PAGE_NOACCESS);
+	if (m_pBase == NULL)
+	{
+		return;
+	}
+#else
+	void *pMap = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (bHugePages)
+	{
+		// Explicit huge pages are reserved up front, so this fails cleanly
+		// (rather than faulting later) if the system pool is too small.
+		pMap = mmap(NULL, nReserveBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+	if (pMap == MAP_FAILED)
+	{
+		// Over-reserve so the base can be aligned for transparent huge pages.
+		size_t nMapBytes = nReserveBytes + kCommitChunk;
+		pMap = mmap(NULL, nMapBytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (pMap == MAP_FAILED)
+		{
+			return;
+		}
+
+		BYTE *pAligned = (BYTE*)(((size_t)pMap + kCommitChunk - 1) & ~(kCommitChunk - 1));
+		size_t nHead = pAligned - (BYTE*)pMap;
+		if (nHead)
+		{
+			munmap(pMap, nHead);
+		}
+		munmap(pAligned + nReserveBytes, kCommitChunk - nHead);
+		pMap = pAligned;
+
+#ifdef MADV_HUGEPAGE
+		if (bHugePages)
+		{
+			madvise(pMap, nReserveBytes, MADV_HUGEPAGE);
+		}
+#endif
+	}
+	m_pBase = (BYTE*)pMap;
+#endif
+
+	m_nReserved = nReserveBytes;
+}
+
+CArenaMappedPageSource::~CArenaMappedPageSource()
 {
-#ifdef _WANT_STATS
-	m_totalBytesAllocated = 0;
-	m_totalBytesRequested = 0;
-	m_pagesAllocated = 0;
-	m_numRequests = 0;
+	if (m_pBase == NULL)
+	{
+		return;
+	}
+#ifdef _WIN32
+	VirtualFree(m_pBase, 0, MEM_RELEASE);
+#else
+	munmap(m_pBase, m_nReserved);
 #endif
+}
+
+bool CArenaMappedPageSource::Commit(size_t nBytes)
+{
+	if (nBytes <= m_nCommitted)
+	{
+		return true;
+	}
+
+	size_t nNewCommitted = MIN((nBytes + kCommitChunk - 1) & ~(kCommitChunk - 1), m_nReserved);
+#ifdef _WIN32
+	if (VirtualAlloc(m_pBase + m_nCommitted, nNewCommitted - m_nCommitted, MEM_COMMIT, PAGE_READWRITE) == NULL)
+#else
+	if (mprotect(m_pBase + m_nCommitted, nNewCommitted - m_nCommitted, PROT_READ | PROT_WRITE) != 0)
+#endif
+	{
+		return false;
+	}
+	m_nCommitted = nNewCommitted;
+	return true;
+}
+
+BYTE *CArenaMappedPageSource::AllocPage(size_t nPageSize)
+{
+	size_t nOffset = (m_nUsed + 15) & ~(size_t)15;
+	if ((m_pBase == NULL) || (nOffset + nPageSize > m_nReserved) || !Commit(nOffset + nPageSize))
+	{
+		return NULL;
+	}
+	m_nUsed = nOffset + nPageSize;
+	return m_pBase + nOffset;
+}
+
+void CArenaMappedPageSource::FreePage(BYTE *pPage, size_t nPageSize)
+{
+	// Only the most recent page can be given back to the bump pointer.
+	// Anything else waits for ReleaseAll.
+	if (pPage + nPageSize == m_pBase + m_nUsed)
+	{
+		m_nUsed = pPage - m_pBase;
+	}
+}
+
+bool CArenaMappedPageSource::ReleaseAll(size_t nKeepBytes)
+{
+	nKeepBytes = (nKeepBytes + kCommitChunk - 1) & ~(kCommitChunk - 1);
+	if (m_nCommitted > nKeepBytes)
+	{
+#ifdef _WIN32
+		VirtualFree(m_pBase + nKeepBytes, m_nCommitted - nKeepBytes, MEM_DECOMMIT);
+		m_nCommitted = nKeepBytes;
+#else
+		// The range stays mapped read/write, the kernel just drops the
+		// physical pages and hands back zeroed ones if touched again.
+		madvise(m_pBase + nKeepBytes, m_nCommitted - nKeepBytes, MADV_DONTNEED);
+#endif
+	}
+	m_nUsed = 0;
+	return true;
+}
+
+CArenaPagePolicy::CArenaPagePolicy(Growth growth, size_t nFirstPageSize, size_t nPageSize, size_t nMaxPageSize) :
+	m_growth(growth), m_nFirstPageSize(nFirstPageSize), m_nPageSize(nPageSize),
+	m_nMaxPageSize(MAX(nPageSize, nMaxPageSize)), m_nHighWater(0)
+{
+}
+
+size_t CArenaPagePolicy::FirstPageSize() const
+{
+	size_t nHighWater = m_nHighWater.load(std::memory_order_relaxed);
+	if ((m_growth != GROW_HINTED) || (nHighWater == 0))
+	{
+		return m_nFirstPageSize;
+	}
+
+	// Enough to hold the whole last run, plus the page header and tail marker,
+	// rounded up to 1K so similar runs end up with interchangeable pages.
+	const size_t kRound = 1024;
+	size_t nSize = nHighWater + ALIGN_TO_POINTER(sizeof(CArenaPageHeader)) + sizeof(void*);
+	nSize = (nSize + kRound - 1) & ~(kRound - 1);
+	return MIN(MAX(nSize, m_nFirstPageSize), m_nMaxPageSize);
+}
+
+size_t CArenaPagePolicy::NextPageSize(size_t nLastPageSize) const
+{
+	if (m_growth == GROW_FIXED)
+	{
+		return m_nPageSize;
+	}
+	// Doubling keeps the number of pages (and the walk to free them)
+	// logarithmic in the size of the arena.
+	return MIN(MAX(nLastPageSize * 2, m_nPageSize), m_nMaxPageSize);
+}
+
+void CArenaPagePolicy::RecordHighWater(size_t nBytesUsed)
+{
+	if (m_growth == GROW_HINTED)
+	{
+		m_nHighWater.store(nBytesUsed, std::memory_order_relaxed);
+	}
+}
+
+CArenaAllocator::CArenaAllocator(CArenaPageSource *pPageSource, CArenaPagePolicy *pPagePolicy) :
+	 m_pPageSource(pPageSource), m_pPagePolicy(pPagePolicy),
+	 m_pCurrPage(0), m_pCurrentFree(0), m_pBarrier(0),
+	 m_pSparePages(0), m_pOrphanPages(0), m_pFinalizers(0), m_nRetiredBytes(0)
+{
+	DropFreeLists();
+	ARENA_TRACE(m_nTraceId = CArenaTrace::NewArenaId());
+
+	// Policy takes over once the first page is made.  Until then this
+	// only matters for the orphan cutoff.
+	if (m_pPagePolicy)
+	{
+		m_nNextPageSize = m_pPagePolicy->NextPageSize(0);
+	}
+	else
+	{
+		size_t nPreferred = m_pPageSource ? m_pPageSource->PreferredPageSize() : 0;
+		m_nNextPageSize = nPreferred ? nPreferred : CArenaPagePool::kDefaultPageSize;
+	}
 
 #ifndef _DEBUG
 	// Should be our /only/ overhead in release mode.
-	StaticAssert(sizeof(CArenaPageHeader) == sizeof(BYTE*));
+	StaticAssert(sizeof(CArenaPageHeader) == sizeof(BYTE*) + sizeof(size_t));
 #endif
 }
 
 CArenaAllocator::~CArenaAllocator()
 {
+	ARENA_TRACE(CArenaTrace::Record(m_nTraceId, CArenaTraceRecord::FREE, 0));
 	FreeAllPages();
 }
 
+CArenaAllocator *CArenaAllocator::ThreadArena()
+{
+	static thread_local CArenaAllocator s_arena(CArenaPagePool::Shared());
+	return &s_arena;
+}
+
+BYTE *CArenaAllocator::AllocPage(size_t nPageSize)
+{
+	if (m_pPageSource)
+	{
+		return m_pPageSource->AllocPage(nPageSize);
+	}
+	return new BYTE[ nPageSize ];
+}
+
+void CArenaAllocator::FreePage(CArenaPageHeader *pPage)
+{
+	if (m_pPageSource)
+	{
+		m_pPageSource->FreePage((BYTE*)pPage, pPage->nPageSize);
+		return;
+	}
+	delete [] (BYTE*)pPage;
+}
+
 void CArenaAllocator::MakeFirstPage()
 {
 	// An interpreter is often instantiated just to evaluate variables being passed 
@@ -92,57 +398,425 @@ void CArenaAllocator::MakeFirstPage()
 	// first page until there is a request for memory - this optimizes for the
 	// running of scripts that don't take parms.  Then make the  first page much 
 	// smaller than normal to optimize for the 'some parameters to a script' 
-	// case, and the 'eval' case.
-	const size_t kFirstPageSize = 192;
-	m_pCurrPage = new BYTE[ kFirstPageSize ];
-	if (m_pCurrPage == NULL)
+	// case, and the 'eval' case.  (Unless the policy knows better.)
+	size_t nFirstPageSize = m_pPagePolicy ? m_pPagePolicy->FirstPageSize() : CArenaPagePolicy::kDefaultFirstPageSize;
+
+	// With a page pool a recycled full size page costs no more than a small
+	// one, and saves the second trip to grow.
+	size_t nPreferred = m_pPageSource ? m_pPageSource->PreferredPageSize() : 0;
+	if (nFirstPageSize < nPreferred)
+	{
+		nFirstPageSize = nPreferred;
+	}
+
+	CArenaPageHeader *pHeader = (CArenaPageHeader *)AllocPage(nFirstPageSize);
+	if (pHeader == NULL)
 	{
 		return;
 	}
-	m_pBarrier = m_pCurrPage + kFirstPageSize;
+	pHeader->nPageSize = nFirstPageSize;
+	UsePage(pHeader);
 
-	CArenaPageHeader *pHeader = (CArenaPageHeader *)m_pCurrPage;
-	m_pCurrentFree = pHeader->Buffer();
-	pHeader->pNextPage = NULL;
+	// Don't count overhead. We want to know how many bytes of page get left over.
+	ARENA_STAT(m_stats.nPageBytes += nFirstPageSize - sizeof(CArenaPageHeader));
+	ARENA_STAT(m_stats.nPagesAllocated++);
+}
 
-	DBG_ONLY(pHeader->nPageSize = kFirstPageSize);
-	DBG_ONLY(AddPageMarkers(pHeader));
+// Push an empty page on the front of the page list and allocate out of it.
+void CArenaAllocator::UsePage(CArenaPageHeader *pPage)
+{
+	if (m_pCurrPage)
+	{
+		ARENA_STAT(UpdatePeak());
+		ARENA_STAT(m_stats.nWastedTailBytes += m_pBarrier - m_pCurrentFree);
+		m_nRetiredBytes += m_pCurrentFree - ((CArenaPageHeader *)m_pCurrPage)->Buffer();
+	}
 
-	// Don't count overhead. We want to know how many bytes of page get left over.
-	STAT_ONLY(m_totalBytesAllocated = kFirstPageSize - sizeof(CArenaPageHeader) - _MARKER_SIZE);
-	STAT_ONLY(m_pagesAllocated = 1);
+	pPage->pNextPage = (CArenaPageHeader *)m_pCurrPage;
+	m_pCurrPage = (BYTE*)pPage;
+	m_pCurrentFree = pPage->Buffer();
+	m_pBarrier = (BYTE*)pPage + pPage->nPageSize;
+
+	if (m_pPagePolicy)
+	{
+		m_nNextPageSize = m_pPagePolicy->NextPageSize(pPage->nPageSize);
+	}
+
+	DBG_ONLY(AddPageMarkers(pPage));
+}
+
+// Only the head of the spare list is considered.  They are almost all the
+// standard page size, and walking for a better fit would cost more than it saves.
+CArenaPageHeader *CArenaAllocator::TakeSparePage(size_t nMinPageSize)
+{
+	CArenaPageHeader *pPage = m_pSparePages;
+	if ((pPage == NULL) || (pPage->nPageSize < nMinPageSize))
+	{
+		return NULL;
+	}
+	m_pSparePages = pPage->pNextPage;
+	return pPage;
+}
+
+size_t CArenaAllocator::BytesInUse() const
+{
+	size_t nBytes = m_nRetiredBytes;
+	if (m_pCurrPage)
+	{
+		nBytes += m_pCurrentFree - ((CArenaPageHeader *)m_pCurrPage)->Buffer();
+	}
+	return nBytes;
+}
+
+// Run destructors registered by Create() back to pStop, newest first.
+void CArenaAllocator::RunFinalizers(const CArenaFinalizer *pStop)
+{
+	while (m_pFinalizers != pStop)
+	{
+		Assert(m_pFinalizers != NULL); // Mark from another arena, or rewound out of order.
+		CArenaFinalizer *pFinalizer = m_pFinalizers;
+
+		// Unlink first; a destructor is allowed to use the arena.
+		m_pFinalizers = pFinalizer->pNext;
+		pFinalizer->pfnDestroy(pFinalizer->pObject);
+		DBG_ONLY(DbgDeleteHelper(pFinalizer));
+	}
+}
+
+void CArenaAllocator::UpdatePeak()
+{
+	m_stats.nPeakBytes = MAX(m_stats.nPeakBytes, BytesInUse());
+}
+
+CArenaStats CArenaAllocator::GetStats() const
+{
+	CArenaStats stats = m_stats;
+	ARENA_STAT(stats.nPeakBytes = MAX(stats.nPeakBytes, BytesInUse()));
+	return stats;
+}
+
+// Process wide totals.  Arenas only touch them on Reset/free so the lock
+// stays out of the allocation path.
+static CArenaStats *ProcessStats(std::mutex **ppLock)
+{
+	static std::mutex s_lock;
+	static CArenaStats s_stats;
+	*ppLock = &s_lock;
+	return &s_stats;
+}
+
+CArenaStats CArenaAllocator::GetProcessStats()
+{
+	std::mutex *pLock;
+	CArenaStats *pStats = ProcessStats(&pLock);
+	std::lock_guard<std::mutex> lock(*pLock);
+	return *pStats;
+}
+
+void CArenaAllocator::ReportStats()
+{
+	std::mutex *pLock;
+	CArenaStats *pStats = ProcessStats(&pLock);
+	{
+		std::lock_guard<std::mutex> lock(*pLock);
+		pStats->AddDelta(m_stats, m_reportedStats);
+	}
+	m_reportedStats = m_stats;
+}
+
+#ifdef _WANT_ARENA_TRACE
+static CArenaTraceRecord s_traceRecords[CArenaTrace::kCapacity];
+static std::atomic<unsigned __int64> s_nTraceNext(0);	// total ever recorded
+static std::atomic<unsigned int> s_nTraceArenaIds(0);
+
+unsigned int CArenaTrace::NewArenaId()
+{
+	return s_nTraceArenaIds.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void CArenaTrace::Record(unsigned int nArenaId, CArenaTraceRecord::Kind kind, size_t nBytes)
+{
+	unsigned __int64 nIndex = s_nTraceNext.fetch_add(1, std::memory_order_relaxed);
+	CArenaTraceRecord &record = s_traceRecords[nIndex & (kCapacity - 1)];
+
+	record.nTimestamp = (unsigned __int64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	record.nArenaId = nArenaId;
+	record.nKindAndSize = ((unsigned int)kind << CArenaTraceRecord::kSizeBits) | (unsigned int)MIN(nBytes, (size_t)CArenaTraceRecord::kMaxSize);
+}
+
+void CArenaTrace::Snapshot(std::vector<CArenaTraceRecord> *pRecords)
+{
+	unsigned __int64 nNext = s_nTraceNext.load();
+	unsigned __int64 nFirst = (nNext > kCapacity) ? nNext - kCapacity : 0;
+
+	pRecords->clear();
+	pRecords->reserve((size_t)(nNext - nFirst));
+	for (unsigned __int64 i = nFirst; i < nNext; i++)
+	{
+		pRecords->push_back(s_traceRecords[i & (kCapacity - 1)]);
+	}
+}
+
+bool CArenaTrace::Dump(const char *pFileName)
+{
+	std::vector<CArenaTraceRecord> records;
+	Snapshot(&records);
+
+	FILE *pFile = fopen(pFileName, "wb");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+	unsigned int header[2] = { kFileMagic, (unsigned int)records.size() };
+	bool bOk = (fwrite(header, sizeof(header), 1, pFile) == 1) &&
+			   (records.empty() || (fwrite(&records[0], sizeof(CArenaTraceRecord), records.size(), pFile) == records.size()));
+	return (fclose(pFile) == 0) && bOk;
+}
+
+void CArenaTrace::Clear()
+{
+	s_nTraceNext.store(0);
+}
+#endif // _WANT_ARENA_TRACE
+
+bool CArenaTrace::Load(const char *pFileName, std::vector<CArenaTraceRecord> *pRecords)
+{
+	StaticAssert(sizeof(CArenaTraceRecord) == 16);
+
+	pRecords->clear();
+	FILE *pFile = fopen(pFileName, "rb");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+	unsigned int header[2];
+	bool bOk = (fread(header, sizeof(header), 1, pFile) == 1) && (header[0] == kFileMagic);
+	if (bOk)
+	{
+		pRecords->resize(header[1]);
+		bOk = pRecords->empty() || (fread(&(*pRecords)[0], sizeof(CArenaTraceRecord), pRecords->size(), pFile) == pRecords->size());
+	}
+	fclose(pFile);
+	return bOk;
+}
+
+void CArenaStats::AddDelta(const CArenaStats &now, const CArenaStats &before)
+{
+	nRequests += now.nRequests - before.nRequests;
+	nBytesRequested += now.nBytesRequested - before.nBytesRequested;
+	nPagesAllocated += now.nPagesAllocated - before.nPagesAllocated;
+	nPageBytes += now.nPageBytes - before.nPageBytes;
+	nOrphans += now.nOrphans - before.nOrphans;
+	nOrphanBytes += now.nOrphanBytes - before.nOrphanBytes;
+	nWastedTailBytes += now.nWastedTailBytes - before.nWastedTailBytes;
+	nResets += now.nResets - before.nResets;
+	nRecycled += now.nRecycled - before.nRecycled;
+	nPeakBytes = MAX(nPeakBytes, now.nPeakBytes);
+	for (size_t i = 0; i < kSizeClasses; i++)
+	{
+		sizeClasses[i] += now.sizeClasses[i] - before.sizeClasses[i];
+	}
+}
+
+std::string CArenaStats::ToJson() const
+{
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer),
+		"{\"requests\":%llu,\"bytesRequested\":%llu,\"pagesAllocated\":%llu,\"pageBytes\":%llu,"
+		"\"orphans\":%llu,\"orphanBytes\":%llu,\"wastedTailBytes\":%llu,\"peakBytes\":%llu,\"resets\":%llu,"
+		"\"recycled\":%llu,\"sizeClasses\":[",
+		(unsigned long long)nRequests, (unsigned long long)nBytesRequested,
+		(unsigned long long)nPagesAllocated, (unsigned long long)nPageBytes,
+		(unsigned long long)nOrphans, (unsigned long long)nOrphanBytes,
+		(unsigned long long)nWastedTailBytes, (unsigned long long)nPeakBytes,
+		(unsigned long long)nResets, (unsigned long long)nRecycled);
+
+	std::string json(buffer);
+	for (size_t i = 0; i < kSizeClasses; i++)
+	{
+		snprintf(buffer, sizeof(buffer), "%s%llu", i ? "," : "", (unsigned long long)sizeClasses[i]);
+		json += buffer;
+	}
+	json += "]}";
+	return json;
+}
+
+void CArenaAllocator::Reset(size_t nMaxRetainedBytes)
+{
+	ARENA_TRACE(CArenaTrace::Record(m_nTraceId, CArenaTraceRecord::RESET, 0));
+	RunFinalizers(NULL);
+	DropFreeLists();
+
+	if (m_pPagePolicy)
+	{
+		m_pPagePolicy->RecordHighWater(BytesInUse());
+	}
+	ARENA_STAT(UpdatePeak());
+	ARENA_STAT(m_stats.nResets++);
+	ARENA_STAT(ReportStats());
+
+	DBG_ONLY( VerifyLivePages() );
+
+	if (m_pPageSource && m_pPageSource->ReleaseAll(nMaxRetainedBytes))
+	{
+		ForgetAllPages();
+		return;
+	}
+
+	CArenaPageHeader *pKeep = NULL;
+	size_t nKeptBytes = 0;
+
+	CArenaPageHeader *lists[] = { (CArenaPageHeader *)m_pCurrPage, m_pOrphanPages, m_pSparePages };
+	for (size_t i = 0; i < ARRAYSIZE(lists); i++)
+	{
+		CArenaPageHeader *pPage = lists[i];
+		while (pPage)
+		{
+			CArenaPageHeader *pNextPage = pPage->pNextPage;
+			if (nKeptBytes + pPage->nPageSize <= nMaxRetainedBytes)
+			{
+				nKeptBytes += pPage->nPageSize;
+				pPage->pNextPage = pKeep;
+				pKeep = pPage;
+			}
+			else
+			{
+				FreePage(pPage);
+			}
+			pPage = pNextPage;
+		}
+	}
+
+	// Back to the 'no page yet' state.  The next allocation picks up a spare
+	// through GrowPagesAndAllocate, which keeps an unused arena free of cost.
+	ForgetAllPages();
+	m_pSparePages = pKeep;
+}
+
+// The pages are gone (or owned by someone else now), reset the bookkeeping.
+void CArenaAllocator::ForgetAllPages()
+{
+	m_pCurrPage = NULL;
+	m_pCurrentFree = NULL;
+	m_pBarrier = NULL;
+	m_pOrphanPages = NULL;
+	m_pSparePages = NULL;
+	m_pFinalizers = NULL;
+	m_nRetiredBytes = 0;
+}
+
+void CArenaAllocator::DropFreeLists()
+{
+	memset(m_pFreeLists, 0, sizeof(m_pFreeLists));
+}
+
+void CArenaAllocator::Rewind(const CArenaMark &mark)
+{
+	ARENA_TRACE(CArenaTrace::Record(m_nTraceId, CArenaTraceRecord::REWIND, 0));
+	RunFinalizers(mark.pFinalizer);
+	DropFreeLists();
+	ARENA_STAT(UpdatePeak());
+
+	// Everything pushed on the page lists since the mark goes to the spares.
+	while (m_pOrphanPages != mark.pOrphan)
+	{
+		Assert(m_pOrphanPages != NULL); // Mark from another arena, or rewound out of order.
+		CArenaPageHeader *pPage = m_pOrphanPages;
+		DBG_ONLY( VerifyPage( pPage ) );
+
+		m_pOrphanPages = pPage->pNextPage;
+		pPage->pNextPage = m_pSparePages;
+		m_pSparePages = pPage;
+	}
+
+	while (m_pCurrPage != mark.pPage)
+	{
+		Assert(m_pCurrPage != NULL); // Mark from another arena, or rewound out of order.
+		CArenaPageHeader *pPage = (CArenaPageHeader *)m_pCurrPage;
+		DBG_ONLY( VerifyPage( pPage ) );
+
+		m_pCurrPage = (BYTE*)pPage->pNextPage;
+		pPage->pNextPage = m_pSparePages;
+		m_pSparePages = pPage;
+	}
+
+#ifdef _DEBUG
+	// The tail of the mark's page must be all dead too.
+	CArenaPageHeader *pPage = (CArenaPageHeader *)m_pCurrPage;
+	if (pPage)
+	{
+		VerifyAllocations(mark.pFree, pPage->highWaterMark);
+		pPage->highWaterMark = mark.pFree;
+	}
+#endif
+
+	m_pCurrentFree = mark.pFree;
+	m_pBarrier = mark.pBarrier;
+	m_nRetiredBytes = mark.nRetiredBytes;
 }
 
 void CArenaAllocator::FreeAllPages()
 {
+	RunFinalizers(NULL);
+	DropFreeLists();
+
+	if (m_pPagePolicy)
+	{
+		m_pPagePolicy->RecordHighWater(BytesInUse());
+	}
+	ARENA_STAT(UpdatePeak());
+	ARENA_STAT(ReportStats());
+
 #ifdef _WANT_ARENA_STATS
-	SD2("   Arena: # of Requests:   %d\n", m_numRequests);
-	SD2("   Arena: Bytes Requested: %d\n", m_totalBytesRequested);
-	SD2("   Arena: Bytes Allocated: %d\n", m_totalBytesAllocated);
-	SD2("   Arena: Pages Allocated: %d\n", m_pagesAllocated);
+	SD2("   Arena: # of Requests:   %zu\n", m_stats.nRequests);
+	SD2("   Arena: Bytes Requested: %zu\n", m_stats.nBytesRequested);
+	SD2("   Arena: Bytes Allocated: %zu\n", m_stats.nPageBytes);
+	SD2("   Arena: Pages Allocated: %zu\n", m_stats.nPagesAllocated);
+	SD2("   Arena: Wasted Tails:    %zu\n", m_stats.nWastedTailBytes);
+	SD2("   Arena: Peak Bytes:      %zu\n", m_stats.nPeakBytes);
+	SD2("   Arena: Recycled:        %zu\n", m_stats.nRecycled);
 #endif
-	CArenaPageHeader *pPage = (CArenaPageHeader *)m_pCurrPage;
-	while (pPage)
+
+	DBG_ONLY( VerifyLivePages() );
+
+	// A source that can drop everything at once saves the walk.
+	if (m_pPageSource && m_pPageSource->ReleaseAll(0))
 	{
-		DBG_ONLY( VerifyPage( pPage ) );
+		ForgetAllPages();
+		return;
+	}
 
-		CArenaPageHeader *pNextPage = pPage->pNextPage;
-		delete [] pPage;
+	CArenaPageHeader *lists[] = { (CArenaPageHeader *)m_pCurrPage, m_pOrphanPages, m_pSparePages };
+	for (size_t i = 0; i < ARRAYSIZE(lists); i++)
+	{
+		CArenaPageHeader *pPage = lists[i];
+		while (pPage)
+		{
+			CArenaPageHeader *pNextPage = pPage->pNextPage;
+			FreePage(pPage);
 
-		pPage = pNextPage;
+			pPage = pNextPage;
+		}
 	}
 }
 
 void *CArenaAllocator::GrowPagesAndAllocate(size_t nMinSize) // return value can be returned to user
 {
-	const size_t kIdealPageSize = 4096; // paramter to constructor? DAL_Variable? Both?
-
 	Assert(m_pCurrentFree + nMinSize > m_pBarrier);
 
 	// Get the 1st page?
 	if (m_pCurrentFree == NULL)
 	{
-		MakeFirstPage();
+		CArenaPageHeader *pSpare = TakeSparePage(0);
+		if (pSpare)
+		{
+			UsePage(pSpare);
+		}
+		else
+		{
+			MakeFirstPage();
+		}
 		if (m_pCurrentFree == NULL)
 		{
 			return NULL;
@@ -157,53 +831,66 @@ void *CArenaAllocator::GrowPagesAndAllocate(size_t nMinSize) // return value can
 		}
 	}
 
-	size_t nBytesToAllocate = kIdealPageSize;
+	size_t nBytesToAllocate = m_nNextPageSize;
 	bool bOrphanBlock = false;
 	// min page size is size of block requested, size of header, and size of tail marker
 	size_t nMinPageSize = nMinSize + ALIGN_TO_POINTER(sizeof(CArenaPageHeader));
 	DBG_ONLY( nMinPageSize += _MARKER_SIZE ); // tail marker in debug
 
-	if (nMinPageSize > (kIdealPageSize>>1) )
+	if (nMinPageSize > (m_nNextPageSize>>1) )
 	{
 		// Need to handle the case where the requested block is larger than
 		// our ideal block size.  In addition, if it's bigger than 1/2 the 
 		// ideal size and didn't fit, let's also give it a dedicated block.
 
-		// Insert a 'finished' page to the page list. 
-		// This lets the next allocation try to use the remaining space
-		// in the current page.
+		// The dedicated block goes on its own list rather than the page
+		// list, so the current page stays current and the next allocation
+		// can use the remaining space in it.
 
 		bOrphanBlock = true;
 		nBytesToAllocate = nMinPageSize;
 	}
 
-	// Don't count overhead. We want to know how many bytes of page get left over.
-	STAT_ONLY(m_totalBytesAllocated += (nBytesToAllocate - sizeof(CArenaPageHeader) - _MARKER_SIZE));
-	STAT_ONLY(m_pagesAllocated++);
-
 	Assert(m_pCurrPage != NULL);
 
-	CArenaPageHeader *pNewFirstPage = (CArenaPageHeader*)new char[ nBytesToAllocate ];
-	if (pNewFirstPage == NULL)
+	// Reuse a page kept by Reset/Rewind if it is big enough.
+	CArenaPageHeader *pNewPage = TakeSparePage(nMinPageSize);
+	if (pNewPage == NULL)
 	{
-		return NULL;
-	}
+		// Don't count overhead. We want to know how many bytes of page get left over.
+		ARENA_STAT(m_stats.nPageBytes += (nBytesToAllocate - sizeof(CArenaPageHeader)));
+		ARENA_STAT(m_stats.nPagesAllocated++);
 
-	pNewFirstPage->pNextPage = (CArenaPageHeader *)m_pCurrPage;
-	DBG_ONLY(pNewFirstPage->nPageSize = nBytesToAllocate);
+		pNewPage = (CArenaPageHeader*)AllocPage(nBytesToAllocate);
+		if (pNewPage == NULL)
+		{
+			return NULL;
+		}
+		pNewPage->nPageSize = nBytesToAllocate;
+	}
 
-	m_pCurrPage = (BYTE*)pNewFirstPage;
-	BYTE* pMem = pNewFirstPage->Buffer();
+	BYTE* pMem = pNewPage->Buffer();
 
 	// Did we actually make a new arena page,
 	// or just a 1-off orphan?
-	if (!bOrphanBlock)
+	if (bOrphanBlock)
 	{
-		m_pBarrier = (BYTE*)pNewFirstPage + nBytesToAllocate;
-		m_pCurrentFree = pMem + ALIGN_TO_POINTER(nMinSize);
+		pNewPage->pNextPage = m_pOrphanPages;
+		m_pOrphanPages = pNewPage;
+		m_nRetiredBytes += nMinSize;
+		ARENA_STAT(m_stats.nOrphans++);
+		ARENA_STAT(m_stats.nOrphanBytes += nMinSize);
+#ifdef _DEBUG
+		MarkPage(pNewPage);
+		// Exactly one allocation lives here.  Its size may not fit in
+		// nAllocationSize, so don't let VerifyPage walk past it.
+		pNewPage->highWaterMark = pMem + 1;
+#endif
+		return pMem;
 	}
 
-	DBG_ONLY(AddPageMarkers(pNewFirstPage));
+	UsePage(pNewPage);
+	m_pCurrentFree += ALIGN_TO_POINTER(nMinSize);
 
 	return pMem;
 }
@@ -211,11 +898,13 @@ void *CArenaAllocator::GrowPagesAndAllocate(size_t nMinSize) // return value can
 #ifdef _DEBUG
 void *CArenaAllocator::DbgAllocate(size_t nBytesRequested)
 {
-	m_totalBytesRequested += nBytesRequested;
-	m_numRequests++;
+	ARENA_STAT(m_stats.nRequests++);
+	ARENA_STAT(m_stats.nBytesRequested += nBytesRequested);
+	ARENA_STAT(m_stats.sizeClasses[CArenaStats::SizeClass(nBytesRequested)]++);
 
-	// Make room for guard markers and info
-	size_t nBytes = nBytesRequested + ALIGN_TO_POINTER((sizeof(CArenaAllocHeader)) + _MARKER_SIZE);
+	// Make room for guard markers and info.  Must add up the same way
+	// CArenaAllocHeader::Next() walks them or VerifyPage gets lost.
+	size_t nBytes = ALIGN_TO_POINTER(sizeof(CArenaAllocHeader)) + ALIGN_TO_POINTER(nBytesRequested + _MARKER_SIZE);
 
 	BYTE *pMem;
 	// m_pBarrier is the 1st illegal address
@@ -270,6 +959,19 @@ static void AddAllocMarkers(CArenaAllocHeader *pHeader)
 	}
 }
 
+// Spares were checked on the way in.
+void CArenaAllocator::VerifyLivePages() const
+{
+	for (const CArenaPageHeader *pPage = (const CArenaPageHeader *)m_pCurrPage; pPage; pPage = pPage->pNextPage)
+	{
+		VerifyPage(pPage);
+	}
+	for (const CArenaPageHeader *pPage = m_pOrphanPages; pPage; pPage = pPage->pNextPage)
+	{
+		VerifyPage(pPage);
+	}
+}
+
 void CArenaAllocator::AddPageMarkers(CArenaPageHeader *pHeader)
 {
 	// While we take pretty good care to make sure we handle align correctly
@@ -282,6 +984,11 @@ void CArenaAllocator::AddPageMarkers(CArenaPageHeader *pHeader)
 	// Flip head/tail markers at the page level.
 	m_pBarrier -= _MARKER_SIZE;
 	Assert(m_pBarrier > m_pCurrentFree); // if this fails our pages are too small
+	MarkPage(pHeader);
+}
+
+static void MarkPage(CArenaPageHeader *pHeader)
+{
 	pHeader->highWaterMark = pHeader->Buffer();
 	memcpy(pHeader->marker, _TAIL_MARKER, _MARKER_SIZE);
 	memcpy(pHeader->TailMarker(), _HEAD_MARKER, _MARKER_SIZE);
@@ -295,14 +1002,18 @@ static void VerifyPage(const CArenaPageHeader *pPage)
 	Assert(memcmp(pEndPageMarker, _HEAD_MARKER, _MARKER_SIZE) == 0);
 
 	// Look for any non-destructor called objects in the page.
-	BYTE *pAlloc = pPage->Buffer();
-	while (pAlloc < pPage->highWaterMark)
+	VerifyAllocations(pPage->Buffer(), pPage->highWaterMark);
+}
+
+static void VerifyAllocations(const BYTE *pStart, const BYTE *pEnd)
+{
+	const BYTE *pAlloc = pStart;
+	while (pAlloc < pEnd)
 	{
-		CArenaAllocHeader *pAllocHeader = (CArenaAllocHeader *)pAlloc;
+		const CArenaAllocHeader *pAllocHeader = (const CArenaAllocHeader *)pAlloc;
 		VerifyDeadAllocation(pAllocHeader);
-		pAlloc = (BYTE*)pAllocHeader->Next();
+		pAlloc = (const BYTE*)pAllocHeader->Next();
 	}
-
 }
 
 static void VerifyDeadAllocation(const CArenaAllocHeader *pHeader)
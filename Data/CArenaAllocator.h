@@ -17,27 +17,359 @@
 // done with it.
 
 //#define _DONT_USE_ARENA
-//#define _WANT_ARENA_STATS // enable to see arena stats, also set _WANT_STATS on the project if Release mode.
+//#define _WANT_ARENA_STATS // enable to have each arena print its stats when freed.
+//#define _NO_ARENA_STATS // compile out the runtime stats (CArenaStats) entirely.
+//#define _WANT_ARENA_TRACE // record every arena event in CArenaTrace's ring buffer.
+
+#ifdef _NO_ARENA_STATS
+#define ARENA_STAT(x)
+#else
+#define ARENA_STAT(x) x
+#endif
+
+#ifdef _WANT_ARENA_TRACE
+#define ARENA_TRACE(x) x
+#else
+#define ARENA_TRACE(x)
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 struct CArenaPageHeader;
+struct CArenaFinalizer;
+struct CArenaFreeBlock;
+
+// Allocation statistics, for tuning page sizes in production.  Per arena
+// with CArenaAllocator::GetStats(), and summed over every arena in the
+// process with CArenaAllocator::GetProcessStats().  All zero if compiled
+// out with _NO_ARENA_STATS.
+struct CArenaStats
+{
+	// Requests by size, in powers of two: [0] is up to 8 bytes, [1] up to 16, ...
+	// the last class holds everything bigger.
+	static const size_t kSizeClasses = 16;
+
+	size_t	nRequests;
+	size_t	nBytesRequested;
+	size_t	nPagesAllocated;	// new pages only, reused spares don't count
+	size_t	nPageBytes;			// usable bytes in those pages
+	size_t	nOrphans;			// blocks big enough to get a dedicated page
+	size_t	nOrphanBytes;
+	size_t	nWastedTailBytes;	// left unused at the end of a page when the arena moved on
+	size_t	nPeakBytes;			// most bytes in use at once
+	size_t	nResets;
+	size_t	nRecycled;			// requests served from a size-class free list
+	size_t	sizeClasses[kSizeClasses];
+
+	CArenaStats() { memset(this, 0, sizeof(*this)); }
+
+	static size_t SizeClass(size_t nBytes)
+	{
+		if (nBytes <= 8)
+		{
+			return 0;
+		}
+#if defined(_MSC_VER)
+		unsigned long nTopBit;
+	#ifdef _WIN64
+		_BitScanReverse64(&nTopBit, nBytes - 1);
+	#else
+		_BitScanReverse(&nTopBit, nBytes - 1);
+	#endif
+#else
+		size_t nTopBit = (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(nBytes - 1);
+#endif
+		// 9..16 bytes has a top bit of 3, and is class 1
+		return MIN((size_t)nTopBit - 2, kSizeClasses - 1);
+	}
+
+	// this += (now - before).  Peaks combine by max.
+	void AddDelta(const CArenaStats &now, const CArenaStats &before);
+
+	std::string ToJson() const;
+};
+
+// Checkpoint in an arena.  See CArenaAllocator::Mark()/Rewind().
+struct CArenaMark
+{
+	BYTE	*pPage;
+	BYTE	*pFree;
+	BYTE	*pBarrier;
+	CArenaPageHeader	*pOrphan;
+	CArenaFinalizer		*pFinalizer;
+	size_t	nRetiredBytes;
+};
+
+// One entry in an arena's list of destructors to run, allocated in the arena.
+struct CArenaFinalizer
+{
+	void			(*pfnDestroy)(void *pObject);
+	void			*pObject;
+	CArenaFinalizer	*pNext;
+};
+
+// A recycled block, on its arena's free list for its size class.
+struct CArenaFreeBlock
+{
+	CArenaFreeBlock	*pNext;
+};
+
+// One event in an allocation trace.  16 bytes, written as is to trace files.
+struct CArenaTraceRecord
+{
+	enum Kind
+	{
+		ALLOCATE,	// size is the request
+		RESET,
+		FREE,		// arena destroyed
+		MARK,
+		REWIND		// to the most recent MARK not yet rewound
+	};
+
+	unsigned __int64	nTimestamp;		// steady clock, ns
+	unsigned int		nArenaId;
+	unsigned int		nKindAndSize;	// kind in the top 3 bits
+
+	static const unsigned int kSizeBits = 29;
+	static const unsigned int kMaxSize = (1u << kSizeBits) - 1; // bigger requests are clamped
+
+	Kind GetKind() const { return (Kind)(nKindAndSize >> kSizeBits); }
+	size_t GetSize() const { return nKindAndSize & kMaxSize; }
+};
+
+// Process wide ring buffer of arena events, for replaying real allocation
+// sequences through other page sizes/policies (see ArenaReplay.cpp).  Only
+// recorded when built with _WANT_ARENA_TRACE; otherwise nothing in the
+// arena references it.  Holds the last kCapacity events from all threads.
+class CArenaTrace
+{
+public:
+	static const size_t kCapacity = 1 << 20;
+
+	// Trace file: magic, record count, then the records oldest first.
+	static const unsigned int kFileMagic = 0x43525441; // "ATRC"
+
+#ifdef _WANT_ARENA_TRACE
+	static unsigned int NewArenaId();
+	static void Record(unsigned int nArenaId, CArenaTraceRecord::Kind kind, size_t nBytes);
+
+	// Oldest first.  Only consistent while no arena is being used.
+	static void Snapshot(std::vector<CArenaTraceRecord> *pRecords);
+	static bool Dump(const char *pFileName);
+	static void Clear();
+#endif
+
+	static bool Load(const char *pFileName, std::vector<CArenaTraceRecord> *pRecords);
+};
+
+// Where an arena gets its pages.  Without one an arena uses new/delete.
+class CArenaPageSource
+{
+public:
+	virtual ~CArenaPageSource() { }
+
+	virtual BYTE *AllocPage(size_t nPageSize) = 0;	// NULL if out of memory
+	virtual void FreePage(BYTE *pPage, size_t nPageSize) = 0;
+
+	// Page size this source is best at, 0 for no preference.
+	virtual size_t PreferredPageSize() const { return 0; }
+
+	// Sources that can drop every page they handed out in one go return
+	// true, and the arena forgets its page lists instead of walking them.
+	// Up to nKeepBytes may stay resident for the next round.
+	virtual bool ReleaseAll(size_t /* nKeepBytes */) { return false; }
+};
+
+// A page recycler shared between threads.  Arenas handed a pool take their
+// standard sized pages from it and give them back on free instead of going
+// through the global heap (and its lock) every time an arena grows or dies.
+//
+// Idle pages are held in slots, a fixed array of nMaxFreePages made with
+// the pool.  Slots move between two lock-free stacks, those holding an idle
+// page and the empty ones.  The links live in the slots, never in the
+// pages, and slots are never freed while the pool lives: a thread reading
+// the link of a slot someone else just popped still reads valid memory, so
+// a page over the cap can go straight back to the heap.  Each stack's head
+// is a single 64 bit word, slot and a tag bumped on every pop (a popped
+// slot can be pushed right back by another thread, the ABA case), so the
+// stacks are lock-free wherever there's a 64 bit CAS.
+class CArenaPagePool : public CArenaPageSource
+{
+	NON_COPYABLE(CArenaPagePool)
+public:
+	static const size_t kDefaultPageSize = 4096;
+	static const size_t kDefaultMaxFreePages = 4096; // 16MB of idle pages at the default size
+
+	CArenaPagePool(size_t nPageSize = kDefaultPageSize, size_t nMaxFreePages = kDefaultMaxFreePages);
+	~CArenaPagePool();
+
+	// Process wide pool used by the thread arenas.
+	static CArenaPagePool *Shared();
+
+	// Only PageSize() pages are pooled, anything else goes to the heap.
+	virtual BYTE *AllocPage(size_t nPageSize);
+	virtual void FreePage(BYTE *pPage, size_t nPageSize);
+	virtual size_t PreferredPageSize() const { return m_nPageSize; }
+
+	size_t PageSize() const { return m_nPageSize; }
+
+private:
+	// Slots are named by index + 1 so 0 can be the bottom of a stack.
+	typedef unsigned int SlotId;
+	static const size_t kMaxSlots = 0xFFFFFFFF;
+
+	struct CSlot
+	{
+		BYTE				*pPage;	// only touched by whoever popped the slot
+		std::atomic<SlotId>	nNext;	// next slot down its stack
+	};
+
+	// tag << 32 | slot at the top
+	typedef unsigned __int64 TaggedHead;
+	StaticAssert(std::atomic<TaggedHead>::is_always_lock_free);
+
+	SlotId Pop(std::atomic<TaggedHead> *pHead);	// 0 if the stack is empty
+	void Push(std::atomic<TaggedHead> *pHead, SlotId nSlot);
+
+	CSlot						*m_pSlots;
+	std::atomic<TaggedHead>		m_idle;		// slots holding a page
+	std::atomic<TaggedHead>		m_empty;	// slots free for one
+	const size_t				m_nPageSize;
+	const size_t				m_nMaxFreePages;
+};
+
+// Pages carved out of one big reserved address range.  Memory is committed
+// as the arena grows into it, can be backed by huge pages to cut TLB misses,
+// and goes back to the OS with one call on reset/free instead of a walk of
+// the page list.  Individual frees are not reused until then.
+//
+// Serves a single arena; not thread safe.  The reservation is a hard cap on
+// the arena (plus orphans), so size it for the worst case.  Address space
+// is cheap.
+class CArenaMappedPageSource : public CArenaPageSource
+{
+	NON_COPYABLE(CArenaMappedPageSource)
+public:
+	static const size_t kDefaultReserveBytes = (size_t)1 << 30;
+	static const size_t kCommitChunk = 2 * 1024 * 1024;	// also the x64 huge page size
+
+	CArenaMappedPageSource(size_t nReserveBytes = kDefaultReserveBytes, bool bHugePages = false);
+	~CArenaMappedPageSource();
+
+	bool IsValid() const { return m_pBase != NULL; }	// false if the reservation failed
+
+	virtual BYTE *AllocPage(size_t nPageSize);
+	virtual void FreePage(BYTE *pPage, size_t nPageSize);
+	virtual bool ReleaseAll(size_t nKeepBytes);
+
+private:
+	bool Commit(size_t nBytes);
+
+	BYTE	*m_pBase;
+	size_t	m_nReserved;
+	size_t	m_nUsed;		// bump pointer, as an offset from m_pBase
+	size_t	m_nCommitted;	// readable/writable prefix
+	bool	m_bHugePages;
+};
+
+// How big to make each page of an arena.  One policy can be shared by
+// many arenas (ie: one per kind of parse) so the hinted mode can learn
+// from the last arena of that kind that was freed or reset.
+class CArenaPagePolicy
+{
+	NON_COPYABLE(CArenaPagePolicy)
+public:
+	enum Growth
+	{
+		GROW_FIXED,		// every page after the first is nPageSize
+		GROW_GEOMETRIC,	// pages double from nPageSize up to nMaxPageSize
+		GROW_HINTED		// geometric, with the first page sized from the last run's high water mark
+	};
+
+	static const size_t kDefaultFirstPageSize = 192;
+	static const size_t kDefaultMaxPageSize = 256 * 1024;
+
+	CArenaPagePolicy(Growth growth = GROW_FIXED,
+					 size_t nFirstPageSize = kDefaultFirstPageSize,
+					 size_t nPageSize = CArenaPagePool::kDefaultPageSize,
+					 size_t nMaxPageSize = kDefaultMaxPageSize);
+
+	size_t FirstPageSize() const;
+	size_t NextPageSize(size_t nLastPageSize) const;
+
+	// Arenas report how many bytes they ended up using when they are reset or freed.
+	void RecordHighWater(size_t nBytesUsed);
+
+private:
+	const Growth	m_growth;
+	const size_t	m_nFirstPageSize;
+	const size_t	m_nPageSize;
+	const size_t	m_nMaxPageSize;
+	std::atomic<size_t>	m_nHighWater;	// last reported, GROW_HINTED only
+};
 
 class CArenaAllocator
 {
 	NON_COPYABLE(CArenaAllocator)
 public:
-	CArenaAllocator();
+	// Pages come from pPageSource when one is given (ie: a CArenaPagePool
+	// shared between threads).  The arena itself is still single threaded.
+	// Without a policy pages are the source's preferred size, or the classic
+	// small first page then 4K pages.  Neither is owned.
+	CArenaAllocator(CArenaPageSource *pPageSource = NULL, CArenaPagePolicy *pPagePolicy = NULL);
 	~CArenaAllocator();
 
+	// Per-thread arena backed by CArenaPagePool::Shared().  Pages go back
+	// to the shared pool when the thread exits.
+	static CArenaAllocator *ThreadArena();
+
+	// Releases every allocation but keeps up to nMaxRetainedBytes of pages
+	// for reuse, so an arena recycled per request stops hitting the heap
+	// once it is warmed up.  Anything past the cap is freed.
+	static const size_t kDefaultRetainedBytes = 64 * 1024;
+	void Reset(size_t nMaxRetainedBytes = kDefaultRetainedBytes);
+
+	// O(1) checkpoints for nested work (ie: 'eval').  Rewind releases everything
+	// allocated since the mark; pages emptied by it are kept for reuse.
+	// Marks must be rewound in LIFO order, and a Reset invalidates them all.
+	CArenaMark Mark() const
+	{
+		ARENA_TRACE(CArenaTrace::Record(m_nTraceId, CArenaTraceRecord::MARK, 0));
+		CArenaMark mark = { m_pCurrPage, m_pCurrentFree, m_pBarrier, m_pOrphanPages, m_pFinalizers, m_nRetiredBytes };
+		return mark;
+	}
+	void Rewind(const CArenaMark &mark);
+
+	// Bytes handed out and not yet released by Reset/Rewind, alignment
+	// included.  Wasted page tails and spare pages don't count.
+	size_t BytesInUse() const;
+
+	// Lifetime stats for this arena.
+	CArenaStats GetStats() const;
+
+	// Every arena in the process.  Arenas report in when they are Reset and
+	// when they are destroyed, so live arenas are only counted up to their
+	// last Reset.
+	static CArenaStats GetProcessStats();
+
 	inline
 	void *Allocate(size_t nBytes)
 	{
+		ARENA_TRACE(CArenaTrace::Record(m_nTraceId, CArenaTraceRecord::ALLOCATE, nBytes));
 #ifdef _DEBUG
 		// Allocation under debug is too much work to try to ifdef it
 		// into the inline-able Release path.
 		return DbgAllocate(nBytes);
 #else
-		STAT_ONLY(m_totalBytesRequested += nBytes);
-		STAT_ONLY(m_numRequests++);
+		ARENA_STAT(m_stats.nRequests++);
+		ARENA_STAT(m_stats.nBytesRequested += nBytes);
+		ARENA_STAT(m_stats.sizeClasses[CArenaStats::SizeClass(nBytes)]++);
 
 		void *pMem;
 		// m_pBarrier is the 1st illegal address
@@ -54,31 +386,216 @@ public:
 #endif
 	}
 
+	// Construct a T in the arena for objects that own resources.  Its
+	// destructor runs when the arena is freed, reset, or rewound past it;
+	// all of them newest first, in one pass.  Don't delete the object.
+	// Trivially destructible types get no finalizer and cost the same as
+	// _ARENA_NEW_HELPER.  (Except in debug, where everything gets one so the
+	// dead-allocation checks see the object released.)
+	template<typename T, typename... TArgs>
+	T *Create(TArgs&&... args)
+	{
+		// The arena only guarantees pointer alignment.
+		StaticAssert(__alignof(T) <= sizeof(void*));
+
+		void *pMem = Allocate(sizeof(T));
+		if (pMem == NULL)
+		{
+			return NULL;
+		}
+		T *pObject = new (pMem) T(std::forward<TArgs>(args)...);
+
+#ifndef _DEBUG
+		if (!std::is_trivially_destructible<T>::value)
+#endif
+		{
+			CArenaFinalizer *pFinalizer = (CArenaFinalizer *)Allocate(sizeof(CArenaFinalizer));
+			if (pFinalizer == NULL)
+			{
+				DestroyObject<T>(pObject);
+				return NULL;
+			}
+			pFinalizer->pfnDestroy = &DestroyObject<T>;
+			pFinalizer->pObject = pObject;
+			pFinalizer->pNext = m_pFinalizers;
+			m_pFinalizers = pFinalizer;
+		}
+		return pObject;
+	}
+
+	// Grow (or shrink) a block in place.  Only works when it is the last
+	// allocation on the current page and the new size still fits; callers
+	// fall back to allocate-and-copy otherwise.
+	inline
+	bool TryExtend(void *pBlock, size_t nOldBytes, size_t nNewBytes)
+	{
+#ifdef _DEBUG
+		// Debug blocks carry a tail marker at the old size.
+		(void)pBlock; (void)nOldBytes; (void)nNewBytes;
+		return false;
+#else
+		BYTE *pStart = (BYTE*)pBlock;
+		if ((pStart + ALIGN_TO_POINTER(nOldBytes) != m_pCurrentFree) || (pStart + nNewBytes > m_pBarrier))
+		{
+			return false;
+		}
+		ARENA_STAT(m_stats.nBytesRequested += nNewBytes - nOldBytes);
+		m_pCurrentFree = pStart + ALIGN_TO_POINTER(nNewBytes);
+		return true;
+#endif
+	}
+
+	// Size-class recycling for types that churn within one arena lifetime.
+	// Opt in per type with _ARENA_RECYCLE_NEW_HELPER/_ARENA_RECYCLE_DELETE_HELPER.
+	// Blocks up to kMaxRecycleSize are rounded up to a power of two and carry
+	// a hidden word naming their arena, so a sized delete can push them on
+	// that arena's free list for the next request of the same class.  Pages
+	// are still only released in bulk.  Free lists are dropped by Reset and
+	// Rewind (even blocks from before the mark, to keep Rewind O(1)).
+	static const size_t kMinRecycleSize = 16;
+	static const size_t kRecycleClasses = 5;
+	static const size_t kMaxRecycleSize = kMinRecycleSize << (kRecycleClasses - 1);
+
+	inline
+	void *AllocateRecyclable(size_t nBytes)
+	{
+#ifdef _DEBUG
+		// No reuse in debug; every block stays checked by the page verifier.
+		return DbgAllocate(nBytes);
+#else
+		size_t nClass = RecycleClass(nBytes);
+		if (nClass >= kRecycleClasses)
+		{
+			return Allocate(nBytes);
+		}
+
+		// A hit is counted and traced as the block a miss would allocate, so
+		// the stats and a replay see every request whether or not it was reused.
+		size_t nBlockBytes = sizeof(CArenaAllocator*) + (kMinRecycleSize << nClass);
+		CArenaFreeBlock *pBlock = m_pFreeLists[nClass];
+		if (pBlock)
+		{
+			ARENA_TRACE(CArenaTrace::Record(m_nTraceId, CArenaTraceRecord::ALLOCATE, nBlockBytes));
+			ARENA_STAT(m_stats.nRequests++);
+			ARENA_STAT(m_stats.nBytesRequested += nBlockBytes);
+			ARENA_STAT(m_stats.sizeClasses[CArenaStats::SizeClass(nBlockBytes)]++);
+			ARENA_STAT(m_stats.nRecycled++);
+			m_pFreeLists[nClass] = pBlock->pNext;
+			return pBlock;
+		}
+
+		CArenaAllocator **ppOwner = (CArenaAllocator **)Allocate(nBlockBytes);
+		if (ppOwner == NULL)
+		{
+			return NULL;
+		}
+		*ppOwner = this;
+		return ppOwner + 1;
+#endif
+	}
+
+	// nBytes must be the size the block was allocated with.
+	static inline
+	void Recycle(void *pBlock, size_t nBytes)
+	{
+#ifdef _DEBUG
+		DbgDeleteHelper(pBlock);
+		(void)nBytes;
+#else
+		size_t nClass = RecycleClass(nBytes);
+		if ((pBlock == NULL) || (nClass >= kRecycleClasses))
+		{
+			return;
+		}
+		CArenaAllocator *pOwner = ((CArenaAllocator **)pBlock)[-1];
+		CArenaFreeBlock *pFree = (CArenaFreeBlock *)pBlock;
+		pFree->pNext = pOwner->m_pFreeLists[nClass];
+		pOwner->m_pFreeLists[nClass] = pFree;
+#endif
+	}
+
 private:
+	// Folds away for a constant sizeof(T).
+	static inline
+	size_t RecycleClass(size_t nBytes)
+	{
+		size_t nClass = 0;
+		while ((nClass < kRecycleClasses) && ((kMinRecycleSize << nClass) < nBytes))
+		{
+			nClass++;
+		}
+		return nClass;
+	}
+
+	void DropFreeLists();
+
+	template<typename T>
+	static void DestroyObject(void *pObject)
+	{
+		((T*)pObject)->~T();
+		DBG_ONLY(DbgDeleteHelper(pObject));
+	}
+
+	void RunFinalizers(const CArenaFinalizer *pStop);
 	void FreeAllPages();
 	void *GrowPagesAndAllocate(size_t nMinSize); // return value can be returned to user
 	void MakeFirstPage();
+	void UsePage(CArenaPageHeader *pPage);
+	CArenaPageHeader *TakeSparePage(size_t nMinPageSize);
+
+	BYTE *AllocPage(size_t nPageSize);
+	void FreePage(CArenaPageHeader *pPage);
+
+	void ForgetAllPages();
+
+	CArenaPageSource *m_pPageSource;	// optional, not owned
+	CArenaPagePolicy *m_pPagePolicy; // optional, not owned
 
 	BYTE	*m_pCurrPage;		// Where to start freeing pages from.
 	BYTE	*m_pCurrentFree;	// Where to allocate next block if it fits. 
 	BYTE	*m_pBarrier;		// Ceiling to decide if it fits.
 
+	CArenaPageHeader	*m_pSparePages;	// Retained by Reset/Rewind, empty and ready for reuse.
+	CArenaPageHeader	*m_pOrphanPages; // Dedicated pages for big blocks, kept off the page list.
+
+	CArenaFinalizer		*m_pFinalizers;	// Newest first.  See Create().
+	CArenaFreeBlock		*m_pFreeLists[kRecycleClasses];	// See AllocateRecyclable().
+
+	size_t	m_nNextPageSize;	// Size of the next regular page.
+	size_t	m_nRetiredBytes;	// Bytes used in pages no longer current, for the high water mark.
+
 #ifdef _DEBUG
 public:
 	static void DbgDeleteHelper(void *ptr);
 private:
 	void *DbgAllocate(size_t nBytes);
 	void AddPageMarkers(CArenaPageHeader *pHeader);
+	void VerifyLivePages() const;
 #endif
-#if defined(_DEBUG) || defined(_WANT_STATS)
-	size_t m_totalBytesAllocated;
-	size_t m_totalBytesRequested;
-	size_t m_pagesAllocated;
-	size_t m_numRequests;
-#endif
+
+	void UpdatePeak();
+	void ReportStats();
+
+	CArenaStats	m_stats;
+	CArenaStats	m_reportedStats;	// what ReportStats already added to the process totals
+
+	ARENA_TRACE(unsigned int m_nTraceId;)
 };
 
 
+// Rewinds the arena when it goes out of scope.
+class CArenaRewindScope
+{
+	NON_COPYABLE(CArenaRewindScope)
+public:
+	CArenaRewindScope(CArenaAllocator *pArena) : m_pArena(pArena), m_mark(pArena->Mark()) { }
+	~CArenaRewindScope() { m_pArena->Rewind(m_mark); }
+
+private:
+	CArenaAllocator	*m_pArena;
+	CArenaMark		m_mark;
+};
+
 // @TODO:JTR Do we need to worry about array allocator.
 #ifdef _DONT_USE_ARENA
 	#define _ARENA_NEW_HELPER(pArena,nBytes)	inline void *operator new(size_t nBytes, CArenaAllocator *pArena) { return new char[ nBytes ]; }
@@ -92,4 +609,15 @@ private:
   #endif
 #endif
 
+// Same as the above, but delete recycles the block within its arena.  See
+// CArenaAllocator::AllocateRecyclable().  Only for types always created
+// with the recycling new.
+#ifdef _DONT_USE_ARENA
+	#define _ARENA_RECYCLE_NEW_HELPER(pArena,nBytes)		inline void *operator new(size_t nBytes, CArenaAllocator *pArena) { return new char[ nBytes ]; }
+	#define _ARENA_RECYCLE_DELETE_HELPER(ptr,nBytes)	inline void operator delete(void *ptr, size_t nBytes) { delete [] (char*)ptr; }
+#else
+	#define _ARENA_RECYCLE_NEW_HELPER(pArena,nBytes)		inline void *operator new(size_t nBytes, CArenaAllocator *pArena) { return pArena->AllocateRecyclable(nBytes); }
+	#define _ARENA_RECYCLE_DELETE_HELPER(ptr,nBytes)	inline void operator delete(void *ptr, size_t nBytes) { CArenaAllocator::Recycle(ptr, nBytes); }
+#endif
+
 #endif // _DEF_CARENAALLOCATOR_H_
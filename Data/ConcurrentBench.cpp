@@ -0,0 +1,187 @@
+// ConcurrentBench.cpp : Read scaling of ConcurrentTree.
+//
+// Fills a ConcurrentTree, then for 1, 2, 4 ... threads up to the hardware's
+// count has each thread make kSelects weighted selections with repeats
+// through its own Reader, while a writer thread changes a weight and
+// Publishes every kPublishMs.  The same selections from a plain Tree behind
+// a mutex, with the same writer taking the mutex to change a weight, are
+// the baseline.  Reads that scale show a total rate growing
+// with the thread count and a flat per thread rate.
+//
+// Usage: ConcurrentBench [node count]   default 1,000,000.
+
+#include "stdafx.h"
+
+#include <chrono>
+#include <thread>
+
+#include "ConcurrentTree.h"
+
+static const size_t kSelects = 1000000;
+static const unsigned int kPublishMs = 50;
+
+struct BenchItem
+{
+	unsigned int	nKey;
+	size_t			nWeight;
+
+	bool operator<(const BenchItem &rhs) const
+	{ return nKey < rhs.nKey; }
+
+	bool operator==(const BenchItem &rhs) const
+	{ return nKey == rhs.nKey; }
+
+	// Called from many threads at once, so it leaves the item alone.
+	void OnVisit()
+	{ }
+
+	size_t Weight() const
+	{ return nWeight; }
+};
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed;
+}
+
+class CStopwatch
+{
+public:
+	CStopwatch() : m_start(chrono::steady_clock::now()) { }
+	double Seconds() const { return chrono::duration<double>(chrono::steady_clock::now() - m_start).count(); }
+
+private:
+	chrono::steady_clock::time_point	m_start;
+};
+
+// Every thread's selections through its own Reader, with a writer
+// publishing the whole time.  return seconds for the readers.
+static double SelectShared(ConcurrentTree<BenchItem> *pShared, size_t nNodes, unsigned int nThreads, size_t *pnPublishes)
+{
+	atomic<bool> bDone(false);
+	*pnPublishes = 0;
+
+	thread writer([pShared, nNodes, &bDone, pnPublishes]()
+	{
+		unsigned int nSeed = 7;
+		while (!bDone.load())
+		{
+			this_thread::sleep_for(chrono::milliseconds(kPublishMs));
+			BenchItem item = { NextRandom(&nSeed) % (unsigned int)nNodes, 0 };
+			pShared->UpdateWeight(item, 1 + NextRandom(&nSeed) % 100);
+			pShared->Publish();
+			(*pnPublishes)++;
+		}
+	});
+
+	CStopwatch watch;
+	vector<thread> threads;
+	for (unsigned int i = 0; i < nThreads; i++)
+	{
+		threads.push_back(thread([pShared, i]()
+		{
+			ConcurrentTree<BenchItem>::Reader reader(*pShared, i + 1);
+			for (size_t j = 0; j < kSelects; j++)
+			{
+				reader.SelectRandom(&BenchItem::OnVisit);
+			}
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	double dSeconds = watch.Seconds();
+
+	bDone.store(true);
+	writer.join();
+	return dSeconds;
+}
+
+// The baseline: one Tree, a lock around each selection, and the same
+// writer changing a weight every kPublishMs under the lock.
+static double SelectLocked(Tree<BenchItem> *pTree, mutex *pLock, size_t nNodes, unsigned int nThreads)
+{
+	atomic<bool> bDone(false);
+
+	thread writer([pTree, pLock, nNodes, &bDone]()
+	{
+		unsigned int nSeed = 7;
+		while (!bDone.load())
+		{
+			this_thread::sleep_for(chrono::milliseconds(kPublishMs));
+			BenchItem item = { NextRandom(&nSeed) % (unsigned int)nNodes, 0 };
+			lock_guard<mutex> lock(*pLock);
+			pTree->UpdateWeight(item, 1 + NextRandom(&nSeed) % 100);
+		}
+	});
+
+	CStopwatch watch;
+	vector<thread> threads;
+	for (unsigned int i = 0; i < nThreads; i++)
+	{
+		threads.push_back(thread([pTree, pLock, i]()
+		{
+			CXoshiro256 random(i + 1);
+			for (size_t j = 0; j < kSelects; j++)
+			{
+				lock_guard<mutex> lock(*pLock);
+				pTree->SelectRandom(random, &BenchItem::OnVisit, true);
+			}
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	double dSeconds = watch.Seconds();
+
+	bDone.store(true);
+	writer.join();
+	return dSeconds;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	size_t nNodes = (argc > 1) ? (size_t)atol(argv[1]) : 1000000;
+	unsigned int nMaxThreads = MAX(thread::hardware_concurrency(), 1u);
+
+	// Keys 0..n-1 so the writer can hit existing ones.
+	ConcurrentTree<BenchItem> shared;
+	Tree<BenchItem> locked;
+	mutex lock;
+	unsigned int nSeed = 1;
+	for (size_t i = 0; i < nNodes; i++)
+	{
+		BenchItem item = { (unsigned int)i, 1 + NextRandom(&nSeed) % 100 };
+		shared.Add(item);
+		locked.Add(item);
+	}
+	shared.Publish();
+
+	printf("%8s %12s %12s %9s %10s %12s\n", "threads", "M sel/sec", "per thread", "scaling", "publishes", "mutex M/s");
+
+	double dOneThread = 0;
+	for (unsigned int nThreads = 1; ; nThreads = MIN(nThreads * 2, nMaxThreads))
+	{
+		size_t nPublishes;
+		double dShared = SelectShared(&shared, nNodes, nThreads, &nPublishes);
+		double dLocked = SelectLocked(&locked, &lock, nNodes, nThreads);
+
+		double dRate = kSelects * nThreads / dShared / 1e6;
+		if (nThreads == 1)
+		{
+			dOneThread = dRate;
+		}
+		printf("%8u %12.2f %12.2f %8.2fx %10u %12.2f\n", nThreads, dRate, dRate / nThreads,
+			dRate / dOneThread, (unsigned int)nPublishes, kSelects * nThreads / dLocked / 1e6);
+
+		if (nThreads == nMaxThreads)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "Tree.h"
+
+// A weighted random set many threads select from (with repeats) while a
+// writer changes it now and then.
+//
+// Writers work on a private Tree under a lock.  Their changes reach the
+// readers at the next Publish(), which copies that tree into a new
+// snapshot and swaps it in with one atomic store, so a burst of writes
+// costs one O(n) copy.  Snapshots never change once published: a reader
+// just loads the current one and does a Tree selection with repeats on
+// it, which only reads.  No locks, no retries, and nothing the readers
+// write is shared between them, so reads scale with the cores.
+//
+// Old snapshots are reclaimed by epoch.  Each Reader owns a slot, and
+// while it's in a snapshot the slot holds the epoch it started in; a
+// snapshot replaced in epoch e is freed once no slot holds e or earlier.
+// A reader that stalls mid-selection holds back reclamation, never the
+// writer.
+//
+// Readers call back into (or copy) items in a snapshot other threads are
+// in too, so callbacks mustn't change the item.
+//
+// Bits having to do with the 'random' stuff are commented //RND
+
+template <typename TData, typename TRandom = CXoshiro256>
+class ConcurrentTree
+{
+	NON_COPYABLE(ConcurrentTree)
+
+// public types
+	typedef void (TData::* TraverseCallBack)(void);
+	typedef Tree<TData, TRandom> Snapshot;
+
+// Interface
+public:
+	// Past this many Readers at once the rest still work, they just take
+	// the writers' lock for every selection.
+	static const size_t kMaxReaders = 256;
+
+	ConcurrentTree(void);
+	~ConcurrentTree(void);
+
+	// Writes; each takes the writers' lock and none is seen by readers
+	// until Publish().
+	void Add(const TData &data);
+	bool Remove(const TData &data);
+	bool UpdateWeight(const TData &data, size_t nWeight);
+
+	// Make every write so far visible to selections that start from now
+	// on, and free the snapshots no reader is in any more.  O(n).
+	void Publish();
+
+	// One per selecting thread: its generator, and its slot for the epochs.
+	class Reader;
+
+// Internal data types
+private:
+	// A slot per Reader.  Two cache lines apiece so no two readers' epochs
+	// ever share one, wherever the array starts.
+	struct Slot
+	{
+		std::atomic<unsigned __int64>	nEpoch;		// 0 when not in a snapshot
+		std::atomic<bool>				bClaimed;
+		char	pad[128 - sizeof(std::atomic<unsigned __int64>) - sizeof(std::atomic<bool>)];
+	};
+
+	struct Retired
+	{
+		Snapshot			*pSnapshot;
+		unsigned __int64	nEpoch;		// readers from this epoch or earlier may be in it
+	};
+
+// Internal Methods
+private:
+	Slot *ClaimSlot();
+
+	// Free the retired snapshots every reader is done with.  Under m_lock.
+	void Reclaim();
+
+// Internal data
+private:
+	std::atomic<Snapshot *>			m_pSnapshot;
+	std::atomic<unsigned __int64>	m_nEpoch;		// starts at 1; 0 is a slot's "not in one"
+	Slot							m_slots[kMaxReaders];
+
+	std::mutex				m_lock;			// writers, Publish, and readers without a slot
+	Tree<TData, TRandom>	m_tree;			// where the writes go
+	std::vector<Retired>	m_retired;
+};
+
+template<typename TData, typename TRandom>
+class ConcurrentTree<TData, TRandom>::Reader
+{
+	NON_COPYABLE(Reader)
+public:
+	Reader(ConcurrentTree &tree, unsigned __int64 nSeed = TRandom::kDefaultSeed)
+	: m_tree(tree), m_pSlot(tree.ClaimSlot()), m_random(nSeed)
+	{
+	}
+
+	~Reader()
+	{
+		if (m_pSlot)
+		{
+			m_pSlot->bClaimed.store(false, std::memory_order_release);
+		}
+	}
+
+	//RND Select a random item from the last published set, by weighted
+	// preference, with repeats.  false if it's empty or weighs nothing.
+	bool SelectRandom(TraverseCallBack callback)
+	{
+		Pin pin(this);
+		return pin.m_pSnapshot->SelectRandom(m_random, callback, true);
+	}
+
+	//RND k selections with repeats, as Tree::SelectRandomBatch, copying
+	// each item selected to out.  return the number copied.
+	template<typename TOutIt>
+	size_t SelectRandomBatch(size_t k, TOutIt out)
+	{
+		Pin pin(this);
+		CopyOut<TOutIt> copy(out);
+		return pin.m_pSnapshot->SelectRandomBatch(m_random, k, copy, true, true);
+	}
+
+	//RND Restart this reader's generator.
+	void Seed(unsigned __int64 nSeed) { m_random = TRandom(nSeed); }
+
+private:
+	// In a snapshot for the life of one of these.  The epoch goes in the
+	// slot before the snapshot pointer is read: a Publish that doesn't see
+	// the epoch has already swapped in the new snapshot, so that's the one
+	// this reads.
+	class Pin
+	{
+	public:
+		Pin(Reader *pReader) : m_pReader(pReader)
+		{
+			Slot *pSlot = pReader->m_pSlot;
+			if (pSlot)
+			{
+				pSlot->nEpoch.store(pReader->m_tree.m_nEpoch.load());
+			}
+			else
+			{
+				pReader->m_tree.m_lock.lock();
+			}
+			m_pSnapshot = pReader->m_tree.m_pSnapshot.load();
+		}
+
+		~Pin()
+		{
+			if (m_pReader->m_pSlot)
+			{
+				m_pReader->m_pSlot->nEpoch.store(0, std::memory_order_release);
+			}
+			else
+			{
+				m_pReader->m_tree.m_lock.unlock();
+			}
+		}
+
+		Reader		*m_pReader;
+		Snapshot	*m_pSnapshot;
+	};
+
+	// Output iterator copying the pointed to item; the pointer itself is
+	// only good while pinned.
+	template<typename TOutIt>
+	class CopyOut
+	{
+	public:
+		CopyOut(TOutIt out) : m_out(out) { }
+		CopyOut &operator*() { return *this; }
+		CopyOut &operator++() { return *this; }
+		CopyOut &operator=(TData *pData) { *m_out = *pData; ++m_out; return *this; }
+
+	private:
+		TOutIt	m_out;
+	};
+
+	ConcurrentTree	&m_tree;
+	Slot			*m_pSlot;	// NULL if there were none left
+	TRandom			m_random;
+};
+
+template<typename TData, typename TRandom>
+ConcurrentTree<TData, TRandom>::ConcurrentTree(void)
+: m_pSnapshot(new Snapshot), m_nEpoch(1)
+{
+	for (size_t i = 0; i < kMaxReaders; i++)
+	{
+		m_slots[i].nEpoch.store(0);
+		m_slots[i].bClaimed.store(false);
+	}
+}
+
+template<typename TData, typename TRandom>
+ConcurrentTree<TData, TRandom>::~ConcurrentTree(void)
+{
+	for (size_t i = 0; i < kMaxReaders; i++)
+	{
+		ASSERT(!m_slots[i].bClaimed.load());
+	}
+
+	for (size_t i = 0; i < m_retired.size(); i++)
+	{
+		delete m_retired[i].pSnapshot;
+	}
+	delete m_pSnapshot.load();
+}
+
+template<typename TData, typename TRandom>
+typename ConcurrentTree<TData, TRandom>::Slot *ConcurrentTree<TData, TRandom>::ClaimSlot()
+{
+	for (size_t i = 0; i < kMaxReaders; i++)
+	{
+		bool bFree = false;
+		if (!m_slots[i].bClaimed.load(std::memory_order_relaxed) &&
+			m_slots[i].bClaimed.compare_exchange_strong(bFree, true, std::memory_order_acquire))
+		{
+			return &m_slots[i];
+		}
+	}
+	return NULL;
+}
+
+template<typename TData, typename TRandom>
+void ConcurrentTree<TData, TRandom>::Add(const TData &data)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_tree.Add(data);
+}
+
+template<typename TData, typename TRandom>
+bool ConcurrentTree<TData, TRandom>::Remove(const TData &data)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_tree.Remove(data);
+}
+
+template<typename TData, typename TRandom>
+bool ConcurrentTree<TData, TRandom>::UpdateWeight(const TData &data, size_t nWeight)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_tree.UpdateWeight(data, nWeight);
+}
+
+// The copy is made outside any reader's view, then swapped in.  Readers
+// that started before the swap may still be in the old snapshot; the
+// epoch moves on so that ones starting after it can be told apart.
+template<typename TData, typename TRandom>
+void ConcurrentTree<TData, TRandom>::Publish()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	Snapshot *pNew = new Snapshot;
+	try
+	{
+		pNew->CopyFrom(m_tree);
+		m_retired.reserve(m_retired.size() + 1);
+	}
+	catch (...)
+	{
+		delete pNew;
+		throw;
+	}
+
+	Retired retired;
+	retired.pSnapshot = m_pSnapshot.exchange(pNew);
+	retired.nEpoch = m_nEpoch.fetch_add(1);
+	m_retired.push_back(retired);
+
+	Reclaim();
+}
+
+template<typename TData, typename TRandom>
+void ConcurrentTree<TData, TRandom>::Reclaim()
+{
+	unsigned __int64 nOldest = ~0ULL;
+	for (size_t i = 0; i < kMaxReaders; i++)
+	{
+		unsigned __int64 nEpoch = m_slots[i].nEpoch.load();
+		if (nEpoch && (nEpoch < nOldest))
+		{
+			nOldest = nEpoch;
+		}
+	}
+
+	size_t nKept = 0;
+	for (size_t i = 0; i < m_retired.size(); i++)
+	{
+		if (m_retired[i].nEpoch < nOldest)
+		{
+			delete m_retired[i].pSnapshot;
+		}
+		else
+		{
+			m_retired[nKept++] = m_retired[i];
+		}
+	}
+	m_retired.resize(nKept);
+}
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Would really want to use a boost graph, or a sedgewick graph.
+// but let's throw one together to see how it works out.
+
+// Colours and visits.  64 bits, so NewColor/NewVisited never come back
+// around to a stamp some node still holds.
+typedef unsigned __int64 GraphEpoch;
+
+// Allocators whose memory all comes back at once, rather than block by
+// block, say so here (CArenaStlAllocator does, in ArenaContainers.h).  A
+// graph using one, of data with nothing to destroy, is torn down without
+// visiting its nodes.
+template<typename TAlloc>
+struct AllocatorFreesInBulk : std::false_type { };
+
+// The node map for keys that are indexes, 0..n-1 or close to it: a slot
+// per key in a vector, NULL where there's no node.  Finding a node is an
+// index, not a hash, and iteration is in key order.  Just enough of
+// unordered_map's interface for DirectedGraph.
+template<typename TKey, typename TNode, typename TAlloc = std::allocator<TNode*> >
+class DenseNodeMap
+{
+public:
+	typedef std::pair<TKey, TNode*> value_type;
+	typedef TAlloc allocator_type;
+
+	explicit DenseNodeMap(const TAlloc &alloc = TAlloc()) : m_slots(alloc), m_nCount(0) { }
+
+	// Forward, over the filled slots.
+	class iterator
+	{
+	public:
+		typedef std::forward_iterator_tag	iterator_category;
+		typedef typename DenseNodeMap::value_type	value_type;
+		typedef ptrdiff_t			difference_type;
+		typedef const value_type	*pointer;
+		typedef const value_type	&reference;
+
+		iterator(TNode *const *pSlot, TNode *const *pBegin, TNode *const *pEnd)
+			: m_pSlot(pSlot), m_pBegin(pBegin), m_pEnd(pEnd)
+		{ SkipEmpty(); }
+
+		reference operator*() const { return m_current; }
+		pointer operator->() const { return &m_current; }
+
+		iterator &operator++() { ++m_pSlot; SkipEmpty(); return *this; }
+		iterator operator++(int) { iterator old(*this); ++*this; return old; }
+
+		bool operator==(const iterator &rhs) const { return m_pSlot == rhs.m_pSlot; }
+		bool operator!=(const iterator &rhs) const { return m_pSlot != rhs.m_pSlot; }
+
+	private:
+		void SkipEmpty()
+		{
+			while ((m_pSlot != m_pEnd) && (NULL == *m_pSlot))
+			{
+				++m_pSlot;
+			}
+			if (m_pSlot != m_pEnd)
+			{
+				m_current.first = (TKey)(m_pSlot - m_pBegin);
+				m_current.second = *m_pSlot;
+			}
+		}
+
+		TNode *const	*m_pSlot;
+		TNode *const	*m_pBegin;
+		TNode *const	*m_pEnd;
+		value_type		m_current;
+	};
+	typedef iterator const_iterator;
+
+	iterator begin() const { return iterator(m_slots.data(), m_slots.data(), m_slots.data() + m_slots.size()); }
+	iterator end() const { return iterator(m_slots.data() + m_slots.size(), m_slots.data(), m_slots.data() + m_slots.size()); }
+
+	size_t size() const { return m_nCount; }
+
+	size_t count(const TKey &key) const
+	{ return ((size_t)key < m_slots.size()) && (NULL != m_slots[(size_t)key]); }
+
+	iterator find(const TKey &key) const
+	{ return count(key) ? iterator(m_slots.data() + (size_t)key, m_slots.data(), m_slots.data() + m_slots.size()) : end(); }
+
+	void insert(const value_type &value)
+	{
+		ASSERT(value.second && !count(value.first));
+		if ((size_t)value.first >= m_slots.size())
+		{
+			m_slots.resize((size_t)value.first + 1, NULL);
+		}
+		m_slots[(size_t)value.first] = value.second;
+		m_nCount++;
+	}
+
+	void erase(const iterator &it)
+	{
+		ASSERT(count(it->first));
+		m_slots[(size_t)it->first] = NULL;
+		m_nCount--;
+	}
+
+	void reserve(size_t nCount) { m_slots.reserve(nCount); }
+
+private:
+	std::vector<TNode*, TAlloc>	m_slots;	// by key
+	size_t					m_nCount;	// slots filled
+};
+
+// _DenseKeys says TData is an index (see DenseNodeMap), and the nodes go
+// in a vector by key rather than a hash map.  DenseDirectedGraph below.
+// Nodes, their edge sets and the map all come from TAlloc rebound, so
+// CArenaStlAllocator puts the whole graph in an arena (see
+// ArenaDirectedGraph in ArenaContainers.h).
+template<typename TData,	// Node content
+		typename _Hasher = std::hash<TData>,	// hash function
+		typename _Keyeq = std::equal_to<TData>,	// equality tester
+		bool _DenseKeys = false,	// TData is a small index: no hashing
+		typename TAlloc = std::allocator<TData> >	// where nodes and edges live
+class DirectedGraph
+{
+public:
+
+	explicit DirectedGraph(const TAlloc &alloc = TAlloc()) // default the color/visit to the node default + 1
+		: m_mapDataToNodes(typename NodeMap::allocator_type(alloc)), m_alloc(alloc), m_nCurrColor(1), m_nCurrVisit(1) 
+	{ }
+
+	~DirectedGraph()
+	{
+		if (AllocatorFreesInBulk<TAlloc>::value && std::is_trivially_destructible<TData>::value)
+		{	// the edge sets only hold memory, and that all goes with the allocator's
+			return;
+		}
+
+		for (const typename NodeMap::value_type &entry : m_mapDataToNodes)
+		{	// we don't need smart pointers (for something this straight forward)
+			FreeNode(entry.second); 
+		}
+	}
+// Public types
+public:
+	struct Node;
+
+	// A node's edges.
+	typedef typename std::allocator_traits<TAlloc>::template rebind_alloc<Node*>	EdgeAlloc;
+	typedef std::unordered_set<Node*, std::hash<Node*>, std::equal_to<Node*>, EdgeAlloc>	EdgeSet;
+
+	// use vector of vectors because edges are sparse
+	// for the use of this graph in typical scenarios.
+	typedef struct Node
+	{
+		GraphEpoch		nColor;	// Color used for walking
+		GraphEpoch		nVisit; // visit is for the user, typically a 'processed' marker.
+		size_t			nWalk;	// a walk's own number for the node, good while nColor is current (GraphAlgorithms.h)
+		TData			data;	// user data
+		EdgeSet			setPointsTo;	// Who does this node point to?
+		EdgeSet			setPointsFrom;	// Who points to this node? (for backtracking like a parent pointer in a tree)
+
+		Node(const TData &srcData, const EdgeAlloc &alloc)
+			: nColor(0), nVisit(0), nWalk(0), data(srcData), setPointsTo(alloc), setPointsFrom(alloc) { }
+	} *PNODE;
+
+	// nodes. mapped from user data to nodes for easy user lookup
+	typedef typename std::conditional<_DenseKeys,
+								DenseNodeMap<TData, Node, typename std::allocator_traits<TAlloc>::template rebind_alloc<PNODE>>,
+								std::unordered_map<TData, PNODE, _Hasher, _Keyeq,
+									typename std::allocator_traits<TAlloc>::template rebind_alloc<std::pair<const TData, PNODE>>>>::type NodeMap;
+	typedef typename NodeMap::iterator iterator;
+	typedef typename NodeMap::const_iterator const_iterator;
+
+// Public Operations
+public:
+	// Add a node to the graph
+	void AddNode(const TData &data)
+	{
+		if (m_mapDataToNodes.count(data))
+		{
+			// should probably derive an exception class.
+			throw std::runtime_error("Trying to double add a node");
+		}
+
+		PNODE pNode = NewNode(data);
+		try
+		{
+			m_mapDataToNodes.insert(typename NodeMap::value_type(data, pNode));
+		}
+		catch (...)
+		{
+			FreeNode(pNode);
+			throw;
+		}
+	}
+
+	// Create a directed edge from a source -> dest
+	void Connect(const TData &source, const TData &dest)
+	{
+		PNODE pSrcNode;
+		PNODE pDestNode;
+
+		if (source == dest)
+		{	// this graph does not allow edges to self
+			return;
+		}
+
+		// find source node
+		typename NodeMap::iterator it = m_mapDataToNodes.find(source);
+		if (it == m_mapDataToNodes.end())
+		{
+			throw std::runtime_error("Attempt to connect to a missing source node");
+		}
+		pSrcNode = it->second;
+
+		// find destination
+		it = m_mapDataToNodes.find(dest);
+		if (it == m_mapDataToNodes.end())
+		{
+			throw std::runtime_error("Attempt to connect to a missing destination node");
+		}
+		pDestNode = it->second;
+
+		// set the link and the link back
+		pSrcNode->setPointsTo.insert(pDestNode);
+		pDestNode->setPointsFrom.insert(pSrcNode);
+	}
+
+	// This node stays in the graph, and still holds onto everything it
+	// connects to, but all edges connected to the source will be removed.
+	bool DisconnectNodesTo(const TData &source)
+	{
+		// Find the node
+		typename NodeMap::iterator it = m_mapDataToNodes.find(source);
+		if (it == m_mapDataToNodes.end())
+		{
+			throw std::runtime_error("Attempt to disconnect a missing node");
+		}
+
+		PNODE pNode = it->second;
+
+		// unlink everything that points to it
+		for (PNODE pPointsFrom : pNode->setPointsFrom)
+		{
+			pPointsFrom->setPointsTo.erase(pNode);
+		}
+		pNode->setPointsFrom.clear();
+
+		return true;
+	}
+
+	// find any nodes that match the current visited value and wipe them out.
+	size_t DeleteVisited()
+	{
+		typename NodeMap::iterator it = m_mapDataToNodes.begin();
+		size_t nDeleted = 0;
+		while (it != m_mapDataToNodes.end())
+		{
+			PNODE pNode = it->second;
+			if (GetVisited() ==  pNode->nVisit)
+			{
+				// Clean the edges
+				for (PNODE pPointsFrom : pNode->setPointsFrom)
+				{
+					pPointsFrom->setPointsTo.erase(pNode);
+				}
+
+				for (PNODE pPointsTo : pNode->setPointsTo)
+				{
+					pPointsTo->setPointsFrom.erase(pNode);
+				}
+
+				// Do the delete
+				FreeNode(it->second);
+				typename NodeMap::iterator tmp(it);
+				it++;
+				m_mapDataToNodes.erase(tmp);
+				nDeleted++;
+			}
+			else
+			{
+				it++;
+			}
+		}
+		return nDeleted;
+	}
+
+	// number of nodes
+	size_t Size() const
+	{ return m_mapDataToNodes.size(); }
+
+	// current color
+	GraphEpoch GetColor() const 
+	{ return m_nCurrColor; }
+
+	// current 'visit' value
+	GraphEpoch GetVisited() const
+	{ return m_nCurrVisit; }
+
+	// iterator wrapper
+	iterator begin() { return m_mapDataToNodes.begin(); }
+	iterator end() { return m_mapDataToNodes.end(); }
+	const_iterator begin() const { return m_mapDataToNodes.begin(); }
+	const_iterator end() const { return m_mapDataToNodes.end(); }
+
+	void NewColor()
+	{ m_nCurrColor++; }
+
+	void NewVisited()
+	{ m_nCurrVisit++; }
+
+	// Private Methods
+private:
+	typedef typename std::allocator_traits<TAlloc>::template rebind_alloc<Node>	NodeAlloc;
+	typedef std::allocator_traits<NodeAlloc>										NodeAllocTraits;
+
+	PNODE NewNode(const TData &data)
+	{
+		PNODE pNode = NodeAllocTraits::allocate(m_alloc, 1);
+		try
+		{
+			return new (pNode) Node(data, EdgeAlloc(m_alloc));
+		}
+		catch (...)
+		{
+			NodeAllocTraits::deallocate(m_alloc, pNode, 1);
+			throw;
+		}
+	}
+
+	void FreeNode(PNODE pNode)
+	{
+		pNode->~Node();
+		NodeAllocTraits::deallocate(m_alloc, pNode, 1);
+	}
+
+	// Private Member Data
+private:
+
+	NodeMap				m_mapDataToNodes;	// actual nodes
+	NodeAlloc			m_alloc;
+	GraphEpoch			m_nCurrColor; // active color id
+	GraphEpoch			m_nCurrVisit; // active visit id
+
+};
+
+// For keys that are indexes: 0..n-1, as a vector's.  Iterates in key order.
+template<typename TIndex>
+using DenseDirectedGraph = DirectedGraph<TIndex, std::hash<TIndex>, std::equal_to<TIndex>, true>;
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <vector>
+
+#include "Random.h"
+
+// Weighted random selection over a flat array: the same selection surface
+// as Tree, for when the items' order doesn't matter and the set of items
+// rarely changes.
+//
+// The items sit in one vector in the order added, and their running weights
+// in a Fenwick (binary indexed) tree: a second vector where m_sums[i] holds
+// the total weight of items (i - lowbit(i), i], counting from 1.  A
+// selection is lg(n) reads from that one array instead of a walk through
+// heap nodes, nothing is allocated per item, and Build() makes the whole
+// thing in O(n) where n Tree::Add calls take O(n lg n).
+//
+// Differences from Tree:
+// - Items are never ordered or merged, there's no lookup by key.  Add()
+//   returns the item's index, which is what UpdateWeight() takes.
+// - No Remove.  UpdateWeight(nIndex, 0) takes an item out of the running.
+//
+// Bits having to do with the 'random' stuff are commented //RND
+
+template <typename TData, typename TRandom = CXoshiro256>
+class FenwickTree
+{
+// public types
+	typedef void (TData::* TraverseCallBack)(void);
+
+// Interface
+public:
+	FenwickTree(void);
+
+	// Replace everything with [first, last).  O(n).
+	template<typename TIt>
+	void Build(TIt first, TIt last);
+
+	// return the new item's index.  O(lg n).
+	size_t Add(const TData &data);
+
+	size_t Count() const { return m_items.size(); }
+
+	TData &operator[](size_t nIndex) { return m_items[nIndex]; }
+	const TData &operator[](size_t nIndex) const { return m_items[nIndex]; }
+
+	//RND Change the selection weight of the item at nIndex.  Lasts until
+	// ResetWeights() goes back to data.Weight().
+	void UpdateWeight(size_t nIndex, size_t nWeight);
+
+	// In the order added.
+	void TraverseInOrder(TraverseCallBack callback) const;
+
+	//RND Select a random item, by weighted preference.
+	bool SelectRandom(TraverseCallBack callback, bool bAllowRepeat = false) const
+	{ return SelectRandom(m_random, callback, bAllowRepeat); }
+
+	//RND Same, drawing from the caller's generator.  With bAllowRepeat
+	// nothing changes, so threads with a generator each can select at once.
+	template<typename TRng>
+	bool SelectRandom(TRng &random, TraverseCallBack callback, bool bAllowRepeat = false) const;
+
+	//RND Restart the container's own generator.
+	void Seed(unsigned __int64 nSeed) { m_random = TRandom(nSeed); }
+
+	//RND visit each item exactly once in the weighted random order.
+	void TraverseRandom(TraverseCallBack callback) const;
+
+	//RND set all the weights back to original values.  O(n).
+	void ResetWeights();
+
+	// Check every partial sum against the weights it covers.
+	void AssertValid() const;
+
+// Internal Methods
+private:
+	static size_t LowBit(size_t n) { return n & (0 - n); }
+
+	//RND Index of the item whose slice of [0, m_nTotalWeight) holds nRandom.
+	size_t FindWeighted(unsigned __int64 nRandom) const;
+
+	//RND Add nDelta (two's complement for a decrease) to every sum covering nIndex.
+	void AddToSums(size_t nIndex, unsigned __int64 nDelta) const;
+
+	// m_sums from m_weights, in O(n).
+	void BuildSums();
+
+// Data
+private:
+	// mutable since selection calls back into items (and zeroes weights)
+	// through const methods, as Tree's do.
+	mutable std::vector<TData>				m_items;
+	mutable std::vector<size_t>				m_weights;
+
+	// 1 based: m_sums[0] is always 0 and m_sums[i] belongs to m_items[i - 1].
+	mutable std::vector<unsigned __int64>	m_sums;
+	mutable unsigned __int64				m_nTotalWeight;
+
+	// Largest power of 2 <= Count(), the first stride of FindWeighted.
+	size_t						m_nTopStep;
+
+	mutable TRandom				m_random;
+};
+
+template<typename TData, typename TRandom>
+FenwickTree<TData, TRandom>::FenwickTree(void) : m_sums(1, 0), m_nTotalWeight(0), m_nTopStep(0)
+{
+}
+
+// The usual O(n) construction: put each weight in its own slot, then fold
+// every slot into the one slot above it that covers it.  Each item is
+// touched twice, in order.
+template<typename TData, typename TRandom>
+template<typename TIt>
+void FenwickTree<TData, TRandom>::Build(TIt first, TIt last)
+{
+	m_items.assign(first, last);
+	ResetWeights();
+}
+
+template<typename TData, typename TRandom>
+void FenwickTree<TData, TRandom>::BuildSums()
+{
+	size_t nCount = m_weights.size();
+
+	m_sums.resize(nCount + 1);
+	m_sums[0] = 0;
+	m_nTotalWeight = 0;
+	for (size_t i = 0; i < nCount; i++)
+	{
+		m_sums[i + 1] = m_weights[i];
+		m_nTotalWeight += m_weights[i];
+	}
+
+	for (size_t i = 1; i <= nCount; i++)
+	{
+		size_t nParent = i + LowBit(i);
+		if (nParent <= nCount)
+		{
+			m_sums[nParent] += m_sums[i];
+		}
+	}
+
+	m_nTopStep = 0;
+	if (nCount)
+	{
+		m_nTopStep = 1;
+		while (m_nTopStep <= nCount / 2)
+		{
+			m_nTopStep *= 2;
+		}
+	}
+
+	AssertValid();
+}
+
+// The new slot i covers (i - lowbit(i), i]: its own weight plus the slots
+// that tile the rest of that range, which already exist.
+template<typename TData, typename TRandom>
+size_t FenwickTree<TData, TRandom>::Add(const TData &data)
+{
+	size_t nIndex = m_items.size();
+	size_t nWeight = data.Weight();
+
+	m_items.push_back(data);
+	m_weights.push_back(nWeight);
+
+	size_t i = nIndex + 1;
+	unsigned __int64 nSum = nWeight;
+	for (size_t j = i - 1; j > i - LowBit(i); j -= LowBit(j))
+	{
+		nSum += m_sums[j];
+	}
+	m_sums.push_back(nSum);
+	m_nTotalWeight += nWeight;
+
+	if (m_nTopStep * 2 <= i)
+	{
+		m_nTopStep = m_nTopStep ? m_nTopStep * 2 : 1;
+	}
+
+	return nIndex;
+}
+
+template<typename TData, typename TRandom>
+void FenwickTree<TData, TRandom>::AddToSums(size_t nIndex, unsigned __int64 nDelta) const
+{
+	for (size_t i = nIndex + 1; i < m_sums.size(); i += LowBit(i))
+	{
+		m_sums[i] += nDelta;
+	}
+	m_nTotalWeight += nDelta;
+}
+
+//RND
+template<typename TData, typename TRandom>
+void FenwickTree<TData, TRandom>::UpdateWeight(size_t nIndex, size_t nWeight)
+{
+	ASSERT(nIndex < m_items.size());
+
+	AddToSums(nIndex, (unsigned __int64)nWeight - m_weights[nIndex]);
+	m_weights[nIndex] = nWeight;
+}
+
+//RND set all the weights back to original values
+template<typename TData, typename TRandom>
+void FenwickTree<TData, TRandom>::ResetWeights()
+{
+	m_weights.resize(m_items.size());
+	for (size_t i = 0; i < m_items.size(); i++)
+	{
+		m_weights[i] = m_items[i].Weight();
+	}
+
+	BuildSums();
+}
+
+//RND Select a random item, by weighted preference.
+template<typename TData, typename TRandom>
+template<typename TRng>
+bool FenwickTree<TData, TRandom>::SelectRandom(TRng &random, TraverseCallBack callback, bool bAllowRepeat) const
+{
+	if (m_nTotalWeight == 0)
+	{
+		return false;
+	}
+
+	size_t nIndex = FindWeighted(RandomBelow(random, m_nTotalWeight));
+
+	if (!bAllowRepeat)
+	{
+		AddToSums(nIndex, 0 - (unsigned __int64)m_weights[nIndex]);
+		m_weights[nIndex] = 0;
+	}
+
+	(m_items[nIndex].*callback)();
+
+	return true;
+}
+
+//RND: Binary search on the running total without ever forming it.  Each
+// stride halves, and m_sums[nPos + nStep] is exactly the weight between
+// nPos and nPos + nStep, so stepping over it is one compare and subtract.
+// Ends on the last prefix whose total is <= nRandom; the item after it
+// holds nRandom, and can't have weight 0 or the walk would have passed it.
+template<typename TData, typename TRandom>
+size_t FenwickTree<TData, TRandom>::FindWeighted(unsigned __int64 nRandom) const
+{
+	ASSERT(nRandom < m_nTotalWeight);
+
+	const unsigned __int64 *pSums = &m_sums[0];
+	size_t nCount = m_items.size();
+	size_t nPos = 0;
+
+	for (size_t nStep = m_nTopStep; nStep; nStep >>= 1)
+	{
+		size_t nNext = nPos + nStep;
+		if (nNext <= nCount && pSums[nNext] <= nRandom)
+		{
+			nPos = nNext;
+			nRandom -= pSums[nNext];
+		}
+	}
+
+	ASSERT(nPos < nCount);
+	ASSERT(m_weights[nPos] > nRandom);
+	return nPos;
+}
+
+//RND visit each item exactly once in the weighted random order.
+template<typename TData, typename TRandom>
+void FenwickTree<TData, TRandom>::TraverseRandom(TraverseCallBack callback) const
+{
+	while (SelectRandom(callback, false))
+		;
+}
+
+template<typename TData, typename TRandom>
+void FenwickTree<TData, TRandom>::TraverseInOrder(TraverseCallBack callback) const
+{
+	for (size_t i = 0; i < m_items.size(); i++)
+	{
+		(m_items[i].*callback)();
+	}
+}
+
+template<typename TData, typename TRandom>
+void FenwickTree<TData, TRandom>::AssertValid() const
+{
+#ifndef _DEBUG
+	return;
+#else
+	size_t nCount = m_items.size();
+
+	ASSERT(m_weights.size() == nCount);
+	ASSERT(m_sums.size() == nCount + 1);
+	ASSERT(m_sums[0] == 0);
+	ASSERT((nCount == 0) ? (m_nTopStep == 0) : (m_nTopStep <= nCount && m_nTopStep * 2 > nCount));
+
+	unsigned __int64 nTotal = 0;
+	for (size_t i = 1; i <= nCount; i++)
+	{
+		unsigned __int64 nSum = 0;
+		for (size_t j = i - LowBit(i); j < i; j++)
+		{
+			nSum += m_weights[j];
+		}
+		ASSERT(m_sums[i] == nSum);
+		nTotal += m_weights[i - 1];
+	}
+	ASSERT(m_nTotalWeight == nTotal);
+
+#endif
+}
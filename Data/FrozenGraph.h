@@ -0,0 +1,346 @@
+#pragma once
+
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "DirectedGraph.h"
+
+// A DirectedGraph frozen into flat arrays, for passes that read a graph
+// far more than they change it.
+//
+// Nodes are numbered 0..Size()-1 and everything about a node is indexed by
+// that number.  The edges are in compressed sparse row form: every node's
+// targets sit together in one array, m_pointsTo[m_toStart[id] ..
+// m_toStart[id + 1]), and a second pair of arrays holds the same edges
+// reversed for walking back.  A walk is a run through contiguous ids with
+// no hashing and no pointer chasing, and an edge costs 8 bytes (one id
+// each way) where a DirectedGraph's pair of hash set entries costs
+// hundreds.
+//
+// The shape is fixed once built.  The one change allowed is DeleteVisited,
+// which marks nodes deleted (a tombstone bit each) rather than moving
+// anything: deleted nodes drop out of Size() and of every node's edges.
+// Compact() then squeezes them out of the arrays in one pass.
+template<typename TData,	// Node content
+		typename _Hasher = std::hash<TData>,	// hash function
+		typename _Keyeq = std::equal_to<TData>>	// equality tester
+class FrozenGraph
+{
+public:
+	typedef unsigned int NodeId;
+
+	FrozenGraph()
+		: m_nLive(0), m_nCurrColor(1), m_nCurrVisit(1)
+	{ }
+
+	// Freeze graph's current state, colours and visits included.
+	template<bool _DenseKeys, typename TGraphAlloc>
+	explicit FrozenGraph(const DirectedGraph<TData, _Hasher, _Keyeq, _DenseKeys, TGraphAlloc> &graph)
+		: m_nLive(0), m_nCurrColor(1), m_nCurrVisit(1)
+	{
+		Build(graph);
+	}
+
+// Public types
+public:
+	// A node's targets (or sources), skipping deleted ones.
+	class EdgeIterator
+	{
+	public:
+		typedef std::forward_iterator_tag	iterator_category;
+		typedef NodeId			value_type;
+		typedef ptrdiff_t		difference_type;
+		typedef const NodeId	*pointer;
+		typedef const NodeId	&reference;
+
+		EdgeIterator(const NodeId *pEdge, const NodeId *pEnd, const std::vector<bool> *pDeleted)
+			: m_pEdge(pEdge), m_pEnd(pEnd), m_pDeleted(pDeleted)
+		{ SkipDeleted(); }
+
+		reference operator*() const { return *m_pEdge; }
+		EdgeIterator &operator++() { ++m_pEdge; SkipDeleted(); return *this; }
+		EdgeIterator operator++(int) { EdgeIterator old(*this); ++*this; return old; }
+
+		bool operator==(const EdgeIterator &rhs) const { return m_pEdge == rhs.m_pEdge; }
+		bool operator!=(const EdgeIterator &rhs) const { return m_pEdge != rhs.m_pEdge; }
+
+	private:
+		void SkipDeleted()
+		{
+			while ((m_pEdge != m_pEnd) && (*m_pDeleted)[*m_pEdge])
+			{
+				++m_pEdge;
+			}
+		}
+
+		const NodeId			*m_pEdge;
+		const NodeId			*m_pEnd;
+		const std::vector<bool>	*m_pDeleted;
+	};
+
+	// for (NodeId id : graph.PointsTo(n))
+	class EdgeRange
+	{
+	public:
+		EdgeRange(const NodeId *pBegin, const NodeId *pEnd, const std::vector<bool> *pDeleted)
+			: m_begin(pBegin, pEnd, pDeleted), m_end(pEnd, pEnd, pDeleted)
+		{ }
+
+		EdgeIterator begin() const { return m_begin; }
+		EdgeIterator end() const { return m_end; }
+
+	private:
+		EdgeIterator	m_begin;
+		EdgeIterator	m_end;
+	};
+
+// Public Operations
+public:
+	// Replace everything with graph's nodes and edges.  Ids follow graph's
+	// iteration order.  O(V + E).
+	template<bool _DenseKeys, typename TGraphAlloc>
+	void Build(const DirectedGraph<TData, _Hasher, _Keyeq, _DenseKeys, TGraphAlloc> &graph)
+	{
+		typedef typename DirectedGraph<TData, _Hasher, _Keyeq, _DenseKeys, TGraphAlloc>::const_iterator GraphIterator;
+
+		size_t nNodes = graph.Size();
+		if (nNodes > (NodeId)~0u)
+		{
+			throw std::runtime_error("Too many nodes to freeze");
+		}
+
+		m_data.clear();
+		m_mapDataToId.clear();
+		m_data.reserve(nNodes);
+		m_mapDataToId.reserve(nNodes);
+		m_colors.resize(nNodes);
+		m_visits.resize(nNodes);
+		m_toStart.assign(nNodes + 1, 0);
+
+		// Number the nodes, and count each one's edges.
+		size_t nEdges = 0;
+		for (GraphIterator it = graph.begin(); it != graph.end(); ++it)
+		{
+			NodeId id = (NodeId)m_data.size();
+			m_mapDataToId[it->first] = id;
+			m_data.push_back(it->first);
+			m_colors[id] = it->second->nColor;
+			m_visits[id] = it->second->nVisit;
+			nEdges += it->second->setPointsTo.size();
+			m_toStart[id + 1] = nEdges;
+		}
+
+		// Then the edges, each node's in a run.
+		m_pointsTo.resize(nEdges);
+		size_t nEdge = 0;
+		for (GraphIterator it = graph.begin(); it != graph.end(); ++it)
+		{
+			for (auto pDest : it->second->setPointsTo)
+			{
+				m_pointsTo[nEdge++] = m_mapDataToId[pDest->data];
+			}
+		}
+		ASSERT(nEdge == nEdges);
+
+		BuildReverse();
+
+		m_deleted.assign(nNodes, false);
+		m_nLive = nNodes;
+		m_nCurrColor = graph.GetColor();
+		m_nCurrVisit = graph.GetVisited();
+	}
+
+	// id of the node holding data
+	NodeId Find(const TData &data) const
+	{
+		typename IdMap::const_iterator it = m_mapDataToId.find(data);
+		if ((it == m_mapDataToId.end()) || m_deleted[it->second])
+		{
+			throw std::runtime_error("Attempt to find a missing node");
+		}
+		return it->second;
+	}
+
+	const TData &Data(NodeId id) const
+	{ return m_data[id]; }
+
+	// Who does this node point to?
+	EdgeRange PointsTo(NodeId id) const
+	{ return EdgeRange(m_pointsTo.data() + m_toStart[id], m_pointsTo.data() + m_toStart[id + 1], &m_deleted); }
+
+	// Who points to this node?
+	EdgeRange PointsFrom(NodeId id) const
+	{ return EdgeRange(m_pointsFrom.data() + m_fromStart[id], m_pointsFrom.data() + m_fromStart[id + 1], &m_deleted); }
+
+	// Color used for walking, and the visit marker for the user, per node.
+	GraphEpoch &Color(NodeId id) { return m_colors[id]; }
+	GraphEpoch &Visit(NodeId id) { return m_visits[id]; }
+	GraphEpoch Color(NodeId id) const { return m_colors[id]; }
+	GraphEpoch Visit(NodeId id) const { return m_visits[id]; }
+
+	bool IsDeleted(NodeId id) const
+	{ return m_deleted[id]; }
+
+	// Tombstone any nodes that match the current visited value.  Their ids
+	// stay taken, and their edges stay in the arrays but are skipped.
+	size_t DeleteVisited()
+	{
+		size_t nDeleted = 0;
+		for (size_t id = 0; id < m_visits.size(); id++)
+		{
+			if (!m_deleted[id] && (GetVisited() == m_visits[id]))
+			{
+				m_deleted[id] = true;
+				nDeleted++;
+			}
+		}
+		m_nLive -= nDeleted;
+		return nDeleted;
+	}
+
+	// Squeeze the deleted nodes, and every edge to or from one, out of the
+	// arrays, so walks stop stepping over them.  The nodes left keep their
+	// order, but ids close up over the holes: ids from before don't hold.
+	// One pass over the nodes and forward edges, then the reverse edges
+	// are rebuilt.  O(V + E).  return the number of nodes squeezed out.
+	size_t Compact()
+	{
+		size_t nNodes = m_data.size();
+
+		std::vector<NodeId> newIds(nNodes);
+		NodeId nLive = 0;
+		for (size_t id = 0; id < nNodes; id++)
+		{
+			newIds[id] = nLive;
+			if (!m_deleted[id])
+			{
+				nLive++;
+			}
+		}
+
+		// Everything moves down (or stays), so it's all done in place: a
+		// node's slot and its edges are read before anything lands on them.
+		size_t nEdges = 0;
+		for (size_t id = 0; id < nNodes; id++)
+		{
+			size_t nStart = m_toStart[id];
+			size_t nEnd = m_toStart[id + 1];
+			if (m_deleted[id])
+			{
+				continue;
+			}
+
+			NodeId newId = newIds[id];
+			m_toStart[newId] = nEdges;
+			for (size_t i = nStart; i < nEnd; i++)
+			{
+				if (!m_deleted[m_pointsTo[i]])
+				{
+					m_pointsTo[nEdges++] = newIds[m_pointsTo[i]];
+				}
+			}
+
+			if (newId != id)
+			{
+				m_data[newId] = m_data[id];
+				m_colors[newId] = m_colors[id];
+				m_visits[newId] = m_visits[id];
+			}
+		}
+		m_toStart[nLive] = nEdges;
+
+		m_toStart.resize(nLive + 1);
+		m_pointsTo.resize(nEdges);
+		m_data.resize(nLive);
+		m_colors.resize(nLive);
+		m_visits.resize(nLive);
+		m_deleted.assign(nLive, false);
+		m_nLive = nLive;
+
+		BuildReverse();
+
+		m_mapDataToId.clear();
+		for (NodeId id = 0; id < nLive; id++)
+		{
+			m_mapDataToId[m_data[id]] = id;
+		}
+
+		return nNodes - nLive;
+	}
+
+	// number of nodes not deleted
+	size_t Size() const
+	{ return m_nLive; }
+
+	// one past the largest id, deleted nodes included
+	size_t IdLimit() const
+	{ return m_data.size(); }
+
+	// current color
+	GraphEpoch GetColor() const
+	{ return m_nCurrColor; }
+
+	// current 'visit' value
+	GraphEpoch GetVisited() const
+	{ return m_nCurrVisit; }
+
+	void NewColor()
+	{ m_nCurrColor++; }
+
+	void NewVisited()
+	{ m_nCurrVisit++; }
+
+// Private Methods
+private:
+	// The reversed edges from the forward ones: count each node's sources,
+	// turn the counts into starts, then drop every edge into its slot.
+	// Sources come out in id order.
+	void BuildReverse()
+	{
+		size_t nNodes = m_data.size();
+
+		m_fromStart.assign(nNodes + 1, 0);
+		for (size_t i = 0; i < m_pointsTo.size(); i++)
+		{
+			m_fromStart[m_pointsTo[i] + 1]++;
+		}
+		for (size_t id = 0; id < nNodes; id++)
+		{
+			m_fromStart[id + 1] += m_fromStart[id];
+		}
+
+		std::vector<size_t> next(m_fromStart.begin(), m_fromStart.end() - 1);
+		m_pointsFrom.resize(m_pointsTo.size());
+		for (size_t id = 0; id < nNodes; id++)
+		{
+			for (size_t i = m_toStart[id]; i < m_toStart[id + 1]; i++)
+			{
+				m_pointsFrom[next[m_pointsTo[i]]++] = (NodeId)id;
+			}
+		}
+	}
+
+// Private Member Data
+private:
+	typedef std::unordered_map<TData, NodeId, _Hasher, _Keyeq> IdMap;
+
+	std::vector<TData>			m_data;			// by id
+	IdMap						m_mapDataToId;	// for user lookup
+
+	// Edges out of id are m_pointsTo[m_toStart[id] .. m_toStart[id + 1]),
+	// edges into it likewise in m_pointsFrom.
+	std::vector<size_t>			m_toStart;
+	std::vector<NodeId>			m_pointsTo;
+	std::vector<size_t>			m_fromStart;
+	std::vector<NodeId>			m_pointsFrom;
+
+	std::vector<GraphEpoch>		m_colors;		// by id
+	std::vector<GraphEpoch>		m_visits;		// by id
+	std::vector<bool>			m_deleted;		// by id, the tombstones
+	size_t						m_nLive;
+
+	GraphEpoch					m_nCurrColor;	// active color id
+	GraphEpoch					m_nCurrVisit;	// active visit id
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "DirectedGraph.h"
+
+// Whole graph algorithms for DirectedGraph: strongly connected components,
+// topological order and the condensation.  Each is one linear pass,
+// O(V + E), and keeps its own stack rather than recursing, so a long chain
+// of nodes can't run the call stack out.
+//
+// They walk the way the graph's users do: a NewColor() to tell the nodes
+// reached from those not, and nWalk on each node for what the algorithm
+// needs to keep there.  No hashing along the way.  Visits, and the shape
+// of the graph, are left alone.
+
+// The strongly connected components of the graph, by Tarjan's algorithm
+// in Pearce's form, which keeps everything it needs per node in the one
+// number.  A component is nodes that can all reach each other: a node on
+// no cycle is a component by itself, anything bigger is a cycle (or
+// several tangled together).
+//
+// Components are numbered in the order they're finished, which is sinks
+// first: every edge from one component to another goes from the higher
+// number to the lower.  So going through them 0, 1, 2 ... reaches each one
+// after everything it points to, reverse topological order.  pComponents
+// gets each component's nodes (reusing what it held), and every node's
+// nWalk is left as its component's number.  return the number of
+// components.
+template<typename TGraph>
+size_t StronglyConnectedComponents(TGraph *pGraph, vector<vector<typename TGraph::PNODE>> *pComponents)
+{
+	typedef typename TGraph::PNODE PNODE;
+	typedef typename TGraph::EdgeSet::const_iterator EdgeIterator;
+
+	// A node part way through the depth first walk, the next of its edges
+	// to follow, and whether it still looks like the first node of a
+	// component (nothing under it reaches back above it).
+	struct Frame
+	{
+		PNODE			pNode;
+		EdgeIterator	itEdge;
+		bool			bRoot;
+	};
+
+	// While a node is open its nWalk is its number in the order the walk
+	// reached it, lowered to the smallest open number it can reach.  Once
+	// its component is found, nWalk is the component's number counting
+	// down from nLast, always above every open number: min() then passes
+	// over finished nodes without having to ask.
+	vector<PNODE> stack;		// finished walking, no component yet
+	vector<Frame> walk;			// the depth first walk's
+
+	const size_t nLast = pGraph->Size() - 1;
+	size_t nIndex = 0;			// next open number
+	size_t nComponent = nLast;	// next component, counting down
+	size_t nComponents = 0;
+
+	pGraph->NewColor();
+	const GraphEpoch nColor = pGraph->GetColor();
+
+	for (typename TGraph::iterator it = pGraph->begin(); it != pGraph->end(); ++it)
+	{
+		if (it->second->nColor == nColor)
+		{
+			continue;
+		}
+
+		PNODE pNext = it->second;
+		for (;;)
+		{
+			if (pNext)
+			{	// first time here: number it and go in.
+				pNext->nColor = nColor;
+				pNext->nWalk = nIndex++;
+				Frame frame = { pNext, pNext->setPointsTo.begin(), true };
+				walk.push_back(frame);
+				pNext = NULL;
+			}
+
+			Frame &frame = walk.back();
+			if (frame.itEdge != frame.pNode->setPointsTo.end())
+			{
+				PNODE pDest = *frame.itEdge;
+				++frame.itEdge;
+
+				if (pDest->nColor != nColor)
+				{
+					pNext = pDest;
+				}
+				else if (pDest->nWalk < frame.pNode->nWalk)
+				{
+					frame.pNode->nWalk = pDest->nWalk;
+					frame.bRoot = false;
+				}
+				continue;
+			}
+
+			// Done with all its edges.
+			PNODE pNode = frame.pNode;
+			if (frame.bRoot)
+			{	// It and everything stacked after it are a component.
+				if (pComponents->size() <= nComponents)
+				{
+					pComponents->push_back(vector<PNODE>());
+				}
+				vector<PNODE> &component = (*pComponents)[nComponents++];
+				component.clear();
+
+				nIndex--;
+				while (!stack.empty() && (pNode->nWalk <= stack.back()->nWalk))
+				{
+					stack.back()->nWalk = nComponent;
+					component.push_back(stack.back());
+					stack.pop_back();
+					nIndex--;
+				}
+				pNode->nWalk = nComponent--;
+				component.push_back(pNode);
+			}
+			else
+			{
+				stack.push_back(pNode);
+			}
+
+			// Back out to the node that led here.
+			walk.pop_back();
+			if (walk.empty())
+			{
+				break;
+			}
+			Frame &parent = walk.back();
+			if (pNode->nWalk < parent.pNode->nWalk)
+			{
+				parent.pNode->nWalk = pNode->nWalk;
+				parent.bRoot = false;
+			}
+		}
+	}
+	ASSERT(stack.empty() && (nIndex == 0));
+
+	// Renumber from the bottom, the order they were found.
+	pComponents->resize(nComponents);
+	for (size_t i = 0; i < nComponents; i++)
+	{
+		for (PNODE pNode : (*pComponents)[i])
+		{
+			ASSERT(pNode->nWalk == nLast - i);
+			pNode->nWalk = i;
+		}
+	}
+	return nComponents;
+}
+
+// The nodes in topological order: every node comes before all the nodes it
+// points to.  Kahn's algorithm: take the nodes nothing points to, then the
+// nodes only they point to, and so on.  return false, with pOrder empty,
+// if the graph has a cycle and so no such order.
+template<typename TGraph>
+bool TopologicalOrder(TGraph *pGraph, vector<typename TGraph::PNODE> *pOrder)
+{
+	typedef typename TGraph::PNODE PNODE;
+
+	pOrder->clear();
+	pOrder->reserve(pGraph->Size());
+	for (typename TGraph::iterator it = pGraph->begin(); it != pGraph->end(); ++it)
+	{
+		if (it->second->setPointsFrom.empty())
+		{
+			pOrder->push_back(it->second);
+		}
+	}
+
+	// A coloured node's nWalk is how many edges into it are still to be
+	// taken.  pOrder is its own queue: everything past nNext is ready.
+	pGraph->NewColor();
+	const GraphEpoch nColor = pGraph->GetColor();
+	for (size_t nNext = 0; nNext < pOrder->size(); nNext++)
+	{
+		for (PNODE pDest : (*pOrder)[nNext]->setPointsTo)
+		{
+			if (pDest->nColor != nColor)
+			{
+				pDest->nColor = nColor;
+				pDest->nWalk = pDest->setPointsFrom.size();
+			}
+			if (0 == --pDest->nWalk)
+			{
+				pOrder->push_back(pDest);
+			}
+		}
+	}
+
+	if (pOrder->size() != pGraph->Size())
+	{	// what's left is on or behind a cycle
+		pOrder->clear();
+		return false;
+	}
+	return true;
+}
+
+// The condensation of the graph: every strongly connected component shrunk
+// to a single node, which leaves a graph with no cycles.  pComponents and
+// the nodes' nWalk are filled as StronglyConnectedComponents does, and
+// pDag, which must be empty, gets a node per component, keyed by its
+// number, with an edge wherever some edge goes from one component to
+// another.
+template<typename TGraph>
+void Condense(TGraph *pGraph,
+				vector<vector<typename TGraph::PNODE>> *pComponents,
+				DenseDirectedGraph<size_t> *pDag)
+{
+	typedef typename TGraph::PNODE PNODE;
+
+	ASSERT(pDag->Size() == 0);
+
+	size_t nComponents = StronglyConnectedComponents(pGraph, pComponents);
+	for (size_t nComponent = 0; nComponent < nComponents; nComponent++)
+	{
+		pDag->AddNode(nComponent);
+	}
+
+	// Edges inside a component come out as edges to self, which Connect
+	// drops, and the parallel ones collapse in its sets.
+	for (size_t nComponent = 0; nComponent < nComponents; nComponent++)
+	{
+		for (PNODE pNode : (*pComponents)[nComponent])
+		{
+			for (PNODE pDest : pNode->setPointsTo)
+			{
+				pDag->Connect(nComponent, pDest->nWalk);
+			}
+		}
+	}
+}
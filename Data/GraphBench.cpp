@@ -0,0 +1,263 @@
+// GraphBench.cpp : DirectedGraph vs FrozenGraph, the hash set graph and its
+// flat array freeze.
+//
+// Builds a random graph (kDegree edges out of each node on average) with
+// AddNode/Connect, hashed and as a DenseDirectedGraph, freezes it, then
+// times the same read passes on both: every edge forward, every edge
+// backward, and a colouring depth first walk from every node.  Then
+// DeleteVisited on half the nodes.
+//
+// Usage: GraphBench [node count]   default 100,000.
+
+#include "stdafx.h"
+
+#include <chrono>
+
+#include "FrozenGraph.h"
+
+static const size_t kDegree = 8;
+
+static size_t s_nSum = 0;	// so the passes aren't optimized away
+
+typedef DirectedGraph<unsigned int> Graph;
+typedef FrozenGraph<unsigned int> Frozen;
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed;
+}
+
+class CStopwatch
+{
+public:
+	CStopwatch() : m_start(chrono::steady_clock::now()) { }
+	double Seconds() const { return chrono::duration<double>(chrono::steady_clock::now() - m_start).count(); }
+
+private:
+	chrono::steady_clock::time_point	m_start;
+};
+
+static void Report(const char *pName, size_t nOps, double dGraph, double dFrozen)
+{
+	printf("%-24s %12u %12.2f %12.2f %8.2fx\n", pName, (unsigned int)nOps,
+		nOps / dGraph / 1e6, nOps / dFrozen / 1e6, dGraph / dFrozen);
+}
+
+// Depth first from every node not yet coloured; return nodes reached.
+static size_t ColourAll(Graph *pGraph)
+{
+	pGraph->NewColor();
+	size_t nReached = 0;
+	vector<Graph::PNODE> stack;
+	for (Graph::iterator it = pGraph->begin(); it != pGraph->end(); ++it)
+	{
+		if (it->second->nColor == pGraph->GetColor())
+		{
+			continue;
+		}
+		it->second->nColor = pGraph->GetColor();
+		stack.push_back(it->second);
+		while (!stack.empty())
+		{
+			Graph::PNODE pNode = stack.back();
+			stack.pop_back();
+			nReached++;
+			for (auto pDest : pNode->setPointsTo)
+			{
+				if (pDest->nColor != pGraph->GetColor())
+				{
+					pDest->nColor = pGraph->GetColor();
+					stack.push_back(pDest);
+				}
+			}
+		}
+	}
+	return nReached;
+}
+
+static size_t ColourAll(Frozen *pGraph)
+{
+	pGraph->NewColor();
+	size_t nReached = 0;
+	vector<Frozen::NodeId> stack;
+	for (Frozen::NodeId id = 0; id < pGraph->IdLimit(); id++)
+	{
+		if (pGraph->IsDeleted(id) || (pGraph->Color(id) == pGraph->GetColor()))
+		{
+			continue;
+		}
+		pGraph->Color(id) = pGraph->GetColor();
+		stack.push_back(id);
+		while (!stack.empty())
+		{
+			Frozen::NodeId node = stack.back();
+			stack.pop_back();
+			nReached++;
+			for (Frozen::NodeId dest : pGraph->PointsTo(node))
+			{
+				if (pGraph->Color(dest) != pGraph->GetColor())
+				{
+					pGraph->Color(dest) = pGraph->GetColor();
+					stack.push_back(dest);
+				}
+			}
+		}
+	}
+	return nReached;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	size_t nNodes = (argc > 1) ? (size_t)atol(argv[1]) : 100000;
+	size_t nEdges = 0;
+
+	Graph graph;
+	{
+		CStopwatch watch;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			graph.AddNode((unsigned int)i);
+		}
+		unsigned int nSeed = 1;
+		for (size_t i = 0; i < nNodes * kDegree; i++)
+		{
+			graph.Connect(NextRandom(&nSeed) % nNodes, NextRandom(&nSeed) % nNodes);
+		}
+		printf("DirectedGraph build:      %.3f seconds\n", watch.Seconds());
+	}
+	{
+		// The keys are 0..n-1, so the same graph can skip the hashing.
+		CStopwatch watch;
+		DenseDirectedGraph<unsigned int> dense;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			dense.AddNode((unsigned int)i);
+		}
+		unsigned int nSeed = 1;
+		for (size_t i = 0; i < nNodes * kDegree; i++)
+		{
+			dense.Connect(NextRandom(&nSeed) % nNodes, NextRandom(&nSeed) % nNodes);
+		}
+		printf("DenseDirectedGraph build: %.3f seconds\n", watch.Seconds());
+	}
+
+	double dFreeze;
+	Frozen frozen;
+	{
+		CStopwatch watch;
+		frozen.Build(graph);
+		dFreeze = watch.Seconds();
+	}
+	for (Frozen::NodeId id = 0; id < frozen.IdLimit(); id++)
+	{
+		for (Frozen::NodeId dest : frozen.PointsTo(id))
+		{
+			nEdges++;
+			s_nSum += dest;
+		}
+	}
+	printf("FrozenGraph build:        %.3f seconds, %u nodes, %u edges\n\n", dFreeze, (unsigned int)nNodes, (unsigned int)nEdges);
+
+	printf("%-24s %12s %12s %12s %9s\n", "pass", "ops", "Graph M/s", "Frozen M/s", "speedup");
+
+	double dGraph, dFrozen;
+	{
+		CStopwatch watch;
+		for (Graph::iterator it = graph.begin(); it != graph.end(); ++it)
+		{
+			for (auto pDest : it->second->setPointsTo)
+			{
+				s_nSum += pDest->nColor;
+			}
+		}
+		dGraph = watch.Seconds();
+	}
+	{
+		CStopwatch watch;
+		for (Frozen::NodeId id = 0; id < frozen.IdLimit(); id++)
+		{
+			for (Frozen::NodeId dest : frozen.PointsTo(id))
+			{
+				s_nSum += frozen.Color(dest);
+			}
+		}
+		dFrozen = watch.Seconds();
+	}
+	Report("edges forward", nEdges, dGraph, dFrozen);
+
+	{
+		CStopwatch watch;
+		for (Graph::iterator it = graph.begin(); it != graph.end(); ++it)
+		{
+			for (auto pSource : it->second->setPointsFrom)
+			{
+				s_nSum += pSource->nColor;
+			}
+		}
+		dGraph = watch.Seconds();
+	}
+	{
+		CStopwatch watch;
+		for (Frozen::NodeId id = 0; id < frozen.IdLimit(); id++)
+		{
+			for (Frozen::NodeId source : frozen.PointsFrom(id))
+			{
+				s_nSum += frozen.Color(source);
+			}
+		}
+		dFrozen = watch.Seconds();
+	}
+	Report("edges backward", nEdges, dGraph, dFrozen);
+
+	size_t nReached;
+	{
+		CStopwatch watch;
+		nReached = ColourAll(&graph);
+		dGraph = watch.Seconds();
+	}
+	size_t nFrozenReached;
+	{
+		CStopwatch watch;
+		nFrozenReached = ColourAll(&frozen);
+		dFrozen = watch.Seconds();
+	}
+	Report("colour walk (per node)", nReached, dGraph, dFrozen);
+	if (nFrozenReached != nReached)
+	{
+		printf("  MISMATCH: the FrozenGraph walk reached %u nodes\n", (unsigned int)nFrozenReached);
+	}
+
+	{
+		// Odd keys go.
+		graph.NewVisited();
+		frozen.NewVisited();
+		for (Graph::iterator it = graph.begin(); it != graph.end(); ++it)
+		{
+			if (it->first & 1)
+			{
+				it->second->nVisit = graph.GetVisited();
+			}
+		}
+		for (Frozen::NodeId id = 0; id < frozen.IdLimit(); id++)
+		{
+			if (frozen.Data(id) & 1)
+			{
+				frozen.Visit(id) = frozen.GetVisited();
+			}
+		}
+	}
+	{
+		CStopwatch watch;
+		graph.DeleteVisited();
+		dGraph = watch.Seconds();
+	}
+	{
+		CStopwatch watch;
+		frozen.DeleteVisited();
+		dFrozen = watch.Seconds();
+	}
+	Report("DeleteVisited (per node)", nNodes, dGraph, dFrozen);
+
+	return 0;
+}
@@ -0,0 +1,585 @@
+// GraphStress.cpp : Long runs of DirectedGraph's colour and visit rounds,
+// checked against a plain model of the graph after every round.
+//
+// Colours and visits used to be 16 bit and came back around after 65536
+// NewColor/NewVisited calls, when a node stamped that long ago looked
+// stamped now: a walk would skip it as already reached, DeleteVisited
+// would take it out.  Each test keeps one such node (stamped in the
+// first round and never again) and runs well past that point:
+// - colours: a fresh depth first colouring from a random node every
+//   round, on a DirectedGraph, a DenseDirectedGraph and a FrozenGraph,
+//   must colour exactly the nodes the model can reach.
+// - visits: every round marks random nodes visited, DeleteVisited takes
+//   them out and fresh nodes with random edges replace them.  Nodes and
+//   both edge sets must match the model after every round.
+// - frozen visits: the same on a FrozenGraph, which can't grow back, so a
+//   node goes only now and then, with a Compact() every kCompactRounds.
+//
+// Then GraphAlgorithms.h against the same model, on fresh random graphs
+// (every other one acyclic) each kComponentRounds rounds: components must
+// be exactly the nodes that reach each other, numbered sinks first, and
+// the topological order and condensation must agree with them.  And once
+// on a chain of kChainNodes, far deeper than a recursive walk would live
+// through.
+//
+// Usage: GraphStress [rounds] [seed]   default 70,000 rounds, seed 1.
+
+#include "stdafx.h"
+
+#include <set>
+
+#include "FrozenGraph.h"
+#include "GraphAlgorithms.h"
+
+static const unsigned int kNodes = 48;
+static const unsigned int kEdgesPerNode = 3;
+static const unsigned int kCompactRounds = 1024;
+static const unsigned int kComponentRounds = 64;
+static const unsigned int kChainNodes = 200000;
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed >> 8;
+}
+
+// The model: live keys, and edges as (source, dest) pairs.
+struct Model
+{
+	set<unsigned int>							keys;
+	set<pair<unsigned int, unsigned int>>		edges;
+
+	// Keys reachable from start, start included.
+	set<unsigned int> Reach(unsigned int start) const
+	{
+		set<unsigned int> reached;
+		vector<unsigned int> stack(1, start);
+		reached.insert(start);
+		while (!stack.empty())
+		{
+			unsigned int node = stack.back();
+			stack.pop_back();
+			set<pair<unsigned int, unsigned int>>::const_iterator it = edges.lower_bound(make_pair(node, 0u));
+			for (; (it != edges.end()) && (it->first == node); ++it)
+			{
+				if (reached.insert(it->second).second)
+				{
+					stack.push_back(it->second);
+				}
+			}
+		}
+		return reached;
+	}
+};
+
+static void EraseNode(Model *pModel, unsigned int key)
+{
+	pModel->keys.erase(key);
+	set<pair<unsigned int, unsigned int>>::iterator it = pModel->edges.begin();
+	while (it != pModel->edges.end())
+	{
+		if ((it->first == key) || (it->second == key))
+		{
+			it = pModel->edges.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+#define CHECK(x) if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); return false; }
+
+template<typename TGraph>
+static void AddRandomEdges(TGraph *pGraph, Model *pModel, unsigned int key, unsigned int *pSeed)
+{
+	vector<unsigned int> keys(pModel->keys.begin(), pModel->keys.end());
+	for (unsigned int i = 0; i < kEdgesPerNode; i++)
+	{
+		unsigned int other = keys[NextRandom(pSeed) % keys.size()];
+		if (other == key)
+		{
+			continue;
+		}
+		bool bOut = (NextRandom(pSeed) & 1) != 0;
+		unsigned int source = bOut ? key : other;
+		unsigned int dest = bOut ? other : key;
+		pGraph->Connect(source, dest);
+		pModel->edges.insert(make_pair(source, dest));
+	}
+}
+
+template<typename TGraph>
+static void BuildRandom(TGraph *pGraph, Model *pModel, unsigned int *pSeed)
+{
+	for (unsigned int key = 0; key < kNodes; key++)
+	{
+		pGraph->AddNode(key);
+		pModel->keys.insert(key);
+	}
+	for (unsigned int key = 0; key < kNodes; key++)
+	{
+		AddRandomEdges(pGraph, pModel, key, pSeed);
+	}
+}
+
+template<typename TGraph>
+static typename TGraph::PNODE FindNode(TGraph *pGraph, unsigned int key)
+{
+	for (typename TGraph::iterator it = pGraph->begin(); it != pGraph->end(); ++it)
+	{
+		if (it->first == key)
+		{
+			return it->second;
+		}
+	}
+	return NULL;
+}
+
+template<typename TGraph>
+static bool MatchesModel(TGraph *pGraph, const Model &model)
+{
+	CHECK(pGraph->Size() == model.keys.size());
+
+	size_t nEdges = 0;
+	for (typename TGraph::iterator it = pGraph->begin(); it != pGraph->end(); ++it)
+	{
+		typename TGraph::PNODE pNode = it->second;
+		CHECK(model.keys.count(it->first) == 1);
+		CHECK(pNode->data == it->first);
+		for (typename TGraph::PNODE pDest : pNode->setPointsTo)
+		{
+			CHECK(model.edges.count(make_pair(pNode->data, pDest->data)) == 1);
+			CHECK(pDest->setPointsFrom.count(pNode) == 1);
+			nEdges++;
+		}
+		for (typename TGraph::PNODE pSource : pNode->setPointsFrom)
+		{
+			CHECK(pSource->setPointsTo.count(pNode) == 1);
+		}
+	}
+	CHECK(nEdges == model.edges.size());
+	return true;
+}
+
+// A round of colouring from start; return the keys it reached.
+template<typename TGraph>
+static set<unsigned int> Colour(TGraph *pGraph, unsigned int start)
+{
+	set<unsigned int> reached;
+	pGraph->NewColor();
+
+	vector<typename TGraph::PNODE> stack(1, FindNode(pGraph, start));
+	stack.back()->nColor = pGraph->GetColor();
+	while (!stack.empty())
+	{
+		typename TGraph::PNODE pNode = stack.back();
+		stack.pop_back();
+		reached.insert(pNode->data);
+		for (typename TGraph::PNODE pDest : pNode->setPointsTo)
+		{
+			if (pDest->nColor != pGraph->GetColor())
+			{
+				pDest->nColor = pGraph->GetColor();
+				stack.push_back(pDest);
+			}
+		}
+	}
+	return reached;
+}
+
+static set<unsigned int> Colour(FrozenGraph<unsigned int> *pGraph, unsigned int start)
+{
+	typedef FrozenGraph<unsigned int>::NodeId NodeId;
+
+	set<unsigned int> reached;
+	pGraph->NewColor();
+
+	vector<NodeId> stack(1, pGraph->Find(start));
+	pGraph->Color(stack.back()) = pGraph->GetColor();
+	while (!stack.empty())
+	{
+		NodeId node = stack.back();
+		stack.pop_back();
+		reached.insert(pGraph->Data(node));
+		for (NodeId dest : pGraph->PointsTo(node))
+		{
+			if (pGraph->Color(dest) != pGraph->GetColor())
+			{
+				pGraph->Color(dest) = pGraph->GetColor();
+				stack.push_back(dest);
+			}
+		}
+	}
+	return reached;
+}
+
+// Node kNodes is the one left behind: only an edge out of it, coloured in
+// the first round and never reached again.
+template<typename TGraph>
+static bool StressColours(unsigned int nRounds, unsigned int nSeed)
+{
+	TGraph graph;
+	Model model;
+	BuildRandom(&graph, &model, &nSeed);
+
+	graph.AddNode(kNodes);
+	graph.Connect(kNodes, 0);
+	model.keys.insert(kNodes);
+	model.edges.insert(make_pair(kNodes, 0u));
+
+	FrozenGraph<unsigned int> frozen(graph);
+	typename TGraph::PNODE pLeft = FindNode(&graph, kNodes);
+	FrozenGraph<unsigned int>::NodeId left = frozen.Find(kNodes);
+
+	CHECK(Colour(&graph, kNodes) == model.Reach(kNodes));
+	CHECK(Colour(&frozen, kNodes) == model.Reach(kNodes));
+
+	for (unsigned int i = 1; i < nRounds; i++)
+	{
+		unsigned int start = NextRandom(&nSeed) % kNodes;
+		set<unsigned int> expected = model.Reach(start);
+		CHECK(Colour(&graph, start) == expected);
+		CHECK(Colour(&frozen, start) == expected);
+
+		if ((pLeft->nColor == graph.GetColor()) || (frozen.Color(left) == frozen.GetColor()))
+		{
+			printf("FAILED: round %u's colour is back to round 0's\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Node kNodes is visited in the first round and never again, and must
+// outlive every DeleteVisited after it.
+template<typename TGraph>
+static bool StressVisits(unsigned int nRounds, unsigned int nSeed)
+{
+	TGraph graph;
+	Model model;
+	BuildRandom(&graph, &model, &nSeed);
+
+	graph.AddNode(kNodes);
+	model.keys.insert(kNodes);
+	AddRandomEdges(&graph, &model, kNodes, &nSeed);
+	FindNode(&graph, kNodes)->nVisit = graph.GetVisited();
+
+	typename TGraph::PNODE pSurvivor = FindNode(&graph, kNodes);
+	for (unsigned int i = 0; i < nRounds; i++)
+	{
+		graph.NewVisited();
+
+		// Mark a few, never the survivor.
+		vector<unsigned int> marked;
+		for (typename TGraph::iterator it = graph.begin(); it != graph.end(); ++it)
+		{
+			if ((it->first != kNodes) && (NextRandom(&nSeed) % 8 == 0))
+			{
+				it->second->nVisit = graph.GetVisited();
+				marked.push_back(it->first);
+			}
+		}
+
+		CHECK(graph.DeleteVisited() == marked.size());
+		for (size_t j = 0; j < marked.size(); j++)
+		{
+			EraseNode(&model, marked[j]);
+		}
+		CHECK(FindNode(&graph, kNodes) == pSurvivor);
+		CHECK(pSurvivor->nVisit != graph.GetVisited());
+
+		// Back up to size under the same keys, wired in at random.
+		for (size_t j = 0; j < marked.size(); j++)
+		{
+			unsigned int key = marked[j];
+			graph.AddNode(key);
+			model.keys.insert(key);
+			AddRandomEdges(&graph, &model, key, &nSeed);
+		}
+
+		if (!MatchesModel(&graph, model))
+		{
+			printf("  in round %u\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool MatchesModel(const FrozenGraph<unsigned int> &graph, const Model &model)
+{
+	typedef FrozenGraph<unsigned int>::NodeId NodeId;
+
+	CHECK(graph.Size() == model.keys.size());
+
+	size_t nEdges = 0;
+	for (NodeId id = 0; id < graph.IdLimit(); id++)
+	{
+		if (graph.IsDeleted(id))
+		{
+			CHECK(model.keys.count(graph.Data(id)) == 0);
+			continue;
+		}
+		CHECK(model.keys.count(graph.Data(id)) == 1);
+		CHECK(graph.Find(graph.Data(id)) == id);
+		for (NodeId dest : graph.PointsTo(id))
+		{
+			CHECK(model.edges.count(make_pair(graph.Data(id), graph.Data(dest))) == 1);
+			nEdges++;
+		}
+		for (NodeId source : graph.PointsFrom(id))
+		{
+			CHECK(model.edges.count(make_pair(graph.Data(source), graph.Data(id))) == 1);
+			nEdges--;
+		}
+	}
+	CHECK(nEdges == 0);
+
+	// and every edge the model has is there
+	for (set<pair<unsigned int, unsigned int>>::const_iterator it = model.edges.begin(); it != model.edges.end(); ++it)
+	{
+		NodeId source = graph.Find(it->first);
+		NodeId dest = graph.Find(it->second);
+		CHECK(count(graph.PointsTo(source).begin(), graph.PointsTo(source).end(), dest) == 1);
+	}
+	return true;
+}
+
+// As StressVisits, node kNodes is visited before the first round and must
+// outlive the rest.
+static bool StressFrozenVisits(unsigned int nRounds, unsigned int nSeed)
+{
+	DirectedGraph<unsigned int> graph;
+	Model model;
+	BuildRandom(&graph, &model, &nSeed);
+
+	graph.AddNode(kNodes);
+	model.keys.insert(kNodes);
+	AddRandomEdges(&graph, &model, kNodes, &nSeed);
+	FindNode(&graph, kNodes)->nVisit = graph.GetVisited();
+
+	FrozenGraph<unsigned int> frozen(graph);
+
+	for (unsigned int i = 0; i < nRounds; i++)
+	{
+		frozen.NewVisited();
+
+		size_t nMarked = 0;
+		if ((model.keys.size() > 1) && (NextRandom(&nSeed) % (nRounds / kNodes + 1) == 0))
+		{
+			vector<unsigned int> keys(model.keys.begin(), model.keys.end());
+			unsigned int key = keys[NextRandom(&nSeed) % keys.size()];
+			if (key != kNodes)
+			{
+				frozen.Visit(frozen.Find(key)) = frozen.GetVisited();
+				EraseNode(&model, key);
+				nMarked++;
+			}
+		}
+
+		CHECK(frozen.DeleteVisited() == nMarked);
+		CHECK(frozen.Visit(frozen.Find(kNodes)) != frozen.GetVisited());
+
+		if ((i % kCompactRounds) == kCompactRounds - 1)
+		{
+			size_t nDeleted = frozen.IdLimit() - frozen.Size();
+			CHECK(frozen.Compact() == nDeleted);
+			CHECK(frozen.IdLimit() == frozen.Size());
+		}
+
+		if (!MatchesModel(frozen, model))
+		{
+			printf("  in round %u\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A random graph on kNodes nodes, from no edges to a few per node.  When
+// bAcyclic, edges only go from lower keys to higher.
+template<typename TGraph>
+static void BuildRandomEdges(TGraph *pGraph, Model *pModel, bool bAcyclic, unsigned int *pSeed)
+{
+	for (unsigned int key = 0; key < kNodes; key++)
+	{
+		pGraph->AddNode(key);
+		pModel->keys.insert(key);
+	}
+	unsigned int nEdges = NextRandom(pSeed) % (2 * kNodes);
+	for (unsigned int i = 0; i < nEdges; i++)
+	{
+		unsigned int source = NextRandom(pSeed) % kNodes;
+		unsigned int dest = NextRandom(pSeed) % kNodes;
+		if (bAcyclic && (source > dest))
+		{
+			swap(source, dest);
+		}
+		if (source != dest)
+		{
+			pGraph->Connect(source, dest);
+			pModel->edges.insert(make_pair(source, dest));
+		}
+	}
+}
+
+template<typename TGraph>
+static bool StressComponents(unsigned int nRounds, unsigned int nSeed)
+{
+	typedef typename TGraph::PNODE PNODE;
+
+	vector<vector<PNODE>> components;
+	vector<PNODE> order;
+	for (unsigned int i = 0; i < nRounds / kComponentRounds; i++)
+	{
+		TGraph graph;
+		Model model;
+		BuildRandomEdges(&graph, &model, (i & 1) != 0, &nSeed);
+
+		size_t nComponents = StronglyConnectedComponents(&graph, &components);
+		CHECK(nComponents == components.size());
+
+		// Every node in one component, the one its nWalk says, with
+		// exactly the nodes it and it alone reaches and is reached by.
+		vector<set<unsigned int>> reach(kNodes);
+		for (unsigned int key = 0; key < kNodes; key++)
+		{
+			reach[key] = model.Reach(key);
+		}
+		size_t nNodes = 0;
+		bool bCycles = false;
+		for (size_t nComponent = 0; nComponent < nComponents; nComponent++)
+		{
+			const vector<PNODE> &component = components[nComponent];
+			CHECK(!component.empty());
+			bCycles |= (component.size() > 1);
+			nNodes += component.size();
+			for (PNODE pNode : component)
+			{
+				CHECK(pNode->nWalk == nComponent);
+				for (unsigned int key = 0; key < kNodes; key++)
+				{
+					bool bStrong = reach[pNode->data].count(key) && reach[key].count(pNode->data);
+					CHECK(bStrong == (FindNode(&graph, key)->nWalk == nComponent));
+				}
+			}
+		}
+		CHECK(nNodes == graph.Size());
+		CHECK(!bCycles || ((i & 1) == 0));
+
+		// Sinks first: edges go down the numbers.
+		for (set<pair<unsigned int, unsigned int>>::const_iterator it = model.edges.begin(); it != model.edges.end(); ++it)
+		{
+			CHECK(FindNode(&graph, it->first)->nWalk >= FindNode(&graph, it->second)->nWalk);
+		}
+
+		// An order exactly when there are no cycles, and every edge goes
+		// forward in it.
+		CHECK(TopologicalOrder(&graph, &order) == !bCycles);
+		if (!bCycles)
+		{
+			CHECK(order.size() == graph.Size());
+			for (size_t j = 0; j < order.size(); j++)
+			{
+				order[j]->nWalk = j;
+			}
+			for (set<pair<unsigned int, unsigned int>>::const_iterator it = model.edges.begin(); it != model.edges.end(); ++it)
+			{
+				CHECK(FindNode(&graph, it->first)->nWalk < FindNode(&graph, it->second)->nWalk);
+			}
+		}
+		else
+		{
+			CHECK(order.empty());
+		}
+
+		// The condensation: a node per component, the edges between them,
+		// no cycles.
+		DenseDirectedGraph<size_t> dag;
+		Condense(&graph, &components, &dag);
+		CHECK(dag.Size() == nComponents);
+		set<pair<size_t, size_t>> crossings;
+		for (set<pair<unsigned int, unsigned int>>::const_iterator it = model.edges.begin(); it != model.edges.end(); ++it)
+		{
+			size_t source = FindNode(&graph, it->first)->nWalk;
+			size_t dest = FindNode(&graph, it->second)->nWalk;
+			if (source != dest)
+			{
+				crossings.insert(make_pair(source, dest));
+			}
+		}
+		size_t nDagEdges = 0;
+		for (DenseDirectedGraph<size_t>::iterator it = dag.begin(); it != dag.end(); ++it)
+		{
+			for (DenseDirectedGraph<size_t>::PNODE pDest : it->second->setPointsTo)
+			{
+				CHECK(crossings.count(make_pair(it->first, pDest->data)) == 1);
+				nDagEdges++;
+			}
+		}
+		CHECK(nDagEdges == crossings.size());
+		vector<DenseDirectedGraph<size_t>::PNODE> dagOrder;
+		CHECK(TopologicalOrder(&dag, &dagOrder));
+	}
+	return true;
+}
+
+// 0 -> 1 -> ... -> kChainNodes - 1: as many components as nodes, the last
+// node first.  Then close it into one cycle.
+static bool StressLongChain()
+{
+	typedef DenseDirectedGraph<unsigned int> Chain;
+
+	Chain chain;
+	for (unsigned int key = 0; key < kChainNodes; key++)
+	{
+		chain.AddNode(key);
+		if (key > 0)
+		{
+			chain.Connect(key - 1, key);
+		}
+	}
+
+	vector<vector<Chain::PNODE>> components;
+	CHECK(StronglyConnectedComponents(&chain, &components) == kChainNodes);
+	for (Chain::iterator it = chain.begin(); it != chain.end(); ++it)
+	{
+		CHECK(it->second->nWalk == kChainNodes - 1 - it->first);
+	}
+
+	vector<Chain::PNODE> order;
+	CHECK(TopologicalOrder(&chain, &order));
+	for (unsigned int j = 0; j < kChainNodes; j++)
+	{
+		CHECK(order[j]->data == j);
+	}
+
+	chain.Connect(kChainNodes - 1, 0);
+	CHECK(StronglyConnectedComponents(&chain, &components) == 1);
+	CHECK(components[0].size() == kChainNodes);
+	CHECK(!TopologicalOrder(&chain, &order));
+	return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	unsigned int nRounds = (argc > 1) ? (unsigned int)atol(argv[1]) : 70000;
+	unsigned int nSeed = (argc > 2) ? (unsigned int)atol(argv[2]) : 1;
+
+	printf("%u rounds, seed %u\n", nRounds, nSeed);
+
+	bool bSucceeded =
+		StressColours<DirectedGraph<unsigned int>>(nRounds, nSeed) &&
+		StressColours<DenseDirectedGraph<unsigned int>>(nRounds, nSeed) &&
+		StressVisits<DirectedGraph<unsigned int>>(nRounds, nSeed) &&
+		StressVisits<DenseDirectedGraph<unsigned int>>(nRounds, nSeed) &&
+		StressFrozenVisits(nRounds, nSeed) &&
+		StressComponents<DirectedGraph<unsigned int>>(nRounds, nSeed) &&
+		StressComponents<DenseDirectedGraph<unsigned int>>(nRounds, nSeed) &&
+		StressLongChain();
+
+	puts(bSucceeded ? "Succeeded" : "FAILED!!!");
+	return bSucceeded ? 0 : 1;
+}
@@ -0,0 +1,548 @@
+// Instruction.cpp : Defines the functions for working with instruction streams.
+//
+
+#include "stdafx.h"
+
+#include "ArenaContainers.h"
+#include "DirectedGraph.h"
+#include "GraphAlgorithms.h"
+
+#include "Instruction.h"
+
+// Helper class that dows the work.
+class BranchResolver
+{
+public:
+	BranchResolver(vector<Instruction> *code, CArenaAllocator *pArena);
+
+	void BuildGraph();
+
+	void Solve();
+
+// Private Data Structures
+private:
+	struct BranchArc
+	{
+		size_t nInstructionIndex;	// Into the vector<Instruction>
+		int	 nBranchByteOffest;		// Signed offset in final bytecode: Assumes unresolved branches take up 0 bytes.
+		int	 nLabelDistance;		// Signed offset in bytes of label: Assumes unresolved branches take up 0 bytes.
+		size_t nFixupDistance;		// Unsigned: Used during graph traversal to adjust arcs based on encoding size of surrounded branches
+	};
+
+// Private Data
+private:
+	vector<Instruction> *m_pCode;
+
+	// keep a vector of all arcs we see.  Not added until
+	// we see the branch source, even for back arcs.
+	typedef vector<BranchArc> ArcVector;
+	ArcVector m_arcs;
+
+	// the nodes in the graph represent arcs in our instructions (the branch span).
+	// However our 'data' will just be the index into an arc vector that
+	// contains the branch source.  Those are 0..n-1, so the nodes sit in a
+	// vector by index: no hashing, and Solve() walks them in arc order every
+	// run rather than in whatever order a hash map has them.  The graph
+	// lives only as long as the resolver, so it all goes in an arena.
+	typedef ArenaDenseDirectedGraph<ArcVector::size_type> ArcGraph;
+	ArcGraph m_graph;
+
+// Private Methods
+private:
+	bool Encode(ArcGraph::PNODE pNode);
+	bool BreakCycle(ArcGraph::PNODE pNode);
+
+	OpCode GetBranchType(const ArcGraph::PNODE pNode) const;
+
+	static int ExtendOffset(int nOriginal, size_t nDistance, bool bLong);
+
+};
+
+void ResolveBranches(vector<Instruction> *code)
+{
+	// The resolver's graph goes in this thread's arena, and comes back out
+	// all at once when the scope ends: no heap traffic once the arena has
+	// pages enough for the biggest function seen.
+	CArenaAllocator *pArena = CArenaAllocator::ThreadArena();
+	CArenaRewindScope scope(pArena);
+
+	BranchResolver resolver(code, pArena);
+
+	resolver.BuildGraph();
+
+	resolver.Solve();
+}
+
+BranchResolver::BranchResolver(vector<Instruction> *code, CArenaAllocator *pArena)
+: m_pCode(code), m_graph(CArenaStlAllocator<ArcVector::size_type>(pArena))
+{
+	// Heuristic that should be measured/sampled. Assume 10% of instructions are branches.
+	m_arcs.reserve(m_pCode->size() / 10);
+}
+
+void BranchResolver::BuildGraph()
+{
+	typedef vector<Instruction> Code;
+	const Code::size_type nSize = m_pCode->size();
+
+	// Map of labels into the arcs vector. Index into arc vector contains the 
+	// first branch source that appears after the label.  Used when
+	// waiting for forward branch sources to the label.
+	typedef unordered_map<Label *, ArcVector::size_type> MapOpenLabels;
+	MapOpenLabels mapOpenLabels;
+
+	// This is the map of forward arcs for which a branch has been
+	// seen, but the closing label has not. The label is the key
+	// and the index into the branch vector is the value
+	typedef unordered_multimap<Label*, ArcVector::size_type> MapOpenBranches;
+	MapOpenBranches mapOpenBranches;
+
+	size_t nByteOffset = 0; // byte offset tracker for final bytecode generation
+
+	// walk all instructions
+	for (Code::size_type i = 0; i < nSize; ++i)
+	{
+		Instruction &op = m_pCode->at(i);
+		nByteOffset += op.size;
+
+		if (OP_LABEL == op.opcode)
+		{
+			Label *pLabel = (Label*)op.pParam;
+
+			Code::size_type nSeenBranches = 0;
+
+			pLabel->nExpectedByteOffset = nByteOffset;
+			pair<MapOpenBranches::iterator, MapOpenBranches::iterator> labelSources;
+			labelSources = mapOpenBranches.equal_range(pLabel);
+
+			if (labelSources.first != labelSources.second)
+			{	// some seen branches targetted this label
+				// Resolve those arcs
+				for (; labelSources.first != labelSources.second; ++labelSources.first)
+				{
+					ArcVector::size_type index = labelSources.first->second;
+					m_arcs[index].nLabelDistance = nByteOffset - m_arcs[index].nBranchByteOffest;
+				}
+
+				// Now we can get rid of them.
+				nSeenBranches = mapOpenBranches.erase(pLabel);
+			}
+
+			if (nSeenBranches < pLabel->nNumRefs)
+			{	// There be back edges to this label remaining!
+				pLabel->nNumRefs -= nSeenBranches; // modify to remaining pending branch source count
+				pLabel->nExpectedByteOffset = nByteOffset;
+
+				// Set a marker so when we see the target branch we know what nodes
+				// in the graph need to be targetted.
+				ASSERT(mapOpenLabels.count(pLabel) == 0);
+				mapOpenLabels[pLabel] = m_arcs.size();
+			}
+
+			if ((nSeenBranches == 0) && (pLabel->nNumRefs == 0))
+			{
+				ASSERT(false && "Erm, label with zero refs showed up. Technically ok, but why???");
+			}
+		}
+		else if (OP_BR_UNRESOLVED == op.opcode)
+		{	// branch instruction
+			ASSERT(op.size == BR_UNRESOLVED_SIZE);
+
+			Label *pLabel = (Label*)op.pParam;
+			ArcVector::size_type idxBranch = m_arcs.size();
+			BranchArc arc;
+			arc.nLabelDistance = 0;
+			arc.nFixupDistance = 0;
+			arc.nInstructionIndex = i;
+			arc.nBranchByteOffest = nByteOffset;
+
+			m_arcs.push_back(arc);
+			m_graph.AddNode(idxBranch);
+
+			// Deal with any labels we've already seen.
+			pair<MapOpenLabels::iterator, MapOpenLabels::iterator> labelSources;
+			labelSources = mapOpenLabels.equal_range(pLabel);
+
+			if (labelSources.first != labelSources.second)
+			{	// seen the label targetted by this branch
+				ASSERT(mapOpenLabels.count(pLabel) == 1); // should never be more than one label defn
+
+				// Set the arc branch distance
+				m_arcs[idxBranch].nLabelDistance = arc.nLabelDistance = pLabel->nExpectedByteOffset - nByteOffset;
+
+				// Now point this arc at all the branch sources we've seen since the label was defined.
+				ArcVector::size_type idxSpannedBranches = labelSources.first->second;
+				for (;idxSpannedBranches < idxBranch; ++idxSpannedBranches)
+				{
+					// This is the connector for back arcs
+					m_graph.Connect(idxBranch, idxSpannedBranches);
+				}
+
+				// Decrement the label's branch ref count. If zero, no longer an open branch
+				pLabel->nNumRefs--;
+				if (0 == pLabel->nNumRefs)
+				{
+					mapOpenLabels.erase(pLabel);
+				}
+			}
+			else
+			{	// Haven't seen label, let this branch hang around until we do
+				mapOpenBranches.insert(MapOpenBranches::value_type(pLabel, idxBranch));
+			}
+
+			// OK, now connect up to any forward reaching arcs that encompass this
+			// branch source.
+			for (const MapOpenBranches::value_type &openBranch : mapOpenBranches)
+			{
+				if (openBranch.second != idxBranch)
+				{	// This is the connector for forward arcs
+					m_graph.Connect(openBranch.second, idxBranch);
+				}
+			}
+
+		} // opcode == branch
+	} // for all instructions
+}	
+
+void BranchResolver::Solve()
+{
+	m_graph.NewVisited();
+
+	// Main algorithm.  Components come sinks first, so every branch a
+	// component spans has had its turn before the component does.  The
+	// acyclic part of the graph resolves leaves up, each node once.
+	vector<vector<ArcGraph::PNODE>> components;
+	StronglyConnectedComponents(&m_graph, &components);
+	for (size_t nComponent = 0; nComponent < components.size(); nComponent++)
+	{
+		vector<ArcGraph::PNODE> &component = components[nComponent];
+		if ((component.size() == 1) && Encode(component[0]))
+		{
+			continue;
+		}
+
+		// Anything else is a cycle in the graph. ie: branches that cross over
+		// each other, or a branch spanning one.  Resolve any where we can
+		// determine with certainty the size of all the spanned branches.  Also
+		// commit the branch size when doing it, once we believe a branch should
+		// be short or long, it better actually happen that way, or all spanning
+		// arcs will be 'off by 1'.
+		//
+		// BreakCycle only looks at the branches a node spans, and only changes
+		// the node and the branches spanning it, so once this component stops
+		// changing nothing later in the pass can move it.  No need to go round
+		// the whole graph again.  In arc order: the walk leaves a component's
+		// nodes in whatever order the edge sets hashed them.
+		sort(component.begin(), component.end(),
+			[](ArcGraph::PNODE pLeft, ArcGraph::PNODE pRight) { return pLeft->data < pRight->data; });
+
+		bool bComponentChanged;
+		do
+		{
+			bComponentChanged = false;
+			for (size_t i = 0; i < component.size(); i++)
+			{
+				bComponentChanged |= BreakCycle(component[i]);
+			}
+		} while (bComponentChanged);
+	}
+
+	// If we get here and they aren't all solved, we have hit a malicious case.
+	// Just make them long branches, or commit them to the size that was determined
+	// earlier with the assumption that all unsized arcs will be long.  (The
+	// solved ones stay in the graph: it's thrown away next, so deleting them
+	// would only be paying to unhook edges twice.)
+	for (const ArcGraph::NodeMap::value_type &pairNode : m_graph)
+	{
+		ArcGraph::PNODE pNode = pairNode.second;
+		if (m_graph.GetVisited() == pNode->nVisit)
+		{	// solved
+			continue;
+		}
+
+		BranchArc &arc(m_arcs[pNode->data]);
+		Instruction &instruction(m_pCode->at(arc.nInstructionIndex));
+		int nLocalFixup = 0;
+
+		for (ArcGraph::PNODE pPointsTo : pNode->setPointsTo)
+		{
+			if (m_graph.GetVisited() == pPointsTo->nVisit)
+			{
+				continue;
+			}
+			// only count the size-unsolved, and assume they are long.
+			nLocalFixup += BR_SIZE_DIFF;
+		}
+
+		// Technically we should mark it visited, but then we would have to update the pointsfrom
+		// set to update the nFixupDistance.  Since we /know/ this is the last time through
+		// the loop, just leave them all alive, so that they are continually accounted for
+		// in the inner loop above.
+
+		// pNode->nVisit = m_graph.GetVisited();
+
+		if (instruction.opcode == OP_BR_UNRESOLVED)
+		{	// assume long
+			instruction.opcode = OP_BR_L;
+			instruction.size = BR_LONG_SIZE;
+		}
+		// commit size
+		int nOffset = ExtendOffset(arc.nLabelDistance, arc.nFixupDistance + nLocalFixup, instruction.opcode == OP_BR_L);
+		instruction.nParam = nOffset;
+	}
+}
+
+// Encode resolves a node that's on no cycle, once every branch it spans
+// has been.  return of false means something it spans is still
+// unresolved; true means it's been resolved
+bool BranchResolver::Encode(ArcGraph::PNODE pNode)
+{
+	if (m_graph.GetVisited() == pNode->nVisit)
+	{	// already processed
+		return true;
+	}
+
+	for (ArcGraph::PNODE pPointsTo : pNode->setPointsTo)
+	{
+		if (m_graph.GetVisited() != pPointsTo->nVisit)
+		{	// waiting on a cycle lower in the arc
+			return false;
+		}
+	}
+
+	// Finally - encode it, no cycles
+	OpCode newOp = OP_BR_S;
+
+	BranchArc &arc(m_arcs[pNode->data]);
+	Instruction &instruction(m_pCode->at(arc.nInstructionIndex));
+	bool bFixupUpdate = false;
+
+	int nDistance = arc.nLabelDistance;
+	if (nDistance <= 0)
+	{
+		nDistance -= arc.nFixupDistance;
+		if (nDistance < -128)
+		{
+			newOp = OP_BR_L;
+			nDistance -= (BR_SIZE_DIFF); // 'long' instructions adjustment
+			ASSERT(instruction.opcode != OP_BR_S);
+			instruction.size = BR_LONG_SIZE;
+			bFixupUpdate = true;
+		}
+	}
+	else
+	{
+		nDistance += arc.nFixupDistance;
+		if (nDistance > 127)
+		{
+			newOp = OP_BR_L;
+			ASSERT(instruction.opcode != OP_BR_S);
+			instruction.size = BR_LONG_SIZE;
+			bFixupUpdate = true;
+		}
+	}
+
+	instruction.opcode = newOp;
+	instruction.nParam = nDistance;
+
+	if (bFixupUpdate) // we went long, so patch up anyone who spanned us
+	{
+		// patch up everyone who directly points to us.
+		for (ArcGraph::PNODE pPointsFrom : pNode->setPointsFrom)
+		{
+			m_arcs[pPointsFrom->data].nFixupDistance += BR_SIZE_DIFF;
+		}
+	}
+
+	// mark processed
+	pNode->nVisit = m_graph.GetVisited();
+
+	return true;
+}
+
+int BranchResolver::ExtendOffset(int nOriginal, size_t nDistance, bool bLong)
+{
+	// Don't infer the longness from the distance - if there's a bug, doing so
+	// will propogate the error and make debugging harder.
+
+	int nLong = bLong ? BR_SIZE_DIFF : 0;
+
+	// If negative, add in the branch size adjustment if needed to skip over ourselves
+	return (nOriginal <= 0) ? nOriginal - (nDistance+nLong) : nOriginal + nDistance;
+}
+
+// Break breakable cycles
+bool BranchResolver::BreakCycle(ArcGraph::PNODE pNode)
+{
+	if (m_graph.GetVisited() == pNode->nVisit)
+	{	// already handled.
+		return false;
+	}
+
+	// Just lock in everything that can be 'trivially' known.
+
+	BranchArc &arc(m_arcs[pNode->data]);
+	Instruction &instruction(m_pCode->at(arc.nInstructionIndex));
+
+	// Figure out 'reasonably' what the size of the spanned branch instructions
+	// are in a way that won't cause circular lockout.
+	int		nLocalFixup = 0;
+	bool	bDistanceKnown = true;
+	for (ArcGraph::PNODE pPointsTo : pNode->setPointsTo)
+	{
+		if (m_graph.GetVisited() == pPointsTo->nVisit)
+		{
+			continue;
+		}
+
+		OpCode branchType = GetBranchType(pPointsTo);
+		switch (branchType)
+		{
+		case OP_BR_S:
+			break;
+		case OP_BR_L:
+			nLocalFixup += BR_SIZE_DIFF;
+			break;
+		case OP_BR_UNRESOLVED:
+			bDistanceKnown = false;
+			break;
+		default:
+			ASSERT(false);
+			return false;
+		}
+
+		if (!bDistanceKnown)
+			break;
+	}
+
+	if (bDistanceKnown)
+	{
+		// OK. We know what size all enclosed instructions will end up being.
+		const int nLabelOffset	= arc.nLabelDistance;
+		nLocalFixup += arc.nFixupDistance; // Add in the fixup we already knew about...
+
+		if ((nLabelOffset >= (-128 + nLocalFixup)) && 
+			(nLabelOffset <= (127 - nLocalFixup)))
+		{	// short branch will work if spanned sizes are 'known'.
+			ASSERT(instruction.opcode != OP_BR_L);
+			instruction.opcode = OP_BR_S;
+			instruction.nParam = ExtendOffset(nLabelOffset, nLocalFixup, false);
+		}
+		// if all the spanned branches are short, is it still too far?
+		else
+		{	// needs a long branch
+			ASSERT(instruction.opcode != OP_BR_S);
+			instruction.opcode = OP_BR_L;
+			instruction.size = BR_LONG_SIZE;
+			instruction.nParam = ExtendOffset(nLabelOffset, nLocalFixup, true);
+		}
+
+		if (instruction.opcode == OP_BR_L)
+		{
+			// patch up everyone who directly points to us.
+			for (ArcGraph::PNODE pPointsFrom : pNode->setPointsFrom)
+			{
+				m_arcs[pPointsFrom->data].nFixupDistance += BR_SIZE_DIFF;
+			}
+		}
+
+		pNode->nVisit = m_graph.GetVisited();
+	}
+	else if (instruction.opcode == OP_BR_UNRESOLVED)
+	{
+		// distance not known yet, do we have a lock on our own
+		// instruction size at least? If so, lock it in.
+		switch (GetBranchType(pNode))
+		{
+		case OP_BR_S:
+			instruction.opcode = OP_BR_S;
+			ASSERT(instruction.size == BR_SHORT_SIZE);
+			break;
+		case OP_BR_L:
+			instruction.opcode = OP_BR_L;
+			instruction.size = BR_LONG_SIZE;
+			break;
+		default:
+			return false; // we don't know anything. :(
+		}
+
+		// OK. We locked the instruction size, but don't know the distance
+		// for the branch for certain.  We no longer participate as a member
+		// of the 'pointsTo' set since we have a known size.  But we can't
+		// mark ourself visited since the instruction is only partially complete.
+		if (instruction.size == BR_LONG_SIZE)
+		{
+			for (ArcGraph::PNODE pPointsFrom : pNode->setPointsFrom)
+			{
+				m_arcs[pPointsFrom->data].nFixupDistance += BR_SIZE_DIFF;
+			}
+		}
+
+		// Patch up everyone who directly points to us.
+		m_graph.DisconnectNodesTo(pNode->data);
+	}
+	else
+	{
+		return false; // We haven't done anything
+	}
+
+	// We changed the graph, maybe even solved something!
+	return true;
+}
+
+// This routine determines if a branch instruction can unequivically
+// fit in a short; or will be required to fit in a long; or if it
+// is unknown.  The upshot is that whatever this routine claims, that
+// branch must be encoded to that size (ie: no widening of something
+// this methods said would be short) - or else it will potentially
+// screw up branches that span the instruction.
+OpCode BranchResolver::GetBranchType(const ArcGraph::PNODE pNode) const
+{
+	const BranchArc &arc(m_arcs[pNode->data]);
+	const Instruction &instruction(m_pCode->at(arc.nInstructionIndex));
+
+	if (instruction.opcode != OP_BR_UNRESOLVED)
+	{
+		// Did we figure this out already?
+		return instruction.opcode; 
+	}
+
+	size_t nSpannedBranches = 0;
+
+	// Figure out how many spanned branches have an unresolved size.
+	// (If the size of a spanned branch instruction was resolved, 
+	// but not the distance it will have been removed from the set. 
+	for (ArcGraph::PNODE pPointsTo : pNode->setPointsTo)
+	{
+		if (m_graph.GetVisited() == pPointsTo->nVisit)
+		{
+			continue;
+		}
+
+		nSpannedBranches++;
+	}
+
+	const int nLabelOffset	= arc.nLabelDistance;
+
+	// max adjustment if all spanned unknowns are long.
+	const int nMaxFixup		= nSpannedBranches * BR_SIZE_DIFF + arc.nFixupDistance;
+
+	// min adjustment if all spanned are short (pretty easy to compute :) )
+	const int nMinFixup		= arc.nFixupDistance;
+
+	// can we do short even if all unknowned are long?
+	if ((nLabelOffset >= (-128 + nMaxFixup)) && 
+		(nLabelOffset <= (127 - nMaxFixup)))
+	{	// short branch will work
+		return OP_BR_S;
+	}
+	// if all the spanned branches are short, is it still too far?
+	else if ((nLabelOffset < (-128 + nMinFixup))||
+			 (nLabelOffset > (127 - nMinFixup)))
+	{	// needs a long branch
+		return OP_BR_L;
+	}
+
+	// We still know nothing.
+	return OP_BR_UNRESOLVED;
+}
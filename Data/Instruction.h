@@ -0,0 +1,43 @@
+#pragma once
+
+enum OpCode
+{
+	OP_BR_S,
+	OP_BR_L,
+	OP_BR_UNRESOLVED,	// not a real opcode, used by code generator
+	OP_LABEL,
+	OP_MISC
+};
+
+#define BR_LONG_SIZE	4
+#define BR_SHORT_SIZE	2
+// Unresolved branches will be predicted short in an act of optimism.
+#define BR_UNRESOLVED_SIZE BR_SHORT_SIZE
+
+#define BR_SIZE_DIFF (BR_LONG_SIZE - BR_SHORT_SIZE)
+
+struct Label
+{
+	string name;
+	size_t  nNumRefs;
+	size_t	nExpectedByteOffset; // not taking into account branch instruction
+};
+
+// An instruction is an opcode, a size for the instruction that is
+// the opcode and its data, and an optional parameter for the instruction.
+// This isn't quite ideal, but it's a good simplification while still
+// being realistic.
+struct Instruction
+{
+	OpCode opcode;
+	size_t size;
+	union
+	{
+		void*			pParam;
+		size_t			sParam;
+		unsigned int	uParam;
+		int				nParam;
+	};
+};
+
+void ResolveBranches(vector<Instruction> *code);
@@ -0,0 +1,116 @@
+#pragma once
+
+// Random numbers for the weighted selection code (see Tree.h).
+//
+// A generator here is anything callable that returns 64 uniformly random
+// bits and can be constructed from a 64 bit seed, so std::mt19937_64 can
+// stand in for CXoshiro256.  Unlike rand() there's no hidden global state:
+// give each thread its own generator and they never contend.
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// xoshiro256** (Blackman and Vigna).  256 bits of state, a period of
+// 2^256 - 1, and a few shifts, xors and multiplies per number.
+class CXoshiro256
+{
+public:
+	typedef unsigned __int64 result_type;
+
+	static const unsigned __int64 kDefaultSeed = 0x853c49e6748fea9bULL;
+
+	explicit CXoshiro256(unsigned __int64 nSeed = kDefaultSeed)
+	{
+		Seed(nSeed);
+	}
+
+	// The state is filled from splitmix64, as the authors recommend, so any
+	// seed (including 0) starts from a well mixed state.
+	void Seed(unsigned __int64 nSeed)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			nSeed += 0x9e3779b97f4a7c15ULL;
+			unsigned __int64 z = nSeed;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			m_state[i] = z ^ (z >> 31);
+		}
+	}
+
+	unsigned __int64 operator()()
+	{
+		unsigned __int64 nResult = Rotl(m_state[1] * 5, 7) * 9;
+		unsigned __int64 nShifted = m_state[1] << 17;
+
+		m_state[2] ^= m_state[0];
+		m_state[3] ^= m_state[1];
+		m_state[1] ^= m_state[2];
+		m_state[0] ^= m_state[3];
+		m_state[2] ^= nShifted;
+		m_state[3] = Rotl(m_state[3], 45);
+
+		return nResult;
+	}
+
+	// For the standard algorithms (ie: std::shuffle).  Parenthesized so a
+	// min/max macro can't get at them.
+	static constexpr unsigned __int64 (min)() { return 0; }
+	static constexpr unsigned __int64 (max)() { return ~0ULL; }
+
+private:
+	static unsigned __int64 Rotl(unsigned __int64 n, int nBits)
+	{
+		return (n << nBits) | (n >> (64 - nBits));
+	}
+
+	unsigned __int64	m_state[4];
+};
+
+// Full 128 bit product of a and b.  Returns the low 64 bits, *pnHigh gets the high.
+inline unsigned __int64 Multiply64(unsigned __int64 a, unsigned __int64 b, unsigned __int64 *pnHigh)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	return _umul128(a, b, pnHigh);
+#elif defined(__SIZEOF_INT128__)
+	unsigned __int128 nProduct = (unsigned __int128)a * b;
+	*pnHigh = (unsigned __int64)(nProduct >> 64);
+	return (unsigned __int64)nProduct;
+#else
+	// Schoolbook, in 32 bit halves.
+	unsigned __int64 aLow = a & 0xffffffff, aHigh = a >> 32;
+	unsigned __int64 bLow = b & 0xffffffff, bHigh = b >> 32;
+
+	unsigned __int64 nLowLow = aLow * bLow;
+	unsigned __int64 nLowHigh = aLow * bHigh;
+	unsigned __int64 nHighLow = aHigh * bLow;
+	unsigned __int64 nMiddle = (nLowLow >> 32) + (nLowHigh & 0xffffffff) + (nHighLow & 0xffffffff);
+
+	*pnHigh = aHigh * bHigh + (nLowHigh >> 32) + (nHighLow >> 32) + (nMiddle >> 32);
+	return (nMiddle << 32) | (nLowLow & 0xffffffff);
+#endif
+}
+
+// Uniform in [0, nBound), nBound > 0.  Lemire's multiply-shift ("Fast Random
+// Integer Generation in an Interval", 2019): the high half of random * nBound,
+// drawing again in the rare case the low half shows it came from the
+// slightly over represented sliver.  No modulo bias, and almost never a divide.
+template<typename TRandom>
+inline unsigned __int64 RandomBelow(TRandom &random, unsigned __int64 nBound)
+{
+	unsigned __int64 nHigh;
+	unsigned __int64 nLow = Multiply64(random(), nBound, &nHigh);
+
+	if (nLow < nBound)
+	{
+		// 2^64 mod nBound
+		unsigned __int64 nThreshold = (0 - nBound) % nBound;
+		while (nLow < nThreshold)
+		{
+			nLow = Multiply64(random(), nBound, &nHigh);
+		}
+	}
+
+	return nHigh;
+}
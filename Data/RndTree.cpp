@@ -30,10 +30,12 @@ struct MyStuff
 int _tmain(int argc, _TCHAR* argv[])
 {
 	Tree<MyStuff> tree;
+	vector<MyStuff> items;
 	MyStuff stuff;
 	const size_t MAX_STR = 60;
 
 	srand((unsigned int)time(0L));
+	tree.Seed((unsigned __int64)time(0L));
 	stuff.name.reserve(MAX_STR);
 
 	for (int i = 0; i < 100; i++)
@@ -55,10 +57,15 @@ int _tmain(int argc, _TCHAR* argv[])
 		}
 		stuff.nWeight = stuff.name.length();
 
-		tree.Add(stuff);
-		tree.AssertValid();
+		items.push_back(stuff);
 	}
 
+	// Sorted, the whole lot goes in at once, no rotations.  Stable, so of
+	// equal names the last made stays, as if each were Add'ed.
+	stable_sort(items.begin(), items.end());
+	tree.BuildFromSorted(items.begin(), items.end());
+	tree.AssertValid();
+
 	tree.TraverseInOrder(&MyStuff::OnVisit);
 	tree.AssertValid();
 
@@ -0,0 +1,177 @@
+// SamplerBench.cpp : Tree vs FenwickTree, the two weighted random samplers,
+// at a range of sizes.
+//
+// For each size: build from scratch (Tree::Add per item, FenwickTree::Build
+// in one go and FenwickTree::Add per item), weighted selection with repeats,
+// ResetWeights, and a full TraverseRandom.  TraverseRandom is skipped above
+// kMaxTraverse items since it's n selections plus n weight updates.
+//
+// Memory is the limit at the top end: Tree needs a heap node per item
+// (around 64 bytes here), FenwickTree the item plus 16 bytes, so
+// 100,000,000 items wants around 10 GB and is only run when asked for.
+//
+// Usage: SamplerBench [item count ...]   default 1000 1000000 10000000.
+
+#include "stdafx.h"
+
+#include <chrono>
+
+#include "Tree.h"
+#include "FenwickTree.h"
+
+static const size_t kSelects = 1000000;
+static const size_t kMaxTraverse = 10000000;
+
+static size_t s_nVisited = 0;
+
+struct BenchItem
+{
+	unsigned int	nKey;
+	size_t			nWeight;
+
+	bool operator<(const BenchItem &rhs) const
+	{ return nKey < rhs.nKey; }
+
+	bool operator==(const BenchItem &rhs) const
+	{ return nKey == rhs.nKey; }
+
+	void OnVisit()
+	{ s_nVisited++; }
+
+	size_t Weight() const
+	{ return nWeight; }
+};
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed;
+}
+
+class CStopwatch
+{
+public:
+	CStopwatch() : m_start(chrono::steady_clock::now()) { }
+	double Seconds() const { return chrono::duration<double>(chrono::steady_clock::now() - m_start).count(); }
+
+private:
+	chrono::steady_clock::time_point	m_start;
+};
+
+static void Report(size_t nItems, const char *pName, size_t nOps, double dTree, double dFenwick)
+{
+	printf("%12u %-24s %12.2f %12.2f %8.2fx\n", (unsigned int)nItems, pName,
+		nOps / dTree / 1e6, nOps / dFenwick / 1e6, dTree / dFenwick);
+}
+
+static void Compare(size_t nItems)
+{
+	// Distinct keys (an odd multiplier is a bijection on 32 bits) so both hold nItems.
+	vector<BenchItem> items(nItems);
+	unsigned int nSeed = 1;
+	for (size_t i = 0; i < nItems; i++)
+	{
+		items[i].nKey = (unsigned int)i * 2654435761u;
+		items[i].nWeight = 1 + NextRandom(&nSeed) % 100;
+	}
+
+	Tree<BenchItem> tree;
+	FenwickTree<BenchItem> fenwick;
+	double dTree, dFenwick;
+
+	{
+		CStopwatch watch;
+		for (size_t i = 0; i < nItems; i++)
+		{
+			tree.Add(items[i]);
+		}
+		dTree = watch.Seconds();
+	}
+	{
+		CStopwatch watch;
+		fenwick.Build(items.begin(), items.end());
+		dFenwick = watch.Seconds();
+	}
+	Report(nItems, "build (Build)", nItems, dTree, dFenwick);
+
+	{
+		FenwickTree<BenchItem> added;
+		CStopwatch watch;
+		for (size_t i = 0; i < nItems; i++)
+		{
+			added.Add(items[i]);
+		}
+		Report(nItems, "build (Add)", nItems, dTree, watch.Seconds());
+	}
+
+	// Done with the copy; at the top end it's memory the traversals want.
+	vector<BenchItem>().swap(items);
+
+	{
+		CStopwatch watch;
+		for (size_t i = 0; i < kSelects; i++)
+		{
+			tree.SelectRandom(&BenchItem::OnVisit, true);
+		}
+		dTree = watch.Seconds();
+	}
+	{
+		CStopwatch watch;
+		for (size_t i = 0; i < kSelects; i++)
+		{
+			fenwick.SelectRandom(&BenchItem::OnVisit, true);
+		}
+		dFenwick = watch.Seconds();
+	}
+	Report(nItems, "SelectRandom (repeat)", kSelects, dTree, dFenwick);
+
+	if (nItems <= kMaxTraverse)
+	{
+		{
+			CStopwatch watch;
+			tree.TraverseRandom(&BenchItem::OnVisit);
+			dTree = watch.Seconds();
+		}
+		{
+			CStopwatch watch;
+			fenwick.TraverseRandom(&BenchItem::OnVisit);
+			dFenwick = watch.Seconds();
+		}
+		Report(nItems, "TraverseRandom (per item)", nItems, dTree, dFenwick);
+	}
+
+	{
+		CStopwatch watch;
+		tree.ResetWeights();
+		dTree = watch.Seconds();
+	}
+	{
+		CStopwatch watch;
+		fenwick.ResetWeights();
+		dFenwick = watch.Seconds();
+	}
+	Report(nItems, "ResetWeights (per item)", nItems, dTree, dFenwick);
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	vector<size_t> sizes;
+	for (int i = 1; i < argc; i++)
+	{
+		sizes.push_back((size_t)atol(argv[i]));
+	}
+	if (sizes.empty())
+	{
+		sizes.push_back(1000);
+		sizes.push_back(1000000);
+		sizes.push_back(10000000);
+	}
+
+	printf("%12s %-24s %12s %12s %9s\n", "items", "operation", "Tree M/s", "Fenwick M/s", "speedup");
+	for (size_t i = 0; i < sizes.size(); i++)
+	{
+		Compare(sizes[i]);
+	}
+
+	return 0;
+}
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <iterator>
+#include <memory>
+
+#include "Random.h"
+
 // To see the interesting parts of this code, prefer looking at (in order of interest):
 // - SelectRandom
 // - TraverseRandom
@@ -13,19 +18,30 @@
 // since this code is about showing the mixing in of the weighted random selection
 // algorithm.  Weighting of 0 remove the item from consideration for selection.
 
+// Nothing recurses: walks use fixed size stacks on the C stack rather than
+// parent pointers in every node.  A red black tree's height is at most
+// 2lg(n+1), so kMaxDepth covers any tree that fits in memory.
+
+// Node layout is for the weighted descent: the words it reads (the links,
+// the node's weight, its left subtree's summed weight and how much of that
+// is taken) come first, with the colour in a spare pointer bit, and the
+// item after.  A selection reads one node header per level and the item
+// only at the end.
+
+//RND Selections without repeats take items out of the running until the
+// next generation.  What's taken is kept beside the weights rather than
+// subtracted from them, and stamped with the generation it was taken in.
+// NewGeneration() just moves the tree on to a new number, so everything is
+// back in O(1): taken state with an old stamp reads as nothing taken, and
+// is cleared by the next write that gets to the node.
+
 // Things that should be done to make this more 'real'.
 //
-// - Get rid of the recursion; and subsequently determine if it's better
-//   to have keep stacks around, or just add parent pointers to the Node type.
-//
-// - Support custom memory allocators, or at least have a decent allocation
-//   story if this is to be heavily used.
-//
 // - Make it STL-Like
 //
-// - Support STL Iterators
-//
-// - Make it thread safe
+// - Make it thread safe.  Selections with repeats only read, so threads
+//   with a generator each can share a tree nobody is changing; for one
+//   that changes, see ConcurrentTree.h.
 //
 // - Better error handling.  This one just has asserts and return values.
 //   Often exception handling really is a better choice (especially on
@@ -34,13 +50,12 @@
 // - Add constraints on TData to force comparability and copy constructability
 //   and a Weight() method or interface.
 //
-// - To make things more readable null checks are typically done on input
-//   parameters of recursive functions.  Nice for readability, but an extra
-//   level of recursion without a /really/ good optimizer. <shrug>
-//
 
 
-template <typename TData>
+// TRandom is the generator selections draw from when they aren't handed
+// one; see Random.h.  Nodes come from TAlloc rebound to the node type, so
+// CArenaStlAllocator puts them in an arena (see ArenaTree in ArenaContainers.h).
+template <typename TData, typename TRandom = CXoshiro256, typename TAlloc = std::allocator<TData> >
 class Tree
 {
 // public types
@@ -48,27 +63,108 @@ class Tree
 	
 // Interface
 public:
-	Tree(void);
+	explicit Tree(const TAlloc &alloc = TAlloc());
 	~Tree(void);
 
 	void Add(const TData &data);
 
-	// Don't have time to re-implement this exercise in tedium.  It barely impacts
-	// the weighted random algorithm any more than insert, except the book-keeping
-	// during the normal 'bst delete' at the start.
+	// Replace the contents with [first, last), which must be sorted.  Of a
+	// run of equal items the last one stays, as if each were Add'ed.  O(n)
+	// and no rotations, where n Add calls are O(n lg n).
+	template<typename TIt>
+	void BuildFromSorted(TIt first, TIt last);
+
+	// Move every item in other into this tree, leaving other empty.  Where
+	// both hold equal items other's stays, as Add would have it.  Weights
+	// come across as they stand (UpdateWeight'd), and taken items stay taken.
+	// O(n + m).  The two allocators must compare equal.
+	void Merge(Tree &other);
+
+	// Replace the contents with a copy of other's, weights as they stand
+	// (UpdateWeight'd).  Nothing in the copy is taken.  O(n) and no
+	// rotations, as BuildFromSorted.
+	void CopyFrom(const Tree &other);
+
+	// return true if removed
+	bool Remove(const TData &data);
+
+	//RND Change the selection weight of the item equal to data, without
+	// copying the item.  Lasts until ResetWeights() goes back to data.Weight().
+	// Puts the item back in the running if it was taken, as Add does.
+	// return true if found
+	bool UpdateWeight(const TData &data, size_t nWeight);
 
-	// bool Remove(const TData &data); // return true if removed
 	// size_t Count() const; // eh, easy to implement later.
 
 	void TraverseInOrder(TraverseCallBack callback) const;
 
-	//RND Select a random item, by weighted preference.
-	bool SelectRandom(TraverseCallBack callback, bool bAllowRepeat = false) const;
+	// In order, front to back.  Items can't be changed through them, that
+	// could break the order, so iterator is const_iterator.  Add, Remove,
+	// BuildFromSorted and Merge invalidate every iterator; weight changes
+	// and selections don't.
+	class const_iterator;
+	typedef const_iterator iterator;
 
-	//RND visit each node exactly once in the weighted random order.
+	const_iterator begin() const;
+	const_iterator end() const;
+
+	// First item not less than data, and first item greater than data.
+	const_iterator lower_bound(const TData &data) const;
+	const_iterator upper_bound(const TData &data) const;
+
+	//RND Summed selection weight of the items in [lo, hi).  O(lg n).
+	unsigned __int64 WeightInRange(const TData &lo, const TData &hi) const;
+
+	//RND Select a random item in [lo, hi), by weighted preference.  As
+	// SelectRandom, but the item is returned rather than called back; NULL
+	// if nothing in the range has weight.  O(lg n).
+	TData *SelectRandomInRange(const TData &lo, const TData &hi, bool bAllowRepeat = false) const
+	{ return SelectRandomInRange(m_random, lo, hi, bAllowRepeat); }
+
+	template<typename TRng>
+	TData *SelectRandomInRange(TRng &random, const TData &lo, const TData &hi, bool bAllowRepeat = false) const;
+
+	//RND Select a random item, by weighted preference.
+	bool SelectRandom(TraverseCallBack callback, bool bAllowRepeat = false) const
+	{ return SelectRandom(m_random, callback, bAllowRepeat); }
+
+	//RND Same, drawing from the caller's generator.  With bAllowRepeat
+	// nothing in the tree changes, so threads with a generator each can
+	// select from one tree at once.
+	template<typename TRng>
+	bool SelectRandom(TRng &random, TraverseCallBack callback, bool bAllowRepeat = false) const;
+
+	//RND Select k items by weighted preference in one pass down the tree,
+	// writing a TData* for each to out.  Return value is how many.
+	// - bWithReplacement: the k draws are independent, so an item can come
+	//   out more than once.  Otherwise the items are distinct and chosen as
+	//   by k calls to SelectRandom(callback, false); fewer than k if the tree
+	//   runs out of weight.
+	// - bAllowRepeat: as for SelectRandom.  false takes every item selected
+	//   out of the running until the next generation.
+	// Items come out in neither key order nor the order drawn: within a
+	// round of draws each node comes before its subtrees, as the walk meets
+	// them.  With replacement there is one round; distinct batches redraw
+	// the draws that hit an item twice, each round after the last.
+	template<typename TOutIt>
+	size_t SelectRandomBatch(size_t k, TOutIt out, bool bWithReplacement = true, bool bAllowRepeat = true) const
+	{ return SelectRandomBatch(m_random, k, out, bWithReplacement, bAllowRepeat); }
+
+	template<typename TRng, typename TOutIt>
+	size_t SelectRandomBatch(TRng &random, size_t k, TOutIt out, bool bWithReplacement = true, bool bAllowRepeat = true) const;
+
+	//RND Restart the tree's own generator.
+	void Seed(unsigned __int64 nSeed) { m_random = TRandom(nSeed); }
+
+	//RND visit each node exactly once in the weighted random order.  Takes
+	// everything, so NewGeneration() before the next.
 	void TraverseRandom(TraverseCallBack callback) const;
 
-	//RND set all the weights back to original values
+	//RND Put back every item taken by selections without repeats.  O(1).
+	void NewGeneration() { m_nGeneration++; m_nTakenWeight = 0; }
+
+	//RND set all the weights back to original values.  Starts a new
+	// generation too.  O(n).
 	void ResetWeights();
 
 	// Verify RedBlack properties, and calidate integrity of weighted values
@@ -76,275 +172,1594 @@ public:
 
 // Internal data types
 private:
+	struct Node;
+
+	// A child link.  The low bit of a node's pLeft is the node's colour, of
+	// its pRight whether it's taken (nodes are pointer aligned, so they're
+	// always free).  Storing a node through a link keeps the bit that's
+	// there: it belongs to the node holding the link, not the one linked to.
+	class Link
+	{
+	public:
+		Link(Node *pNode = NULL) : m_nBits((uintptr_t)pNode) { }
+
+		operator Node *() const { return (Node *)(m_nBits & ~(uintptr_t)1); }
+		Node *operator->() const { return *this; }
+
+		Link &operator=(Node *pNode) { m_nBits = (uintptr_t)pNode | (m_nBits & 1); return *this; }
+		Link &operator=(const Link &rhs) { return *this = (Node *)rhs; }
+
+		bool GetBit() const { return (m_nBits & 1) != 0; }
+		void SetBit(bool bBit) { m_nBits = (m_nBits & ~(uintptr_t)1) | (bBit ? 1 : 0); }
+
+	private:
+		uintptr_t	m_nBits;
+	};
+
+	// The payload stays inline after the header rather than split out to
+	// a cold block of its own.  A split would cost a second allocation per
+	// node and a second miss whenever a walk does reach the item, and for a
+	// small TData it saves nothing: the header already leads the node, so
+	// a descent touches the same lines either way.
 	typedef struct Node
 	{
-		Node	*pLeft;
-		Node	*pRight;
+		// Read by every walk.
+		Link	pLeft;			// low bit: this node is red
+		Link	pRight;			//RND low bit: this node is taken
 		size_t	nWeight;
 		unsigned
-		__int64	nSummedWeight;
+		__int64	nLeftWeight;	//RND summed weight of the left subtree
+		unsigned
+		__int64	nTakenLeft;		//RND how much of that is taken
+		unsigned
+		__int64	nGeneration;	//RND when the taken state was written
+
+		// Read once a walk gets here.
 		TData	data;
-		bool	bRed;
 
 		// a theoretical 2-3-4 'node'.
-		Node(const TData &srcData) : data(srcData), pLeft(NULL), pRight(NULL), bRed(true), nWeight(srcData.Weight())
+		Node(const TData &srcData) : nWeight(srcData.Weight()), nLeftWeight(0), nTakenLeft(0), nGeneration(0), data(srcData)
 		{
-			// initialize this explicitely so as to never confuse anyone who isn't clear
-			// about constructor initialization order being dependant on declaration.
-			// (ie: insulate ourselves from someone re-ordering the struct, while avoiding
-			// calling srcData.Weight() twice since we don't know if that call is expensive or not).
-			nSummedWeight = nWeight;
+			SetRed(true);
 		}
 
+		void SetRed(bool bRed) { pLeft.SetBit(bRed); }
+
 	} *PNODE;
 
+	typedef typename std::allocator_traits<TAlloc>::template rebind_alloc<Node>	NodeAlloc;
+	typedef std::allocator_traits<NodeAlloc>										NodeAllocTraits;
+
+	// Deepest path any walk can take.  See the top of the file.
+	static const size_t kMaxDepth = 128;
+
+public:
+	// Holds the path from the root down to its item, so stepping is
+	// amortized O(1) without parent pointers.  Empty at end().
+	//
+	// Room for the path is kMaxDepth pointers, 1 KB on x64, of which a copy
+	// moves only the m_nDepth in use (around 2lg(n), so a few hundred bytes
+	// for millions of items).  Still, pass them by reference and keep them
+	// out of containers, and prefer ++it and --it: it++ and it-- copy it.
+	class const_iterator
+	{
+	public:
+		typedef std::bidirectional_iterator_tag	iterator_category;
+		typedef TData			value_type;
+		typedef ptrdiff_t		difference_type;
+		typedef const TData		*pointer;
+		typedef const TData		&reference;
+
+		const_iterator() : m_pTree(NULL), m_nDepth(0) { }
+		const_iterator(const const_iterator &rhs) { *this = rhs; }
+
+		const_iterator &operator=(const const_iterator &rhs)
+		{
+			m_pTree = rhs.m_pTree;
+			m_nDepth = rhs.m_nDepth;
+			std::copy(rhs.m_path, rhs.m_path + rhs.m_nDepth, m_path);
+			return *this;
+		}
+
+		reference operator*() const { return Current()->data; }
+		pointer operator->() const { return &Current()->data; }
+
+		//RND The item's selection weight as it stands, which UpdateWeight
+		// changes and data.Weight() doesn't know about.  0 if it's taken.
+		size_t Weight() const { return m_pTree->LiveWeight(Current()); }
+
+		const_iterator &operator++();
+		const_iterator &operator--();
+		const_iterator operator++(int) { const_iterator old(*this); ++*this; return old; }
+		const_iterator operator--(int) { const_iterator old(*this); --*this; return old; }
+
+		bool operator==(const const_iterator &rhs) const
+		{ return (m_nDepth ? Current() : NULL) == (rhs.m_nDepth ? rhs.Current() : NULL); }
+		bool operator!=(const const_iterator &rhs) const
+		{ return !(*this == rhs); }
+
+	private:
+		friend class Tree;
+
+		explicit const_iterator(const Tree *pTree) : m_pTree(pTree), m_nDepth(0) { }
+
+		PNODE Current() const { ASSERT(m_nDepth); return m_path[m_nDepth - 1]; }
+
+		// Onto pNode, then down its left (or right) side as far as it goes.
+		void PushLeftmost(PNODE pNode);
+		void PushRightmost(PNODE pNode);
+
+		const Tree	*m_pTree;	// for stepping back from end()
+		PNODE		m_path[kMaxDepth];
+		size_t		m_nDepth;
+	};
+
 // Internal Methods
 private:
-	// return value is the weight on the new data
-	static size_t Insert(PNODE &pCurrent, const TData &data, bool bRed);
-
-	// callback will be called when selection hit
-	static size_t SelectRandom(const PNODE pNode, unsigned __int64 nRandom, TraverseCallBack callback, bool bAllowRepeat);
+	PNODE NewNode(const TData &data);
+	void FreeNode(PNODE pNode);
+
+	// return value is how much the tree's summed weight changed
+	unsigned __int64 Insert(Link &pRoot, const TData &data);
+
+	// Fills ppPath with the links from the root down to the node equal to
+	// data, and returns how many.  0 if there isn't one.
+	static size_t FindPath(Link &pRoot, const TData &data, Link **ppPath);
+
+	//RND Add nDelta to the left sum of each node above data on its path
+	// (from FindPath) whose left subtree holds it, and take nUntaken out of
+	// their taken sums.
+	static void AddToPathWeights(Link **ppPath, size_t nDepth, const TData &data, unsigned __int64 nDelta, size_t nUntaken = 0);
+
+	// Red black repair after taking out a black node.  See Remove.
+	void RemoveFixup(Link **ppPath, size_t nIndex);
+
+	//RND Summed weight of the items less than data.
+	unsigned __int64 WeightBelow(const TData &data) const;
+
+	//RND A node's taken state is good only for the generation stamped on
+	// it; one stamped in an earlier generation has nothing taken.
+	bool IsCurrent(const PNODE pn) const { return pn->nGeneration == m_nGeneration; }
+	bool IsTaken(const PNODE pn) const { return IsCurrent(pn) && pn->pRight.GetBit(); }
+	size_t TakenWeight(const PNODE pn) const { return IsTaken(pn) ? pn->nWeight : 0; }
+	unsigned __int64 TakenLeft(const PNODE pn) const { return IsCurrent(pn) ? pn->nTakenLeft : 0; }
+
+	//RND What selections see: the weights less what's taken.
+	size_t LiveWeight(const PNODE pn) const { return pn->nWeight - TakenWeight(pn); }
+	unsigned __int64 LiveLeftWeight(const PNODE pn) const { return pn->nLeftWeight - TakenLeft(pn); }
+	unsigned __int64 LiveTotal() const { return m_nTotalWeight - m_nTakenWeight; }
+
+	//RND Stamp pNode with this generation, clearing what an older one left.
+	// Before anything writes its taken state.
+	void Refresh(PNODE pNode) const;
+
+	//RND Take pNode out of the running, and count it in the taken sums of
+	// pPath as FindWeighted fills it.  Return value is the weight taken.
+	size_t Take(PNODE pNode, PNODE *pPath, size_t nDepth) const;
+
+	//RND Put pNode back in the running, if it's taken.  Return value is the
+	// weight put back, which the taken sums above it still count.
+	size_t Untake(PNODE pNode) const;
+
+	// callback will be called when selection hit, return value is the weight selected
+	size_t SelectRandom(PNODE pNode, unsigned __int64 nRandom, TraverseCallBack callback, bool bAllowRepeat) const;
+
+	// The node under pNode whose slice of the summed weight holds nRandom.
+	// pPath gets the nodes the walk went left from, the ones whose left sums
+	// count the node found.
+	PNODE FindWeighted(PNODE pNode, unsigned __int64 nRandom, PNODE *pPath, size_t *pnDepth) const;
+
+	//RND FindWeighted with the weight laid out in key order instead, as
+	// [left subtree][node][right subtree], so a range of keys is a range of
+	// nRandom.
+	PNODE FindWeightedInOrder(PNODE pNode, unsigned __int64 nRandom, PNODE *pPath, size_t *pnDepth) const;
+
+	// Resolve sorted random thresholds against the tree all at once; see
+	// SelectRandomBatch.  bDistinct writes an item once however many land on
+	// it.  bTake takes the items hit, and if pTaken is given records them
+	// there.
+	template<typename TOutIt>
+	size_t SelectThresholds(PNODE pRoot, const unsigned __int64 *pThresholds, size_t nThresholds,
+							bool bDistinct, bool bTake, TOutIt &out, std::vector<PNODE> *pTaken) const;
+
+	// A balanced tree of nCount nodes, which next() hands over in order.
+	// *pnTotalWeight gets their summed weight, and *pnTakenWeight how much
+	// of it is taken (nodes come with their taken state for this generation).
+	template<typename TNext>
+	PNODE Build(size_t nCount, TNext next, unsigned __int64 *pnTotalWeight, unsigned __int64 *pnTakenWeight);
+
+	// Unhook every node into a list in order, linked through pRight.
+	static PNODE Flatten(PNODE pRoot);
 
 	// destructor helper
-	static void DeleteFromRoot(PNODE pNode);
+	void DeleteFromRoot(PNODE pNode);
 
 	// Helpers to make null checking less intrusive
-	static bool IsRed(const PNODE pn) { return pn ? pn->bRed : false; }
-	static unsigned __int64 GetSummedWeight(const PNODE pn) { return pn ? pn->nSummedWeight : 0; }
+	static bool IsRed(const PNODE pn) { return pn ? pn->pLeft.GetBit() : false; }
 
 	// Universal
-	static void RotateLeft(PNODE &pNode);
-	static void RotateRight(PNODE &pNode);
+	void RotateLeft(Link &pNode);
+	void RotateRight(Link &pNode);
 
-	// recursion helper
 	static void Traverse(PNODE pNode, TraverseCallBack callback);
 
+	// Children before parents.  visit(pNode, ppPath, nDepth) also gets the
+	// node's ancestors, root first, in ppPath[0..nDepth).
+	template<typename TVisit>
+	static void VisitPostOrder(PNODE pRoot, TVisit visit);
+
+	//RND In order, with visit(pNode, nLeftWeight) given the summed
+	// weight(pNode) of pNode's left subtree as added up along the way.
+	// Return value is the total.  The walk adds weight(pNode) after visit
+	// returns.
+	template<typename TWeight, typename TVisit>
+	static unsigned __int64 VisitInOrder(PNODE pRoot, TWeight weight, TVisit visit);
+
+	// return value is the new summed weight
 	static unsigned __int64 ResetWeight(PNODE pNode);
 
 	// Verify RedBlack properties, and validate integrity of weighted values
-	static unsigned __int64 AssertValid(const PNODE pNode, int nBlackCountSeen, int *pnBlackTotal);
+	void AssertValid(PNODE pRoot) const;
 
 // Internal data
 private:
-	PNODE	m_pRoot;
+	Link	m_pRoot;
+	mutable unsigned __int64	m_nTotalWeight;	//RND summed weight of every node
+	mutable unsigned __int64	m_nTakenWeight;	//RND how much of that is taken
+	unsigned __int64	m_nGeneration;	//RND see NewGeneration
+	mutable TRandom	m_random;	// for selections not handed a generator
+	NodeAlloc	m_alloc;
 };
 
-template<typename TData>
-Tree<TData>::Tree()
-: m_pRoot(NULL)
+template<typename TData, typename TRandom, typename TAlloc>
+Tree<TData, TRandom, TAlloc>::Tree(const TAlloc &alloc)
+: m_pRoot(NULL), m_nTotalWeight(0), m_nTakenWeight(0), m_nGeneration(1), m_alloc(alloc)
 {
 
 }
 
-template<typename TData>
-Tree<TData>::~Tree()
+template<typename TData, typename TRandom, typename TAlloc>
+Tree<TData, TRandom, TAlloc>::~Tree()
 {
 	DeleteFromRoot(m_pRoot);
 }
 
-template<typename TData>
-void Tree<TData>::DeleteFromRoot(PNODE pNode)
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::DeleteFromRoot(PNODE pNode)
 {
-	if (pNode)
+	// Rotate left children up until there are none, so every node is
+	// deleted on the way down a right spine.  No stack, no weights to keep.
+	while (pNode)
 	{
-		if (pNode->pLeft) DeleteFromRoot(pNode->pLeft);
-		if (pNode->pRight) DeleteFromRoot(pNode->pRight);
+		PNODE pLeft = pNode->pLeft;
+		if (pLeft)
+		{
+			pNode->pLeft = pLeft->pRight;
+			pLeft->pRight = pNode;
+			pNode = pLeft;
+		}
+		else
+		{
+			PNODE pRight = pNode->pRight;
+			FreeNode(pNode);
+			pNode = pRight;
+		}
+	}
+}
+
+// Rotate left children up, as DeleteFromRoot does, until the node on top
+// has none; it's the smallest left, so on the list it goes.
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::PNODE Tree<TData, TRandom, TAlloc>::Flatten(PNODE pNode)
+{
+	Link	head;
+	Link	*ppTail = &head;
 
-		delete pNode;
+	while (pNode)
+	{
+		PNODE pLeft = pNode->pLeft;
+		if (pLeft)
+		{
+			pNode->pLeft = pLeft->pRight;
+			pLeft->pRight = pNode;
+			pNode = pLeft;
+		}
+		else
+		{
+			*ppTail = pNode;
+			ppTail = &pNode->pRight;
+			pNode = pNode->pRight;
+		}
 	}
+
+	return head;
 }
 
-template<typename TData>
-void Tree<TData>::Add(const TData &data)
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::PNODE Tree<TData, TRandom, TAlloc>::NewNode(const TData &data)
+{
+	PNODE pNode = NodeAllocTraits::allocate(m_alloc, 1);
+	try
+	{
+		return new (pNode) Node(data);
+	}
+	catch (...)
+	{
+		NodeAllocTraits::deallocate(m_alloc, pNode, 1);
+		throw;
+	}
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::FreeNode(PNODE pNode)
+{
+	pNode->~Node();
+	NodeAllocTraits::deallocate(m_alloc, pNode, 1);
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::Add(const TData &data)
 {
 	// Pretty much right from Sedgewick
-	Insert(m_pRoot, data, false);
-	m_pRoot->bRed = false;
+	m_nTotalWeight += Insert(m_pRoot, data);
+	m_pRoot->SetRed(false);
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TIt>
+void Tree<TData, TRandom, TAlloc>::BuildFromSorted(TIt first, TIt last)
+{
+	DeleteFromRoot(m_pRoot);
+	m_pRoot = NULL;
+	m_nTotalWeight = 0;
+	m_nTakenWeight = 0;
+
+	// One pass to count, runs of equal items counting once.
+	size_t nCount = 0;
+	for (TIt it = first; it != last; ++it)
+	{
+		TIt next = it;
+		if ((++next == last) || !(*it == *next))
+		{
+			ASSERT((next == last) || (*it < *next));
+			nCount++;
+		}
+	}
+
+	// and one to make the nodes, from the last of each run.
+	TIt it = first;
+	m_pRoot = Build(nCount, [this, &it, last]() -> PNODE
+	{
+		TIt next = it;
+		while ((++next != last) && (*it == *next))
+		{
+			it = next;
+		}
+		PNODE pNode = NewNode(*it);
+		it = next;
+		return pNode;
+	}, &m_nTotalWeight, &m_nTakenWeight);
 }
 
-template<typename TData>
-size_t Tree<TData>::Insert(PNODE &pCurrent, const TData &data, bool bFlip)
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::Merge(Tree &other)
 {
-	if (NULL == pCurrent)
-	{	// Root not set
-		pCurrent = new Node(data);
-		return pCurrent->nWeight;
+	ASSERT(&other != this);
+	ASSERT(m_alloc == other.m_alloc);
+	if (&other == this)
+	{
+		return;
 	}
 
-	if (data == pCurrent->data)
-	{ // match. Replace it since equality is not the same as identity, assume we want the 'freshest' item
-		pCurrent->data = data;
-		pCurrent->nWeight = data.Weight();
-		pCurrent->nSummedWeight = pCurrent->nWeight + GetSummedWeight(pCurrent->pLeft) + GetSummedWeight(pCurrent->pRight);
-		return pCurrent->nWeight;
+	PNODE pMine = Flatten(m_pRoot);
+	PNODE pTheirs = Flatten(other.m_pRoot);
+	m_pRoot = NULL;
+	other.m_pRoot = NULL;
+	other.m_nTotalWeight = 0;
+	other.m_nTakenWeight = 0;
+
+	// Merge the two lists into one.
+	Link	head;
+	Link	*ppTail = &head;
+	size_t	nCount = 0;
+
+	while (pMine || pTheirs)
+	{
+		PNODE pNext;
+		bool bTaken;
+		if ((NULL == pTheirs) || (pMine && (pMine->data < pTheirs->data)))
+		{
+			pNext = pMine;
+			bTaken = IsTaken(pMine);
+			pMine = pMine->pRight;
+		}
+		else
+		{
+			if (pMine && (pMine->data == pTheirs->data))
+			{
+				PNODE pReplaced = pMine;
+				pMine = pMine->pRight;
+				FreeNode(pReplaced);
+			}
+			pNext = pTheirs;
+			bTaken = other.IsTaken(pTheirs);
+			pTheirs = pTheirs->pRight;
+		}
+
+		//RND Taken stays taken, in this tree's generation.  0 is nobody's.
+		pNext->nGeneration = bTaken ? m_nGeneration : 0;
+		pNext->pRight.SetBit(bTaken);
+
+		*ppTail = pNext;
+		ppTail = &pNext->pRight;
+		nCount++;
 	}
 
-	size_t nWeight;
+	PNODE pList = head;
+	m_pRoot = Build(nCount, [&pList]() -> PNODE
+	{
+		PNODE pNode = pList;
+		pList = pNode->pRight;
+		return pNode;
+	}, &m_nTotalWeight, &m_nTakenWeight);
+}
 
-	// 4 node, split it now, fix it on the way back up.
-	if (IsRed(pCurrent->pLeft) && (IsRed(pCurrent->pRight)))
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::CopyFrom(const Tree &other)
+{
+	ASSERT(&other != this);
+	if (&other == this)
 	{
-		pCurrent->bRed = true;
-		pCurrent->pLeft->bRed = false;
-		pCurrent->pRight->bRed = false;
+		return;
 	}
 
-	if (data < pCurrent->data)
-	{ // go left
-		nWeight = Insert(pCurrent->pLeft, data, false);
-		pCurrent->nSummedWeight += nWeight;
+	DeleteFromRoot(m_pRoot);
+	m_pRoot = NULL;
+	m_nTotalWeight = 0;
+	m_nTakenWeight = 0;
 
-		if (IsRed(pCurrent) && IsRed(pCurrent->pLeft) && bFlip)
+	size_t nCount = 0;
+	for (const_iterator it = other.begin(); it != other.end(); ++it)
+	{
+		nCount++;
+	}
+
+	const_iterator it = other.begin();
+	m_pRoot = Build(nCount, [this, &it]() -> PNODE
+	{
+		PNODE pNode = NewNode(*it);
+		pNode->nWeight = it.Current()->nWeight;
+		++it;
+		return pNode;
+	}, &m_nTotalWeight, &m_nTakenWeight);
+}
+
+// Split the count as evenly as possible at every node and the two subtrees'
+// sizes never differ by more than one, so every level is full but the last.
+// Make the nodes on that last level red and the rest black, and each path
+// has the same number of black nodes with no rotations needed.  The shape
+// depends on the count alone, so nodes are made in order, each as soon as
+// its left subtree is done: a frame per level, as VisitInOrder keeps.
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TNext>
+typename Tree<TData, TRandom, TAlloc>::PNODE Tree<TData, TRandom, TAlloc>::Build(size_t nCount, TNext next, unsigned __int64 *pnTotalWeight, unsigned __int64 *pnTakenWeight)
+{
+	struct Frame
+	{
+		PNODE	pNode;		// NULL until the left subtree is done
+		size_t	nMid;		// this node's place; (nMid, nHi) go on its right
+		size_t	nHi;
+		size_t	nLevel;
+		unsigned __int64	nReached;	//RND the totals when the left subtree began
+		unsigned __int64	nTakenReached;
+	};
+
+	size_t nLastLevel = 0;
+	while (((size_t)2 << nLastLevel) - 1 < nCount)
+	{
+		nLastLevel++;
+	}
+
+	Frame	stack[kMaxDepth];
+	size_t	nDepth = 0;
+	PNODE	pDone = NULL;	// the subtree finished last
+	unsigned __int64 nTotal = 0;
+	unsigned __int64 nTaken = 0;
+
+	// The range of the subtree to make next.
+	size_t	nLo = 0;
+	size_t	nHi = nCount;
+	size_t	nLevel = 0;
+
+	try
+	{
+		for (;;)
+		{
+			// Down the left side to an empty subtree.
+			while (nLo < nHi)
+			{
+				ASSERT(nDepth < kMaxDepth);
+				Frame &frame = stack[nDepth++];
+				frame.pNode = NULL;
+				frame.nMid = nLo + (nHi - nLo) / 2;
+				frame.nHi = nHi;
+				frame.nLevel = nLevel++;
+				frame.nReached = nTotal;
+				frame.nTakenReached = nTaken;
+				nHi = frame.nMid;
+			}
+			pDone = NULL;
+
+			// Back up, hanging each finished subtree on its parent, until a
+			// node with its right side still to make.
+			while (nDepth)
+			{
+				Frame &top = stack[nDepth - 1];
+				if (NULL == top.pNode)
+				{
+					PNODE pNode = next();
+					bool bTaken = IsTaken(pNode);
+					pNode->pLeft = pDone;
+					pNode->pRight = NULL;
+					pNode->SetRed((top.nLevel == nLastLevel) && (top.nLevel > 0));
+
+					//RND
+					pNode->nLeftWeight = nTotal - top.nReached;
+					pNode->nTakenLeft = nTaken - top.nTakenReached;
+					pNode->nGeneration = m_nGeneration;
+					pNode->pRight.SetBit(bTaken);
+					nTotal += pNode->nWeight;
+					nTaken += bTaken ? pNode->nWeight : 0;
+					top.pNode = pNode;
+
+					nLo = top.nMid + 1;
+					nHi = top.nHi;
+					nLevel = top.nLevel + 1;
+					break;
+				}
+
+				top.pNode->pRight = pDone;
+				pDone = top.pNode;
+				nDepth--;
+			}
+
+			if (nDepth == 0)
+			{
+				break;
+			}
+		}
+	}
+	catch (...)
+	{
+		// Only next() throws.  The nodes made so far are the subtree just
+		// finished and, in the frames, nodes whose right sides weren't hung
+		// on yet.
+		DeleteFromRoot(pDone);
+		while (nDepth--)
+		{
+			DeleteFromRoot(stack[nDepth].pNode);
+		}
+		throw;
+	}
+
+	*pnTotalWeight = nTotal;
+	*pnTakenWeight = nTaken;
+	return pDone;
+}
+
+// Sedgewick's recursive top down insert, with the recursion unrolled: 4 nodes
+// are split on the way down, and the rotations done on the way back up the
+// recorded path.  Each entry in ppPath is the link (parent's pLeft/pRight,
+// or the root) holding a node on the way down, so rotations can replace it.
+template<typename TData, typename TRandom, typename TAlloc>
+unsigned __int64 Tree<TData, TRandom, TAlloc>::Insert(Link &pRoot, const TData &data)
+{
+	Link	*ppPath[kMaxDepth];
+	bool	bWentRight[kMaxDepth];
+	size_t	nDepth = 0;
+
+	Link *ppCurrent = &pRoot;
+	unsigned __int64 nWeightDelta;
+	size_t nUntaken = 0;	//RND
+
+	for (;;)
+	{
+		PNODE pCurrent = *ppCurrent;
+		if (NULL == pCurrent)
 		{
-			RotateRight(pCurrent);
+			pCurrent = NewNode(data);
+			*ppCurrent = pCurrent;
+			nWeightDelta = pCurrent->nWeight;
+			break;
+		}
+
+		if (data == pCurrent->data)
+		{ // match. Replace it since equality is not the same as identity, assume we want the 'freshest' item
+			// Ancestors only change by the difference.  May 'go negative'; the
+			// unsigned sums wrap back around when it's added.
+			size_t nWeight = data.Weight();
+			nWeightDelta = (unsigned __int64)nWeight - pCurrent->nWeight;
+			nUntaken = Untake(pCurrent);	//RND back in the running if it was taken
+			pCurrent->data = data;
+			pCurrent->nWeight = nWeight;
+			break;
 		}
 
-		// pCurrent->pLeft->pLeft won't deref null because of short circuit eval on the left side
-		if (IsRed(pCurrent->pLeft) && IsRed(pCurrent->pLeft->pLeft))
+		// 4 node, split it now, fix it on the way back up.
+		if (IsRed(pCurrent->pLeft) && (IsRed(pCurrent->pRight)))
 		{
-			RotateRight(pCurrent);
-			pCurrent->bRed = false;
-			pCurrent->pRight->bRed = true;
+			pCurrent->SetRed(true);
+			pCurrent->pLeft->SetRed(false);
+			pCurrent->pRight->SetRed(false);
+		}
+
+		ASSERT(nDepth < kMaxDepth);
+		ppPath[nDepth] = ppCurrent;
+		bWentRight[nDepth] = !(data < pCurrent->data);
+		ppCurrent = bWentRight[nDepth] ? &pCurrent->pRight : &pCurrent->pLeft;
+		nDepth++;
+	}
+
+	while (nDepth--)
+	{
+		Link &pCurrent = *ppPath[nDepth];
+		// Is pCurrent a right child?  (The recursive version's bFlip.)
+		bool bFlip = (nDepth > 0) && bWentRight[nDepth - 1];
+
+		if (!bWentRight[nDepth])
+		{ // went left
+			pCurrent->nLeftWeight += nWeightDelta;
+			pCurrent->nTakenLeft -= nUntaken;	// 0 unless pCurrent is current
+
+			if (IsRed(pCurrent) && IsRed(pCurrent->pLeft) && bFlip)
+			{
+				RotateRight(pCurrent);
+			}
+
+			// pCurrent->pLeft->pLeft won't deref null because of short circuit eval on the left side
+			if (IsRed(pCurrent->pLeft) && IsRed(pCurrent->pLeft->pLeft))
+			{
+				RotateRight(pCurrent);
+				pCurrent->SetRed(false);
+				pCurrent->pRight->SetRed(true);
+			}
+		}
+		else
+		{ // went right
+			if (IsRed(pCurrent) && IsRed(pCurrent->pRight) && !bFlip)
+			{
+				RotateLeft(pCurrent);
+			}
+			if (IsRed(pCurrent->pRight) && IsRed(pCurrent->pRight->pRight))
+			{
+				RotateLeft(pCurrent);
+				pCurrent->SetRed(false);
+				pCurrent->pLeft->SetRed(true);
+			}
 		}
 	}
-	else
-	{ // go right
-		nWeight = Insert(pCurrent->pRight, data, true);
-		pCurrent->nSummedWeight += nWeight;
 
-		if (IsRed(pCurrent) && IsRed(pCurrent->pRight) && !bFlip)
+	return nWeightDelta;
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+size_t Tree<TData, TRandom, TAlloc>::FindPath(Link &pRoot, const TData &data, Link **ppPath)
+{
+	size_t nDepth = 0;
+	Link *ppLink = &pRoot;
+
+	while (*ppLink)
+	{
+		ASSERT(nDepth < kMaxDepth);
+		ppPath[nDepth++] = ppLink;
+
+		PNODE pNode = *ppLink;
+		if (data == pNode->data)
 		{
-			RotateLeft(pCurrent);
+			return nDepth;
 		}
-		if (IsRed(pCurrent->pRight) && IsRed(pCurrent->pRight->pRight))
+		ppLink = (data < pNode->data) ? &pNode->pLeft : &pNode->pRight;
+	}
+
+	return 0;
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::AddToPathWeights(Link **ppPath, size_t nDepth, const TData &data, unsigned __int64 nDelta, size_t nUntaken)
+{
+	for (size_t i = 0; i + 1 < nDepth; i++)
+	{
+		PNODE pNode = *ppPath[i];
+		if (data < pNode->data)
 		{
-			RotateLeft(pCurrent);
-			pCurrent->bRed = false;
-			pCurrent->pLeft->bRed = true;
+			// Only a current node can count anything taken, and a stale
+			// one's taken sum doesn't matter.
+			pNode->nLeftWeight += nDelta;
+			pNode->nTakenLeft -= nUntaken;
 		}
 	}
+}
 
-	return nWeight;
+// The usual bottom up red black delete, without parent pointers: the path
+// of links down to the node taken out stands in for them.
+template<typename TData, typename TRandom, typename TAlloc>
+bool Tree<TData, TRandom, TAlloc>::Remove(const TData &data)
+{
+	// One spare for the level a red sibling rotation adds in RemoveFixup.
+	Link	*ppPath[kMaxDepth + 1];
+	size_t	nDepth = FindPath(m_pRoot, data, ppPath);
+	if (nDepth == 0)
+	{
+		return false;
+	}
+
+	PNODE pRemove = *ppPath[nDepth - 1];
+
+	//RND The item's weight comes out of the sums above it.  Fixed before
+	// anything moves, which the fix up rotations expect.
+	AddToPathWeights(ppPath, nDepth, data, 0 - (unsigned __int64)pRemove->nWeight, Untake(pRemove));
+	m_nTotalWeight -= pRemove->nWeight;
+
+	if (pRemove->pLeft && pRemove->pRight)
+	{
+		// Two children.  Trade items with the in order successor, which has
+		// no left child, and take that node out instead.
+		size_t nFound = nDepth;
+		Link *ppLink = &pRemove->pRight;
+		for (;;)
+		{
+			ASSERT(nDepth < kMaxDepth);
+			ppPath[nDepth++] = ppLink;
+			if (NULL == (*ppLink)->pLeft)
+			{
+				break;
+			}
+			ppLink = &(*ppLink)->pLeft;
+		}
+
+		//RND The successor's weight, and whether it's taken, move up to
+		// pRemove, out of the left sums between them: the path goes right
+		// once and then only left.
+		PNODE pSuccessor = *ppLink;
+		size_t nTaken = TakenWeight(pSuccessor);
+		for (size_t i = nFound; i + 1 < nDepth; i++)
+		{
+			(*ppPath[i])->nLeftWeight -= pSuccessor->nWeight;
+			(*ppPath[i])->nTakenLeft -= nTaken;
+		}
+
+		std::swap(pRemove->data, pSuccessor->data);
+		pRemove->nWeight = pSuccessor->nWeight;
+		if (nTaken)
+		{
+			Refresh(pRemove);
+			pRemove->pRight.SetBit(true);
+		}
+		pRemove = pSuccessor;
+	}
+
+	// At most one child now; it takes the node's place.
+	*ppPath[nDepth - 1] = pRemove->pLeft ? pRemove->pLeft : pRemove->pRight;
+	bool bRemovedBlack = !IsRed(pRemove);
+	FreeNode(pRemove);
+
+	if (bRemovedBlack)
+	{
+		RemoveFixup(ppPath, nDepth - 1);
+	}
+	if (m_pRoot)
+	{
+		m_pRoot->SetRed(false);
+	}
+
+	return true;
+}
+
+// The subtree under the link at ppPath[nIndex] is one black short of its
+// sibling's.  Push the shortfall up the path until a red node can absorb
+// it or a rotation can even things out.  The rotations keep the sums.
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::RemoveFixup(Link **ppPath, size_t nIndex)
+{
+	while ((nIndex > 0) && !IsRed(*ppPath[nIndex]))
+	{
+		Link *ppParentLink = ppPath[nIndex - 1];
+		PNODE pParent = *ppParentLink;
+
+		// The sibling can't be NULL, its side has at least one black.
+		if (ppPath[nIndex] == &pParent->pLeft)
+		{
+			PNODE pSibling = pParent->pRight;
+			if (IsRed(pSibling))
+			{
+				// Rotate the red sibling up, so the new sibling is black.  The
+				// parent moves down a level under it, and the path with it.
+				pSibling->SetRed(false);
+				pParent->SetRed(true);
+				RotateLeft(*ppParentLink);
+				ppPath[nIndex] = &pSibling->pLeft;
+				ppPath[++nIndex] = &pParent->pLeft;
+				ppParentLink = ppPath[nIndex - 1];
+				pSibling = pParent->pRight;
+			}
+
+			if (!IsRed(pSibling->pLeft) && !IsRed(pSibling->pRight))
+			{
+				// Take a black off the sibling's side too, and move up.
+				pSibling->SetRed(true);
+				nIndex--;
+				continue;
+			}
+
+			if (!IsRed(pSibling->pRight))
+			{
+				pSibling->pLeft->SetRed(false);
+				pSibling->SetRed(true);
+				RotateRight(pParent->pRight);
+				pSibling = pParent->pRight;
+			}
+
+			pSibling->SetRed(IsRed(pParent));
+			pParent->SetRed(false);
+			pSibling->pRight->SetRed(false);
+			RotateLeft(*ppParentLink);
+			return;
+		}
+		else
+		{
+			PNODE pSibling = pParent->pLeft;
+			if (IsRed(pSibling))
+			{
+				pSibling->SetRed(false);
+				pParent->SetRed(true);
+				RotateRight(*ppParentLink);
+				ppPath[nIndex] = &pSibling->pRight;
+				ppPath[++nIndex] = &pParent->pRight;
+				ppParentLink = ppPath[nIndex - 1];
+				pSibling = pParent->pLeft;
+			}
+
+			if (!IsRed(pSibling->pLeft) && !IsRed(pSibling->pRight))
+			{
+				pSibling->SetRed(true);
+				nIndex--;
+				continue;
+			}
+
+			if (!IsRed(pSibling->pLeft))
+			{
+				pSibling->pRight->SetRed(false);
+				pSibling->SetRed(true);
+				RotateLeft(pParent->pLeft);
+				pSibling = pParent->pLeft;
+			}
+
+			pSibling->SetRed(IsRed(pParent));
+			pParent->SetRed(false);
+			pSibling->pLeft->SetRed(false);
+			RotateRight(*ppParentLink);
+			return;
+		}
+	}
+
+	if (*ppPath[nIndex])
+	{
+		(*ppPath[nIndex])->SetRed(false);
+	}
 }
 
 //RND
-template<typename TData>
-void Tree<TData>::ResetWeights()
+template<typename TData, typename TRandom, typename TAlloc>
+bool Tree<TData, TRandom, TAlloc>::UpdateWeight(const TData &data, size_t nWeight)
+{
+	Link	*ppPath[kMaxDepth];
+	size_t	nDepth = FindPath(m_pRoot, data, ppPath);
+	if (nDepth == 0)
+	{
+		return false;
+	}
+
+	// The sums counting the node change by the difference; as in Insert it
+	// may 'go negative' and wrap back around.
+	PNODE pNode = *ppPath[nDepth - 1];
+	size_t nUntaken = Untake(pNode);
+	unsigned __int64 nWeightDelta = (unsigned __int64)nWeight - pNode->nWeight;
+	pNode->nWeight = nWeight;
+	AddToPathWeights(ppPath, nDepth, data, nWeightDelta, nUntaken);
+	m_nTotalWeight += nWeightDelta;
+
+	return true;
+}
+
+//RND
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::ResetWeights()
 {	
-	ResetWeight(m_pRoot);
+	m_nTotalWeight = ResetWeight(m_pRoot);
+	NewGeneration();
 }
 
-template<typename TData>
-unsigned __int64 Tree<TData>::ResetWeight(PNODE pNode)
+template<typename TData, typename TRandom, typename TAlloc>
+unsigned __int64 Tree<TData, TRandom, TAlloc>::ResetWeight(PNODE pNode)
 {
-	if (NULL == pNode)
+	return VisitInOrder(pNode, [](PNODE pVisit) { return (unsigned __int64)pVisit->nWeight; },
+		[](PNODE pVisit, unsigned __int64 nLeftWeight)
 	{
-		return 0;
+		pVisit->nWeight = pVisit->data.Weight();
+		pVisit->nLeftWeight = nLeftWeight;
+	});
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TVisit>
+void Tree<TData, TRandom, TAlloc>::VisitPostOrder(PNODE pRoot, TVisit visit)
+{
+	PNODE	path[kMaxDepth];
+	size_t	nDepth = 0;
+	PNODE	pNode = pRoot;
+	PNODE	pLastVisited = NULL;
+
+	for (;;)
+	{
+		while (pNode)
+		{
+			ASSERT(nDepth < kMaxDepth);
+			path[nDepth++] = pNode;
+			pNode = pNode->pLeft;
+		}
+		if (nDepth == 0)
+		{
+			break;
+		}
+
+		// Left side is done.  Do the right side unless we just came from it.
+		PNODE pTop = path[nDepth - 1];
+		if (pTop->pRight && (pTop->pRight != pLastVisited))
+		{
+			pNode = pTop->pRight;
+			continue;
+		}
+
+		nDepth--;
+		visit(pTop, path, nDepth);
+		pLastVisited = pTop;
 	}
+}
+
+//RND: A node's left sum is how much the running total grew between
+// reaching the node and visiting it.
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TWeight, typename TVisit>
+unsigned __int64 Tree<TData, TRandom, TAlloc>::VisitInOrder(PNODE pNode, TWeight weight, TVisit visit)
+{
+	PNODE	path[kMaxDepth];
+	unsigned __int64 reached[kMaxDepth];	// the total when path[i] was reached
+	size_t	nDepth = 0;
+	unsigned __int64 nTotal = 0;
 
-	pNode->nWeight = pNode->data.Weight();
-	pNode->nSummedWeight = pNode->nWeight;
+	for (;;)
+	{
+		while (pNode)
+		{
+			ASSERT(nDepth < kMaxDepth);
+			path[nDepth] = pNode;
+			reached[nDepth++] = nTotal;
+			pNode = pNode->pLeft;
+		}
+		if (nDepth == 0)
+		{
+			break;
+		}
 
-	pNode->nSummedWeight += ResetWeight(pNode->pLeft);
-	pNode->nSummedWeight += ResetWeight(pNode->pRight);
+		nDepth--;
+		pNode = path[nDepth];
+		visit(pNode, nTotal - reached[nDepth]);
+		nTotal += weight(pNode);
+		pNode = pNode->pRight;
+	}
 
-	return pNode->nSummedWeight;
+	return nTotal;
 }
 
 //RND Select a random item, by weighted preference.
-template<typename TData>
-bool Tree<TData>::SelectRandom(TraverseCallBack callback, bool bAllowRepeat) const
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TRng>
+bool Tree<TData, TRandom, TAlloc>::SelectRandom(TRng &random, TraverseCallBack callback, bool bAllowRepeat) const
 {
-	if ((NULL == m_pRoot) || (m_pRoot->nSummedWeight == 0))
+	if ((NULL == m_pRoot) || (LiveTotal() == 0))
 	{
 		return false;
 	}
 
-	__int64 nRandom = rand();
-	nRandom = (nRandom << 32) | rand();
-	nRandom %= m_pRoot->nSummedWeight;
-
-	SelectRandom(m_pRoot, nRandom, callback, bAllowRepeat);
+	SelectRandom(m_pRoot, RandomBelow(random, LiveTotal()), callback, bAllowRepeat);
 
 	return true;
 }
 
+//RND Select k items in one pass.
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TRng, typename TOutIt>
+size_t Tree<TData, TRandom, TAlloc>::SelectRandomBatch(TRng &random, size_t k, TOutIt out, bool bWithReplacement, bool bAllowRepeat) const
+{
+	std::vector<unsigned __int64> thresholds;
+	std::vector<PNODE> taken;
+	size_t nSelected = 0;
+
+	while ((nSelected < k) && m_pRoot && (LiveTotal() > 0))
+	{
+		size_t nDraws = k - nSelected;
+		thresholds.resize(nDraws);
+		for (size_t i = 0; i < nDraws; i++)
+		{
+			thresholds[i] = RandomBelow(random, LiveTotal());
+		}
+		std::sort(thresholds.begin(), thresholds.end());
+
+		if (bWithReplacement)
+		{
+			// Every draw lands on something, so one round does it.
+			nSelected += SelectThresholds(m_pRoot, &thresholds[0], nDraws, false, !bAllowRepeat, out, NULL);
+			break;
+		}
+
+		// Take each item hit so later rounds only draw from what's left;
+		// draws that landed on an item already hit are redrawn next round.
+		// Skipping repeats this way picks items exactly as successive
+		// single selections would.
+		nSelected += SelectThresholds(m_pRoot, &thresholds[0], nDraws, true, true, out, bAllowRepeat ? &taken : NULL);
+	}
+
+	// Put back the items taken only to keep them distinct.
+	for (size_t i = 0; i < taken.size(); i++)
+	{
+		Link	*ppPath[kMaxDepth];
+		PNODE	pNode = taken[i];
+		size_t	nDepth = FindPath(const_cast<Link &>(m_pRoot), pNode->data, ppPath);
+		ASSERT(nDepth && (*ppPath[nDepth - 1] == pNode));
+
+		AddToPathWeights(ppPath, nDepth, pNode->data, 0, Untake(pNode));
+	}
+
+	return nSelected;
+}
+
+//RND: The batch selector.  SelectRandom's walk, down every branch that
+// has a threshold in its range at once: thresholds are sorted, so each
+// node splits its slice of them into [node][left subtree][right subtree]
+// with two binary searches.  A stack frame per level, popped children
+// first so weight taken below can go into the taken sums above.  Once a
+// subtree is down to a single threshold it is a plain SelectRandom walk.
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TOutIt>
+size_t Tree<TData, TRandom, TAlloc>::SelectThresholds(PNODE pRoot, const unsigned __int64 *pThresholds, size_t nThresholds,
+									 bool bDistinct, bool bTake, TOutIt &out, std::vector<PNODE> *pTaken) const
+{
+	struct Frame
+	{
+		PNODE	pNode;
+		size_t	nLeftLo;	// thresholds [nLeftLo, nRightLo) are in the left subtree
+		size_t	nRightLo;	// and [nRightLo, nHi) in the right
+		size_t	nHi;
+		unsigned __int64	nLeftBase;	// where the subtrees' ranges start
+		unsigned __int64	nRightBase;
+		unsigned __int64	nRemoved;	// weight taken in this subtree
+		int		nStage;		// 0: do left, 1: left in progress, 2: right in progress
+	};
+
+	Frame	stack[kMaxDepth];
+	size_t	nDepth = 0;
+	size_t	nSelected = 0;
+	PNODE	path[kMaxDepth];
+
+	// The subtree to enter next, and its thresholds.
+	PNODE	pNode = pRoot;
+	size_t	nLo = 0;
+	size_t	nHi = nThresholds;
+	unsigned __int64 nBase = 0;
+
+	for (;;)
+	{
+		if (pNode && (nHi - nLo == 1))
+		{
+			// Down to one threshold; the rest is the single selection walk.
+			size_t nPathDepth;
+			pNode = FindWeighted(pNode, pThresholds[nLo] - nBase, path, &nPathDepth);
+			*out = &pNode->data;
+			++out;
+			nSelected++;
+
+			if (bTake)
+			{
+				if (pTaken)
+				{
+					pTaken->push_back(pNode);
+				}
+				size_t nWeight = Take(pNode, path, nPathDepth);
+				if (nDepth)
+				{
+					Frame &parent = stack[nDepth - 1];
+					parent.nRemoved += nWeight;
+					if (parent.nStage == 1)
+					{
+						Refresh(parent.pNode);
+						parent.pNode->nTakenLeft += nWeight;
+					}
+				}
+			}
+			pNode = NULL;
+		}
+
+		if (pNode)
+		{
+			ASSERT(nDepth < kMaxDepth);
+			Frame &frame = stack[nDepth++];
+			size_t nWeight = LiveWeight(pNode);
+
+			frame.pNode = pNode;
+			frame.nHi = nHi;
+			frame.nLeftBase = nBase + nWeight;
+			frame.nRightBase = frame.nLeftBase + LiveLeftWeight(pNode);
+			frame.nLeftLo = std::lower_bound(pThresholds + nLo, pThresholds + nHi, frame.nLeftBase) - pThresholds;
+			frame.nRightLo = std::lower_bound(pThresholds + frame.nLeftLo, pThresholds + nHi, frame.nRightBase) - pThresholds;
+			frame.nRemoved = 0;
+			frame.nStage = 0;
+
+			// Thresholds in this node's own slice select it.
+			size_t nHits = frame.nLeftLo - nLo;
+			if (nHits)
+			{
+				size_t nWrite = bDistinct ? 1 : nHits;
+				for (size_t i = 0; i < nWrite; i++)
+				{
+					*out = &pNode->data;
+					++out;
+				}
+				nSelected += nWrite;
+
+				if (bTake)
+				{
+					if (pTaken)
+					{
+						pTaken->push_back(pNode);
+					}
+					frame.nRemoved = Take(pNode, NULL, 0);
+				}
+			}
+			pNode = NULL;
+		}
+
+		if (nDepth == 0)
+		{
+			break;
+		}
+
+		Frame &top = stack[nDepth - 1];
+		if (top.nStage == 0)
+		{
+			top.nStage = 1;
+			if (top.nLeftLo < top.nRightLo)
+			{
+				pNode = top.pNode->pLeft;
+				nLo = top.nLeftLo;
+				nHi = top.nRightLo;
+				nBase = top.nLeftBase;
+				ASSERT(pNode);
+			}
+			continue;
+		}
+		if (top.nStage == 1)
+		{
+			top.nStage = 2;
+			if (top.nRightLo < top.nHi)
+			{
+				pNode = top.pNode->pRight;
+				nLo = top.nRightLo;
+				nHi = top.nHi;
+				nBase = top.nRightBase;
+				ASSERT(pNode);
+			}
+			continue;
+		}
+
+		nDepth--;
+		if (nDepth)
+		{
+			Frame &parent = stack[nDepth - 1];
+			parent.nRemoved += top.nRemoved;
+			if ((parent.nStage == 1) && top.nRemoved)
+			{
+				Refresh(parent.pNode);
+				parent.pNode->nTakenLeft += top.nRemoved;
+			}
+		}
+	}
+
+	return nSelected;
+}
+
 //RND: The selector
-template<typename TData>
-size_t Tree<TData>::SelectRandom(const PNODE pNode, unsigned __int64 nRandom, TraverseCallBack callback, bool bAllowRepeat)
+// Find the node, then take it out of the running.
+template<typename TData, typename TRandom, typename TAlloc>
+size_t Tree<TData, TRandom, TAlloc>::SelectRandom(PNODE pNode, unsigned __int64 nRandom, TraverseCallBack callback, bool bAllowRepeat) const
 {
-	ASSERT(pNode);
+	PNODE	path[kMaxDepth];
+	size_t	nDepth;
+
+	pNode = FindWeighted(pNode, nRandom, path, &nDepth);
+
+	size_t nWeight = bAllowRepeat ? pNode->nWeight : Take(pNode, path, nDepth);
+
+	(pNode->data.*callback)();
+
+	return nWeight;
+}
+
+//RND
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::Refresh(PNODE pNode) const
+{
+	if (!IsCurrent(pNode))
+	{
+		pNode->nGeneration = m_nGeneration;
+		pNode->nTakenLeft = 0;
+		pNode->pRight.SetBit(false);
+	}
+}
+
+//RND
+template<typename TData, typename TRandom, typename TAlloc>
+size_t Tree<TData, TRandom, TAlloc>::Take(PNODE pNode, PNODE *pPath, size_t nDepth) const
+{
+	ASSERT(!IsTaken(pNode));
 
 	size_t nWeight = pNode->nWeight;
-	if (nRandom < nWeight)
+	Refresh(pNode);
+	pNode->pRight.SetBit(true);
+	while (nDepth--)
 	{
-		if (!bAllowRepeat) pNode->nWeight = 0;
+		Refresh(pPath[nDepth]);
+		pPath[nDepth]->nTakenLeft += nWeight;
+	}
+	m_nTakenWeight += nWeight;
 
-		(pNode->data.*callback)();
+	return nWeight;
+}
+
+//RND
+template<typename TData, typename TRandom, typename TAlloc>
+size_t Tree<TData, TRandom, TAlloc>::Untake(PNODE pNode) const
+{
+	size_t nWeight = TakenWeight(pNode);
+	if (nWeight)
+	{
+		pNode->pRight.SetBit(false);
+		m_nTakenWeight -= nWeight;
 	}
-	else
+	return nWeight;
+}
+
+//RND: Each node's range is laid out as [node][left subtree][right subtree].
+// Walk down to the node whose slice holds nRandom.  Both sizes it needs are
+// in the node itself, so each level reads just the one node header.
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::PNODE Tree<TData, TRandom, TAlloc>::FindWeighted(PNODE pNode, unsigned __int64 nRandom, PNODE *pPath, size_t *pnDepth) const
+{
+	size_t nDepth = 0;
+
+	for (;;)
 	{
+		ASSERT(pNode);
+
+		size_t nWeight = LiveWeight(pNode);
+		if (nRandom < nWeight)
+		{
+			break;
+		}
 		nRandom -= nWeight;
 
-		if (nRandom < GetSummedWeight(pNode->pLeft))
+		unsigned __int64 nLeftWeight = LiveLeftWeight(pNode);
+		if (nRandom < nLeftWeight)
 		{
-			nWeight = SelectRandom(pNode->pLeft, nRandom, callback, bAllowRepeat);
+			ASSERT(nDepth < kMaxDepth);
+			pPath[nDepth++] = pNode;
+			pNode = pNode->pLeft;
 		}
 		else
 		{
-			nRandom -= GetSummedWeight(pNode->pLeft);
-			nWeight = SelectRandom(pNode->pRight, nRandom, callback, bAllowRepeat);
+			nRandom -= nLeftWeight;
+			pNode = pNode->pRight;
 		}
 	}
 
-	if (!bAllowRepeat)
+	*pnDepth = nDepth;
+	return pNode;
+}
+
+//RND: The usual in order rank search, by weight: left subtree, then the
+// node, then right.  Same path as FindWeighted records, the nodes it went
+// left from.
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::PNODE Tree<TData, TRandom, TAlloc>::FindWeightedInOrder(PNODE pNode, unsigned __int64 nRandom, PNODE *pPath, size_t *pnDepth) const
+{
+	size_t nDepth = 0;
+
+	for (;;)
 	{
-		pNode->nSummedWeight -= nWeight;
+		ASSERT(pNode);
+
+		unsigned __int64 nLeftWeight = LiveLeftWeight(pNode);
+		if (nRandom < nLeftWeight)
+		{
+			ASSERT(nDepth < kMaxDepth);
+			pPath[nDepth++] = pNode;
+			pNode = pNode->pLeft;
+			continue;
+		}
+		nRandom -= nLeftWeight;
+
+		size_t nWeight = LiveWeight(pNode);
+		if (nRandom < nWeight)
+		{
+			break;
+		}
+		nRandom -= nWeight;
+		pNode = pNode->pRight;
+	}
+
+	*pnDepth = nDepth;
+	return pNode;
+}
+
+//RND: Everything left of where a search for data goes right is less than it.
+template<typename TData, typename TRandom, typename TAlloc>
+unsigned __int64 Tree<TData, TRandom, TAlloc>::WeightBelow(const TData &data) const
+{
+	unsigned __int64 nWeight = 0;
+	PNODE pNode = m_pRoot;
+
+	while (pNode)
+	{
+		if (pNode->data < data)
+		{
+			nWeight += LiveLeftWeight(pNode) + LiveWeight(pNode);
+			pNode = pNode->pRight;
+		}
+		else
+		{
+			pNode = pNode->pLeft;
+		}
 	}
 
 	return nWeight;
 }
 
+//RND
+template<typename TData, typename TRandom, typename TAlloc>
+unsigned __int64 Tree<TData, TRandom, TAlloc>::WeightInRange(const TData &lo, const TData &hi) const
+{
+	unsigned __int64 nBelowLo = WeightBelow(lo);
+	unsigned __int64 nBelowHi = WeightBelow(hi);
+	return (nBelowHi > nBelowLo) ? (nBelowHi - nBelowLo) : 0;
+}
+
+//RND: The range's weight is one stretch of the in order layout, so draw
+// from that stretch and look it up.
+template<typename TData, typename TRandom, typename TAlloc>
+template<typename TRng>
+TData *Tree<TData, TRandom, TAlloc>::SelectRandomInRange(TRng &random, const TData &lo, const TData &hi, bool bAllowRepeat) const
+{
+	unsigned __int64 nBelowLo = WeightBelow(lo);
+	unsigned __int64 nBelowHi = WeightBelow(hi);
+	if (nBelowHi <= nBelowLo)
+	{
+		return NULL;
+	}
+
+	PNODE	path[kMaxDepth];
+	size_t	nDepth;
+	PNODE	pNode = FindWeightedInOrder(m_pRoot, nBelowLo + RandomBelow(random, nBelowHi - nBelowLo), path, &nDepth);
+	ASSERT(!(pNode->data < lo) && (pNode->data < hi));
+
+	if (!bAllowRepeat)
+	{
+		Take(pNode, path, nDepth);
+	}
+
+	return &pNode->data;
+}
+
 //RND visit each node exactly once in the weighted random order.
-template<typename TData>
-void Tree<TData>::TraverseRandom(TraverseCallBack callback) const
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::TraverseRandom(TraverseCallBack callback) const
 {
 	while (SelectRandom(callback, false))
 		;
 }
 
-template<typename TData>
-void Tree<TData>::TraverseInOrder(TraverseCallBack callback) const
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::TraverseInOrder(TraverseCallBack callback) const
 {
 	Traverse(m_pRoot, callback);
 }
 
-template<typename TData>
-void Tree<TData>::Traverse(PNODE pNode, TraverseCallBack callback)
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::Traverse(PNODE pNode, TraverseCallBack callback)
 {
-	if (NULL == pNode) return;
+	// path holds the nodes whose left side is being visited.
+	PNODE	path[kMaxDepth];
+	size_t	nDepth = 0;
 
-	Traverse(pNode->pLeft, callback);
-	
-	(pNode->data.*callback)();
+	for (;;)
+	{
+		while (pNode)
+		{
+			ASSERT(nDepth < kMaxDepth);
+			path[nDepth++] = pNode;
+			pNode = pNode->pLeft;
+		}
+		if (nDepth == 0)
+		{
+			break;
+		}
+
+		pNode = path[--nDepth];
+		(pNode->data.*callback)();
+		pNode = pNode->pRight;
+	}
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::const_iterator Tree<TData, TRandom, TAlloc>::begin() const
+{
+	const_iterator it(this);
+	it.PushLeftmost(m_pRoot);
+	return it;
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::const_iterator Tree<TData, TRandom, TAlloc>::end() const
+{
+	return const_iterator(this);
+}
+
+// The search path, cut back to the last node that qualified.
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::const_iterator Tree<TData, TRandom, TAlloc>::lower_bound(const TData &data) const
+{
+	const_iterator it(this);
+	size_t nFound = 0;
+
+	for (PNODE pNode = m_pRoot; pNode; )
+	{
+		ASSERT(it.m_nDepth < kMaxDepth);
+		it.m_path[it.m_nDepth++] = pNode;
+		if (pNode->data < data)
+		{
+			pNode = pNode->pRight;
+		}
+		else
+		{
+			nFound = it.m_nDepth;
+			pNode = pNode->pLeft;
+		}
+	}
+
+	it.m_nDepth = nFound;
+	return it;
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::const_iterator Tree<TData, TRandom, TAlloc>::upper_bound(const TData &data) const
+{
+	const_iterator it(this);
+	size_t nFound = 0;
+
+	for (PNODE pNode = m_pRoot; pNode; )
+	{
+		ASSERT(it.m_nDepth < kMaxDepth);
+		it.m_path[it.m_nDepth++] = pNode;
+		if (data < pNode->data)
+		{
+			nFound = it.m_nDepth;
+			pNode = pNode->pLeft;
+		}
+		else
+		{
+			pNode = pNode->pRight;
+		}
+	}
+
+	it.m_nDepth = nFound;
+	return it;
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::const_iterator::PushLeftmost(PNODE pNode)
+{
+	while (pNode)
+	{
+		ASSERT(m_nDepth < kMaxDepth);
+		m_path[m_nDepth++] = pNode;
+		pNode = pNode->pLeft;
+	}
+}
+
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::const_iterator::PushRightmost(PNODE pNode)
+{
+	while (pNode)
+	{
+		ASSERT(m_nDepth < kMaxDepth);
+		m_path[m_nDepth++] = pNode;
+		pNode = pNode->pRight;
+	}
+}
+
+// The next item is the leftmost of the right subtree if there is one,
+// otherwise the nearest ancestor this item is left of.
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::const_iterator &Tree<TData, TRandom, TAlloc>::const_iterator::operator++()
+{
+	PNODE pNode = Current();
+	if (pNode->pRight)
+	{
+		PushLeftmost(pNode->pRight);
+		return *this;
+	}
+
+	PNODE pChild;
+	do
+	{
+		pChild = m_path[--m_nDepth];
+	}
+	while (m_nDepth && (m_path[m_nDepth - 1]->pRight == pChild));
+
+	return *this;
+}
+
+// The mirror image, and from end() the last item.
+template<typename TData, typename TRandom, typename TAlloc>
+typename Tree<TData, TRandom, TAlloc>::const_iterator &Tree<TData, TRandom, TAlloc>::const_iterator::operator--()
+{
+	if (m_nDepth == 0)
+	{
+		PushRightmost(m_pTree->m_pRoot);
+		return *this;
+	}
 
-	Traverse(pNode->pRight, callback);
+	PNODE pNode = Current();
+	if (pNode->pLeft)
+	{
+		PushRightmost(pNode->pLeft);
+		return *this;
+	}
+
+	PNODE pChild;
+	do
+	{
+		pChild = m_path[--m_nDepth];
+	}
+	while (m_nDepth && (m_path[m_nDepth - 1]->pLeft == pChild));
+
+	return *this;
 }
 
 //RND: As the items rotate, the weighted sums must be kept in sync
-template<typename TData>
-void Tree<TData>::RotateLeft(PNODE &pNode)
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::RotateLeft(Link &pNode)
 {
 	PNODE pRight = pNode->pRight;
 
 	// Update the counts first
-	// The point of the rotate is that the right child exists and
-	// replaces the current node. So pick up that weight.
-	pRight->nSummedWeight = pNode->nSummedWeight;
-
-	// The current node will 'lose' the weight of right's right tree and right itself.
-	pNode->nSummedWeight -= (GetSummedWeight(pRight->pRight) + pRight->nWeight);
+	// The current node and everything left of it join right's left
+	// subtree.  The current node's own left subtree doesn't change.
+	pRight->nLeftWeight += pNode->nWeight + pNode->nLeftWeight;
+	unsigned __int64 nTaken = TakenWeight(pNode) + TakenLeft(pNode);
+	if (nTaken)
+	{
+		Refresh(pRight);
+		pRight->nTakenLeft += nTaken;
+	}
 
 	pNode->pRight = pRight->pLeft;
 	pRight->pLeft = pNode;
@@ -352,62 +1767,76 @@ void Tree<TData>::RotateLeft(PNODE &pNode)
 }
 
 //RND: As the items rotate, the weighted sums must be kept in sync
-template<typename TData>
-void Tree<TData>::RotateRight(PNODE &pNode)
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::RotateRight(Link &pNode)
 {
 	PNODE pLeft = pNode->pLeft;
 
 	// Update the counts first
-	// The point of the rotate is that the left child exists and
-	// replaces the current node. So pick up that weight.
-	pLeft->nSummedWeight = pNode->nSummedWeight;
-
-	// The current node will 'lose' the weight of left's left tree and left iself.
-	pNode->nSummedWeight -= (GetSummedWeight(pLeft->pLeft) + pLeft->nWeight);
+	// The current node will 'lose' left and left's left tree; only left's
+	// right tree stays on its left.  Left's own left subtree doesn't change.
+	pNode->nLeftWeight -= pLeft->nWeight + pLeft->nLeftWeight;
+	unsigned __int64 nTaken = TakenWeight(pLeft) + TakenLeft(pLeft);
+	if (nTaken)
+	{
+		ASSERT(IsCurrent(pNode));
+		pNode->nTakenLeft -= nTaken;
+	}
 
 	pNode->pLeft = pLeft->pRight;
 	pLeft->pRight = pNode;
 	pNode = pLeft;
 }
 
-// Return value is the count of black children
-template<typename TData>
-unsigned __int64 Tree<TData>::AssertValid(const PNODE pNode, int nBlackCountSeen, int *pnBlackTotal)
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::AssertValid(PNODE pRoot) const
 {
-	if (pNode == NULL)
-	{
-		return 0;
-	}
-	
-	// (2)
-	if (IsRed(pNode))
-	{
-		ASSERT(!IsRed(pNode->pLeft));
-		ASSERT(!IsRed(pNode->pRight));
-	}
-	else
-	{
-		nBlackCountSeen++;
-	}
+	int nBlackTotal = -1;
 
-	// (3)
-	if ((NULL == pNode->pLeft) && (NULL == pNode->pRight))
+	VisitPostOrder(pRoot, [&nBlackTotal](PNODE pNode, const PNODE *ppPath, size_t nDepth)
 	{
-		if (*pnBlackTotal < 0)
+		// (2)
+		if (IsRed(pNode))
 		{
-			*pnBlackTotal = nBlackCountSeen;
+			ASSERT(!IsRed(pNode->pLeft));
+			ASSERT(!IsRed(pNode->pRight));
 		}
-		ASSERT(*pnBlackTotal == nBlackCountSeen);
-	}
 
-	//RND (4)
-	unsigned __int64 nComputedWeight = pNode->nWeight;
-	nComputedWeight += AssertValid(pNode->pLeft, nBlackCountSeen, pnBlackTotal);
-	nComputedWeight += AssertValid(pNode->pRight, nBlackCountSeen, pnBlackTotal);
+		// (3)
+		if ((NULL == pNode->pLeft) && (NULL == pNode->pRight))
+		{
+			int nBlackCountSeen = IsRed(pNode) ? 0 : 1;
+			for (size_t i = 0; i < nDepth; i++)
+			{
+				if (!IsRed(ppPath[i]))
+				{
+					nBlackCountSeen++;
+				}
+			}
+
+			if (nBlackTotal < 0)
+			{
+				nBlackTotal = nBlackCountSeen;
+			}
+			ASSERT(nBlackTotal == nBlackCountSeen);
+		}
+	});
 
-	ASSERT(nComputedWeight == pNode->nSummedWeight); // (5)
+	//RND (4)
+	unsigned __int64 nComputedTotal = VisitInOrder(pRoot, [](PNODE pNode) { return (unsigned __int64)pNode->nWeight; },
+		[](PNODE pNode, unsigned __int64 nLeftWeight)
+	{
+		ASSERT(nLeftWeight == pNode->nLeftWeight);
+	});
+	ASSERT(nComputedTotal == m_nTotalWeight);
 
-	return nComputedWeight;
+	//RND (5)
+	unsigned __int64 nComputedTaken = VisitInOrder(pRoot, [this](PNODE pNode) { return (unsigned __int64)TakenWeight(pNode); },
+		[this](PNODE pNode, unsigned __int64 nTakenLeft)
+	{
+		ASSERT(nTakenLeft == TakenLeft(pNode));
+	});
+	ASSERT(nComputedTaken == m_nTakenWeight);
 }
 
 // Properties being validated:
@@ -415,24 +1844,25 @@ unsigned __int64 Tree<TData>::AssertValid(const PNODE pNode, int nBlackCountSeen
 // (2) red nodes have only black immediate children
 // (3) count of black nodes on any vertical path is equal.
 //RND
-// (4) Weighted sum of any node is the weight of the node
-//   plus the weighted sum of its children.
-template<typename TData>
-void Tree<TData>::AssertValid() const
+// (4) The left sum of any node is the summed weight of its left
+//   subtree, and all the weights add up to the tree's total.
+// (5) Likewise the taken sums, counting what's taken this generation.
+template<typename TData, typename TRandom, typename TAlloc>
+void Tree<TData, TRandom, TAlloc>::AssertValid() const
 {
 #ifndef _DEBUG
-	return true;
+	return;
 #else
 	if (m_pRoot == NULL)
 	{
+		ASSERT((m_nTotalWeight == 0) && (m_nTakenWeight == 0));
 		return;
 	}
 
 	// (1)
-	ASSERT(m_pRoot->bRed == false);
+	ASSERT(IsRed(m_pRoot) == false);
 
-	int nBlackPathCount = -1;
-	AssertValid(m_pRoot, 0, &nBlackPathCount);
+	AssertValid(m_pRoot);
 
 #endif
 }
@@ -0,0 +1,355 @@
+// TreeBench.cpp : Throughput of the weighted random Tree's operations.
+//
+// Builds big trees from random and from sorted keys, churns replace-on-equal
+// inserts, then times weighted selection with and without repeats (one at a
+// time and kBatch per SelectRandomBatch call), ResetWeights, the full
+// weighted random traversal (after ResetWeights and after NewGeneration), in
+// order traversal by callback and by iterator, in place weight updates,
+// selection within key ranges and removal, then BuildFromSorted and Merge.
+// Then the same build and selection again with the nodes in a
+// CArenaAllocator, and Remove/Add churn in an arena with and without the
+// arena's node recycling.
+//
+// Usage: TreeBench [node count]   default 1,000,000.
+
+#include "stdafx.h"
+
+#include <chrono>
+#include <thread>
+
+#include "Tree.h"
+#include "ArenaContainers.h"
+
+static const size_t kBatch = 1000;
+
+static size_t s_nVisited = 0;
+
+struct BenchItem
+{
+	unsigned int	nKey;
+	size_t			nWeight;
+
+	bool operator<(const BenchItem &rhs) const
+	{ return nKey < rhs.nKey; }
+
+	bool operator==(const BenchItem &rhs) const
+	{ return nKey == rhs.nKey; }
+
+	void OnVisit()
+	{ s_nVisited++; }
+
+	// For selections from many threads at once.
+	void OnSharedVisit()
+	{ }
+
+	size_t Weight() const
+	{ return nWeight; }
+};
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed;
+}
+
+class CStopwatch
+{
+public:
+	CStopwatch() : m_start(chrono::steady_clock::now()) { }
+	double Seconds() const { return chrono::duration<double>(chrono::steady_clock::now() - m_start).count(); }
+
+private:
+	chrono::steady_clock::time_point	m_start;
+};
+
+static void Report(const char *pName, size_t nOps, const CStopwatch &watch)
+{
+	double dSeconds = watch.Seconds();
+	printf("%-28s %12u %10.3f %12.2f\n", pName, (unsigned int)nOps, dSeconds, nOps / dSeconds / 1e6);
+}
+
+// Read-only selection from every hardware thread, each with its own generator.
+static void SelectConcurrently(const Tree<BenchItem> *pTree, size_t nSelects, unsigned int nThreads)
+{
+	vector<thread> threads;
+	for (unsigned int i = 0; i < nThreads; i++)
+	{
+		threads.push_back(thread([pTree, nSelects, i]()
+		{
+			CXoshiro256 random(i + 1);
+			for (size_t j = 0; j < nSelects; j++)
+			{
+				pTree->SelectRandom(random, &BenchItem::OnSharedVisit, true);
+			}
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
+// Build a tree of nNodes/4, then replace one item at a time: every Remove
+// frees a node for the next Add.
+template<typename TTree>
+static void ChurnArenaTree(TTree *pTree, size_t nNodes, const char *pName)
+{
+	unsigned int nSeed = 1;
+	size_t nLive = nNodes / 4;
+	for (size_t i = 0; i < nLive; i++)
+	{
+		BenchItem item = { (unsigned int)i, 1 + NextRandom(&nSeed) % 100 };
+		pTree->Add(item);
+	}
+
+	CStopwatch watch;
+	for (size_t i = nLive; i < nNodes + nLive; i++)
+	{
+		BenchItem old = { (unsigned int)(i - nLive), 0 };
+		pTree->Remove(old);
+		BenchItem item = { (unsigned int)i, 1 + NextRandom(&nSeed) % 100 };
+		pTree->Add(item);
+	}
+	Report(pName, nNodes, watch);
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	size_t nNodes = (argc > 1) ? (size_t)atol(argv[1]) : 1000000;
+
+	printf("%-28s %12s %10s %12s\n", "operation", "ops", "seconds", "M ops/sec");
+
+	Tree<BenchItem> tree;
+	unsigned int nSeed = 1;
+	{
+		CStopwatch watch;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			BenchItem item = { NextRandom(&nSeed), 1 + NextRandom(&nSeed) % 100 };
+			tree.Add(item);
+		}
+		Report("Add (random keys)", nNodes, watch);
+	}
+
+	{
+		// Replace on equal: same keys again, new weights.
+		CStopwatch watch;
+		nSeed = 1;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			BenchItem item = { NextRandom(&nSeed), 0 };
+			item.nWeight = 1 + NextRandom(&nSeed) % 50;
+			tree.Add(item);
+		}
+		Report("Add (replace existing)", nNodes, watch);
+	}
+
+	{
+		CStopwatch watch;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			tree.SelectRandom(&BenchItem::OnVisit, true);
+		}
+		Report("SelectRandom (repeat)", nNodes, watch);
+	}
+
+	{
+		unsigned int nThreads = MAX(thread::hardware_concurrency(), 1u);
+		CStopwatch watch;
+		SelectConcurrently(&tree, nNodes, nThreads);
+		char name[64];
+		snprintf(name, sizeof(name), "SelectRandom (%u threads)", nThreads);
+		Report(name, nNodes * nThreads, watch);
+	}
+
+	{
+		// Same draws as above, kBatch at a time.
+		vector<BenchItem*> selected;
+		selected.reserve(kBatch);
+		CStopwatch watch;
+		for (size_t i = 0; i < nNodes; i += kBatch)
+		{
+			selected.clear();
+			tree.SelectRandomBatch(kBatch, back_inserter(selected), true, true);
+		}
+		Report("SelectRandomBatch (repeat)", nNodes, watch);
+	}
+
+	{
+		vector<BenchItem*> selected;
+		selected.reserve(kBatch);
+		CStopwatch watch;
+		for (size_t i = 0; i < nNodes; i += kBatch)
+		{
+			selected.clear();
+			tree.SelectRandomBatch(kBatch, back_inserter(selected), false, true);
+		}
+		Report("SelectRandomBatch (distinct)", nNodes, watch);
+	}
+
+	{
+		CStopwatch watch;
+		for (size_t i = 0; i < nNodes / 2; i++)
+		{
+			tree.SelectRandom(&BenchItem::OnVisit, false);
+		}
+		Report("SelectRandom (no repeat)", nNodes / 2, watch);
+	}
+
+	{
+		CStopwatch watch;
+		tree.ResetWeights();
+		Report("ResetWeights (per node)", nNodes, watch);
+	}
+
+	{
+		CStopwatch watch;
+		s_nVisited = 0;
+		tree.TraverseRandom(&BenchItem::OnVisit);
+		Report("TraverseRandom (per node)", s_nVisited, watch);
+	}
+
+	{
+		// Everything's taken now.  Put it all back in O(1) and go again.
+		CStopwatch watch;
+		s_nVisited = 0;
+		tree.NewGeneration();
+		tree.TraverseRandom(&BenchItem::OnVisit);
+		Report("NewGeneration + TraverseRandom", s_nVisited, watch);
+	}
+
+	{
+		CStopwatch watch;
+		s_nVisited = 0;
+		tree.TraverseInOrder(&BenchItem::OnVisit);
+		Report("TraverseInOrder (per node)", s_nVisited, watch);
+	}
+
+	{
+		// Same keys again, weights changed in place.
+		CStopwatch watch;
+		nSeed = 1;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			BenchItem item = { NextRandom(&nSeed), 0 };
+			tree.UpdateWeight(item, NextRandom(&nSeed) % 50);
+		}
+		Report("UpdateWeight", nNodes, watch);
+	}
+
+	{
+		// Ranges of a 16th of the key space, from all over.
+		CStopwatch watch;
+		nSeed = 1;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			BenchItem lo = { NextRandom(&nSeed), 0 };
+			BenchItem hi = { lo.nKey + (1u << 28), 0 };
+			if (hi.nKey < lo.nKey)
+			{
+				hi.nKey = ~0u;
+			}
+			tree.SelectRandomInRange(lo, hi, true);
+		}
+		Report("SelectRandomInRange", nNodes, watch);
+	}
+
+	{
+		CStopwatch watch;
+		s_nVisited = 0;
+		for (Tree<BenchItem>::const_iterator it = tree.begin(); it != tree.end(); ++it)
+		{
+			s_nVisited++;
+		}
+		Report("const_iterator (per node)", s_nVisited, watch);
+	}
+
+	{
+		CStopwatch watch;
+		nSeed = 1;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			BenchItem item = { NextRandom(&nSeed), 0 };
+			NextRandom(&nSeed);
+			tree.Remove(item);
+		}
+		Report("Remove", nNodes, watch);
+	}
+
+	{
+		// Sorted keys: the skewed case, always inserting at the far right.
+		CStopwatch watch;
+		Tree<BenchItem> sorted;
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			BenchItem item = { (unsigned int)i, 1 };
+			sorted.Add(item);
+		}
+		Report("Add (sorted keys)", nNodes, watch);
+	}
+
+	{
+		// The same sorted keys, all at once.
+		vector<BenchItem> items(nNodes);
+		for (size_t i = 0; i < nNodes; i++)
+		{
+			items[i].nKey = (unsigned int)i;
+			items[i].nWeight = 1;
+		}
+		CStopwatch watch;
+		Tree<BenchItem> built;
+		built.BuildFromSorted(items.begin(), items.end());
+		Report("BuildFromSorted", nNodes, watch);
+	}
+
+	{
+		// Two trees of random keys, half the nodes each, into one.
+		Tree<BenchItem> merged, other;
+		nSeed = 1;
+		for (size_t i = 0; i < nNodes / 2; i++)
+		{
+			BenchItem item = { NextRandom(&nSeed), 1 + NextRandom(&nSeed) % 100 };
+			merged.Add(item);
+			item.nKey = NextRandom(&nSeed);
+			other.Add(item);
+		}
+		CStopwatch watch;
+		merged.Merge(other);
+		Report("Merge (per node)", nNodes, watch);
+	}
+
+	{
+		CArenaAllocator arena;
+		ArenaTree<BenchItem> arenaTree((CArenaStlAllocator<BenchItem>(&arena)));
+		{
+			CStopwatch watch;
+			nSeed = 1;
+			for (size_t i = 0; i < nNodes; i++)
+			{
+				BenchItem item = { NextRandom(&nSeed), 1 + NextRandom(&nSeed) % 100 };
+				arenaTree.Add(item);
+			}
+			Report("Add (arena nodes)", nNodes, watch);
+		}
+		{
+			CStopwatch watch;
+			for (size_t i = 0; i < nNodes; i++)
+			{
+				arenaTree.SelectRandom(&BenchItem::OnVisit, true);
+			}
+			Report("SelectRandom (arena nodes)", nNodes, watch);
+		}
+	}
+
+	{
+		CArenaAllocator arena, recyclingArena;
+		ArenaTree<BenchItem> arenaTree((CArenaStlAllocator<BenchItem>(&arena)));
+		ArenaRecyclingTree<BenchItem> recyclingTree((CArenaRecyclingStlAllocator<BenchItem>(&recyclingArena)));
+		ChurnArenaTree(&arenaTree, nNodes, "Churn (arena nodes)");
+		ChurnArenaTree(&recyclingTree, nNodes, "Churn (recycled nodes)");
+		printf("  arena peak bytes: %u, recycled %u\n",
+			(unsigned int)arena.GetStats().nPeakBytes, (unsigned int)recyclingArena.GetStats().nPeakBytes);
+	}
+
+	return 0;
+}
@@ -0,0 +1,432 @@
+// TreeStress.cpp : Random runs of the weighted random Tree's operations,
+// checked against a plain model of the tree after every round.
+//
+// Keys come from a small range, so Adds keep landing on items already
+// there.  Every round does one of: Add, Remove, UpdateWeight, a selection
+// (single with or without repeats, in a key range, or a distinct batch
+// then a batch with replacement), NewGeneration, and now and then
+// BuildFromSorted from a sorted run with repeated keys, Merge with a
+// second random tree holding taken items of its own, ResetWeights or
+// CopyFrom.  Each item carries the round it was made in, so the model can
+// tell which of two equal items stayed.
+//
+// After every round AssertValid (which checks in debug builds), and the
+// items in order must be the model's, each with the model's weight as it
+// stands (0 if taken), walking forward and back with both the prefix and
+// postfix steps.  WeightInRange, lower_bound and upper_bound for a random
+// range must agree with the model too.  A selection must come from the
+// model's live items (a distinct batch from distinct ones, a batch with
+// replacement all k, repeats and all), and one without repeats takes the
+// item out of the model's running until NewGeneration.
+//
+// Run on a Tree, an ArenaTree and an ArenaRecyclingTree.
+//
+// Usage: TreeStress [rounds] [seed]   default 100,000 rounds, seed 1.
+
+#include "stdafx.h"
+
+#include <map>
+#include <set>
+
+#include "Tree.h"
+#include "ArenaContainers.h"
+
+static const unsigned int kKeys = 200;
+static const unsigned int kMaxWeight = 16;
+static const unsigned int kBatch = 8;
+static const unsigned int kRareOdds = 16;
+
+static unsigned int NextRandom(unsigned int *pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return *pSeed >> 8;
+}
+
+#define CHECK(x) if (!(x)) { printf("FAILED: %s (line %d)\n", #x, __LINE__); return false; }
+
+struct StressItem
+{
+	unsigned int	nKey;
+	unsigned int	nWeight;
+	unsigned int	nRound;		// when it was made, to tell equal items apart
+
+	bool operator<(const StressItem &rhs) const
+	{ return nKey < rhs.nKey; }
+
+	bool operator==(const StressItem &rhs) const
+	{ return nKey == rhs.nKey; }
+
+	void OnSelect()
+	{ s_pSelected = this; }
+
+	size_t Weight() const
+	{ return nWeight; }
+
+	static StressItem	*s_pSelected;
+};
+
+StressItem *StressItem::s_pSelected = NULL;
+
+static StressItem RandomItem(unsigned int nRound, unsigned int *pSeed)
+{
+	StressItem item;
+	item.nKey = NextRandom(pSeed) % kKeys;
+	item.nWeight = NextRandom(pSeed) % kMaxWeight;	// 0 too: in the tree, never selected
+	item.nRound = nRound;
+	return item;
+}
+
+static StressItem KeyItem(unsigned int nKey)
+{
+	StressItem item = { nKey, 0, 0 };
+	return item;
+}
+
+// The model: each key's item, its weight as it stands and whether it's taken.
+struct ModelItem
+{
+	StressItem	item;
+	size_t		nWeight;
+	bool		bTaken;
+
+	size_t LiveWeight() const { return bTaken ? 0 : nWeight; }
+};
+
+typedef map<unsigned int, ModelItem> Model;
+
+static void ModelAdd(Model *pModel, const StressItem &item)
+{
+	ModelItem entry = { item, item.nWeight, false };
+	(*pModel)[item.nKey] = entry;
+}
+
+static size_t LiveItems(const Model &model)
+{
+	size_t nLive = 0;
+	for (Model::const_iterator it = model.begin(); it != model.end(); ++it)
+	{
+		nLive += (it->second.LiveWeight() != 0);
+	}
+	return nLive;
+}
+
+// Weight of the model's keys in [nLo, nHi).
+static unsigned __int64 ModelWeightInRange(const Model &model, unsigned int nLo, unsigned int nHi)
+{
+	unsigned __int64 nWeight = 0;
+	for (Model::const_iterator it = model.lower_bound(nLo); (it != model.end()) && (it->first < nHi); ++it)
+	{
+		nWeight += it->second.LiveWeight();
+	}
+	return nWeight;
+}
+
+// A selection must be a live item of the model's; without repeats it's then taken.
+static bool CheckSelected(Model *pModel, const StressItem *pItem, bool bAllowRepeat)
+{
+	CHECK(pItem != NULL);
+	Model::iterator it = pModel->find(pItem->nKey);
+	CHECK(it != pModel->end());
+	CHECK(it->second.item.nRound == pItem->nRound);
+	CHECK(it->second.LiveWeight() != 0);
+	if (!bAllowRepeat)
+	{
+		it->second.bTaken = true;
+	}
+	return true;
+}
+
+template<typename TTree>
+static bool CheckTree(const TTree &tree, const Model &model, unsigned int *pSeed)
+{
+	tree.AssertValid();
+
+	typename TTree::const_iterator it = tree.begin();
+	for (Model::const_iterator mit = model.begin(); mit != model.end(); ++mit, ++it)
+	{
+		CHECK(it != tree.end());
+		CHECK(it->nKey == mit->first);
+		CHECK(it->nRound == mit->second.item.nRound);
+		CHECK(it.Weight() == mit->second.LiveWeight());
+	}
+	CHECK(it == tree.end());
+
+	// Back from end() to begin() with --it, then across again with it++
+	// and back with it--, which must hand back where they stepped from.
+	for (Model::const_reverse_iterator rit = model.rbegin(); rit != model.rend(); ++rit)
+	{
+		CHECK(it != tree.begin());
+		--it;
+		CHECK(it->nKey == rit->first);
+	}
+	CHECK(it == tree.begin());
+
+	for (Model::const_iterator mit = model.begin(); mit != model.end(); ++mit)
+	{
+		typename TTree::const_iterator before(it);
+		CHECK((it++)->nKey == mit->first);
+		CHECK(before != it);
+		CHECK(++before == it);
+	}
+	CHECK(it == tree.end());
+
+	for (Model::const_reverse_iterator rit = model.rbegin(); rit != model.rend(); ++rit)
+	{
+		typename TTree::const_iterator before(it);
+		CHECK(it-- == before);
+		CHECK(it->nKey == rit->first);
+	}
+	CHECK(it == tree.begin());
+
+	unsigned int nLo = NextRandom(pSeed) % (kKeys + 1);
+	unsigned int nHi = nLo + NextRandom(pSeed) % (kKeys + 1 - nLo);
+	CHECK(tree.WeightInRange(KeyItem(nLo), KeyItem(nHi)) == ModelWeightInRange(model, nLo, nHi));
+
+	Model::const_iterator lower = model.lower_bound(nLo);
+	it = tree.lower_bound(KeyItem(nLo));
+	CHECK((lower == model.end()) ? (it == tree.end()) : ((it != tree.end()) && (it->nKey == lower->first)));
+
+	Model::const_iterator upper = model.upper_bound(nLo);
+	it = tree.upper_bound(KeyItem(nLo));
+	CHECK((upper == model.end()) ? (it == tree.end()) : ((it != tree.end()) && (it->nKey == upper->first)));
+	return true;
+}
+
+// A few random Adds, UpdateWeights and selections without repeats.
+template<typename TTree>
+static bool FillRandom(TTree *pTree, Model *pModel, unsigned int nRound, unsigned int *pSeed)
+{
+	unsigned int nItems = NextRandom(pSeed) % kKeys;
+	for (unsigned int i = 0; i < nItems; i++)
+	{
+		StressItem item = RandomItem(nRound, pSeed);
+		pTree->Add(item);
+		ModelAdd(pModel, item);
+
+		if (0 == NextRandom(pSeed) % 8)
+		{
+			size_t nWeight = NextRandom(pSeed) % kMaxWeight;
+			CHECK(pTree->UpdateWeight(item, nWeight));
+			(*pModel)[item.nKey].nWeight = nWeight;
+		}
+		if ((0 == NextRandom(pSeed) % 8) && pTree->SelectRandom(&StressItem::OnSelect, false))
+		{
+			CHECK(CheckSelected(pModel, StressItem::s_pSelected, false));
+		}
+	}
+	return true;
+}
+
+template<typename TAlloc>
+static bool StressTree(const char *pName, const TAlloc &alloc, unsigned int nRounds, unsigned int nSeed)
+{
+	typedef Tree<StressItem, CXoshiro256, TAlloc> TTree;
+
+	printf("  %s\n", pName);
+
+	TTree tree(alloc);
+	Model model;
+	tree.Seed(nSeed);
+
+	for (unsigned int nRound = 1; nRound <= nRounds; nRound++)
+	{
+		unsigned int nAction = NextRandom(&nSeed) % 10;
+		if ((nAction == 9) && (NextRandom(&nSeed) % kRareOdds))
+		{
+			nAction = NextRandom(&nSeed) % 9;
+		}
+
+		switch (nAction)
+		{
+		case 0:
+		case 1:
+			{
+				StressItem item = RandomItem(nRound, &nSeed);
+				tree.Add(item);
+				ModelAdd(&model, item);
+			}
+			break;
+
+		case 2:
+			{
+				unsigned int nKey = NextRandom(&nSeed) % kKeys;
+				CHECK(tree.Remove(KeyItem(nKey)) == (model.erase(nKey) != 0));
+			}
+			break;
+
+		case 3:
+			{
+				unsigned int nKey = NextRandom(&nSeed) % kKeys;
+				size_t nWeight = NextRandom(&nSeed) % kMaxWeight;
+				Model::iterator it = model.find(nKey);
+				CHECK(tree.UpdateWeight(KeyItem(nKey), nWeight) == (it != model.end()));
+				if (it != model.end())
+				{
+					it->second.nWeight = nWeight;
+					it->second.bTaken = false;
+				}
+			}
+			break;
+
+		case 4:
+			{
+				bool bAllowRepeat = (NextRandom(&nSeed) % 2) != 0;
+				StressItem::s_pSelected = NULL;
+				bool bSelected = tree.SelectRandom(&StressItem::OnSelect, bAllowRepeat);
+				CHECK(bSelected == (LiveItems(model) != 0));
+				if (bSelected)
+				{
+					CHECK(CheckSelected(&model, StressItem::s_pSelected, bAllowRepeat));
+				}
+			}
+			break;
+
+		case 5:
+			{
+				bool bAllowRepeat = (NextRandom(&nSeed) % 2) != 0;
+				unsigned int nLo = NextRandom(&nSeed) % kKeys;
+				unsigned int nHi = nLo + NextRandom(&nSeed) % (kKeys - nLo);
+				StressItem *pItem = tree.SelectRandomInRange(KeyItem(nLo), KeyItem(nHi), bAllowRepeat);
+				CHECK((pItem != NULL) == (ModelWeightInRange(model, nLo, nHi) != 0));
+				if (pItem)
+				{
+					CHECK((pItem->nKey >= nLo) && (pItem->nKey < nHi));
+					CHECK(CheckSelected(&model, pItem, bAllowRepeat));
+				}
+			}
+			break;
+
+		case 6:
+			{
+				// Distinct, so as many as there are live items to give.
+				bool bAllowRepeat = (NextRandom(&nSeed) % 2) != 0;
+				size_t k = 1 + NextRandom(&nSeed) % kBatch;
+				vector<StressItem*> selected;
+				CHECK(tree.SelectRandomBatch(k, back_inserter(selected), false, bAllowRepeat) == selected.size());
+				CHECK(selected.size() == MIN(k, LiveItems(model)));
+
+				set<unsigned int> keys;
+				for (size_t i = 0; i < selected.size(); i++)
+				{
+					CHECK(keys.insert(selected[i]->nKey).second);
+					CHECK(CheckSelected(&model, selected[i], bAllowRepeat));
+				}
+
+				// With replacement: all k draws, repeats allowed.  Every one
+				// was live before any were taken.
+				bAllowRepeat = (NextRandom(&nSeed) % 2) != 0;
+				k = 1 + NextRandom(&nSeed) % kBatch;
+				selected.clear();
+				CHECK(tree.SelectRandomBatch(k, back_inserter(selected), true, bAllowRepeat) == selected.size());
+				CHECK(selected.size() == (LiveItems(model) ? k : 0));
+				for (size_t i = 0; i < selected.size(); i++)
+				{
+					CHECK(CheckSelected(&model, selected[i], true));
+				}
+				for (size_t i = 0; !bAllowRepeat && (i < selected.size()); i++)
+				{
+					model[selected[i]->nKey].bTaken = true;
+				}
+			}
+			break;
+
+		case 7:
+		case 8:
+			tree.NewGeneration();
+			for (Model::iterator it = model.begin(); it != model.end(); ++it)
+			{
+				it->second.bTaken = false;
+			}
+			break;
+
+		default:
+			switch (NextRandom(&nSeed) % 4)
+			{
+			case 0:
+				{
+					// Sorted, with runs of equal keys: the last of each stays.
+					vector<StressItem> items;
+					unsigned int nItems = NextRandom(&nSeed) % (2 * kKeys);
+					for (unsigned int i = 0; i < nItems; i++)
+					{
+						items.push_back(RandomItem(nRound, &nSeed));
+						items.back().nRound = nRound * 1000 + i;
+					}
+					stable_sort(items.begin(), items.end());
+					tree.BuildFromSorted(items.begin(), items.end());
+
+					model.clear();
+					for (size_t i = 0; i < items.size(); i++)
+					{
+						ModelAdd(&model, items[i]);
+					}
+				}
+				break;
+
+			case 1:
+				{
+					// Where both have a key, other's item stays, weight and taken as it stands.
+					TTree other(alloc);
+					Model otherModel;
+					other.Seed(nRound);
+					CHECK(FillRandom(&other, &otherModel, nRound, &nSeed));
+					CHECK(CheckTree(other, otherModel, &nSeed));
+
+					tree.Merge(other);
+					CHECK(other.begin() == other.end());
+					for (Model::iterator it = otherModel.begin(); it != otherModel.end(); ++it)
+					{
+						model[it->first] = it->second;
+					}
+				}
+				break;
+
+			case 2:
+				tree.ResetWeights();
+				for (Model::iterator it = model.begin(); it != model.end(); ++it)
+				{
+					it->second.nWeight = it->second.item.nWeight;
+					it->second.bTaken = false;
+				}
+				break;
+
+			default:
+				{
+					// A copy has the weights as they stand, nothing taken.
+					TTree copy(alloc);
+					copy.CopyFrom(tree);
+					for (Model::iterator it = model.begin(); it != model.end(); ++it)
+					{
+						it->second.bTaken = false;
+					}
+					CHECK(CheckTree(copy, model, &nSeed));
+
+					// And the original goes on as the copy.
+					tree.CopyFrom(copy);
+				}
+				break;
+			}
+			break;
+		}
+
+		CHECK(CheckTree(tree, model, &nSeed));
+	}
+	return true;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	unsigned int nRounds = (argc > 1) ? (unsigned int)atol(argv[1]) : 100000;
+	unsigned int nSeed = (argc > 2) ? (unsigned int)atol(argv[2]) : 1;
+
+	printf("%u rounds, seed %u\n", nRounds, nSeed);
+
+	CArenaAllocator arena, recyclingArena;
+	bool bSucceeded =
+		StressTree("Tree", allocator<StressItem>(), nRounds, nSeed) &&
+		StressTree("ArenaTree", CArenaStlAllocator<StressItem>(&arena), nRounds, nSeed) &&
+		StressTree("ArenaRecyclingTree", CArenaRecyclingStlAllocator<StressItem>(&recyclingArena), nRounds, nSeed);
+
+	puts(bSucceeded ? "Succeeded" : "FAILED!!!");
+	return bSucceeded ? 0 : 1;
+}